@@ -1,9 +1,23 @@
+#include <algorithm>
+
 #include "BackConverter.hpp"
 
 #include "SliceMatcher.hpp"
+#include "SliceMask.hpp"
 
 using namespace type_to_vector;
 
+void AbstractBackConverter::applyBatch(const double* vectors, int size, 
+        int outer_stride, int count, void* const* targets) {
+
+    VectorOfDoubles vod;
+
+    for (int i = 0; i < count; i++, vectors += outer_stride) {
+        vod.assign(vectors, vectors + size);
+        apply(vod, targets[i]);
+    }
+}
+
 void FlatBackConverter::setSlice(const std::string& slice) {
 
     if ( mpMatcher ) {
@@ -11,7 +25,8 @@ void FlatBackConverter::setSlice(const std::string& slice) {
         mpMatcher = 0;
     }
 
-    if (slice != "") mpMatcher = new SliceMatcher(slice);
+    // a "*" in a place only fits a "*" of the slice, as with SliceMatcher
+    if (slice != "") mpMatcher = new SliceAutomaton(slice, false);
 }
 
 FlatBackConverter::~FlatBackConverter() {
@@ -40,7 +55,7 @@ void FlatBackConverter::setElement(const VectorValueInfo& info) {
 
     if (mElementCounter >= mpVec->size()) return;
 
-    if (!mpMatcher || mpMatcher->fitsASlice(info.placeDescription)) {
+    if (!mpMatcher || mpMatcher->fitsASlice(info.placeDescription.toString())) {
 
         info.backCastFun(getPosition(info), mpVec->at(mElementCounter));
         mElementCounter++;
@@ -87,10 +102,11 @@ void BackConverter::setElement(const VectorValueInfo& info) {
     
     if (mpMatcher) {
 
-        if (info.placeDescription != "" ) mPlaceStack.push_back(info.placeDescription);
+        if (!info.placeDescription.empty()) 
+            mPlaceStack.push_back(info.placeDescription.toString());
         std::string this_place = utilmm::join(mPlaceStack,".");
         push_this = mpMatcher->fitsASlice(this_place);
-        if (info.placeDescription != "" ) mPlaceStack.pop_back();
+        if (!info.placeDescription.empty()) mPlaceStack.pop_back();
     }
 
     if (push_this) {
@@ -104,21 +120,17 @@ void BackConverter::visit(const VectorValueInfo& info) {
     // If there is a content pointer, it means this is a container. 
     if (info.content.get()) {
         
-        const Typelib::Container& t = 
-            static_cast<const Typelib::Container&>(*mrRegistry.get(info.containerType));
         void* ptr = getPosition(info);
-        unsigned int ecnt = t.getElementCount( ptr );
+        unsigned int ecnt = info.container.getElementCount( ptr );
         if ( ecnt == 0 ) return;
         
-        unsigned int esize = t.getIndirection().getSize();
-        std::vector<uint8_t>* vector_ptr = 
-            reinterpret_cast<std::vector<uint8_t>*>( ptr );
-        mBaseStack.push_back(&(*vector_ptr)[0]);
+        unsigned int esize = info.container.elementSize;
+        mBaseStack.push_back(const_cast<uint8_t*>(info.container.getElements(ptr)));
         mContainersSizeStack.push_back(0);
        
         int istar;
         if (mpMatcher) {
-            mPlaceStack.push_back(info.placeDescription);
+            mPlaceStack.push_back(info.placeDescription.toString());
             istar = mPlaceStack.back().size()-1;
         }
         
@@ -138,3 +150,59 @@ void BackConverter::visit(const VectorValueInfo& info) {
     }
     else setElement(info); 
 }
+
+CompiledBackConverter::CompiledBackConverter(const VectorToc& toc,
+        const Typelib::Registry& registry) :
+    AbstractBackConverter(VectorToc::withResolvedContainers(toc, registry)),
+    mrRegistry(registry), mPolicy(BackCastTruncate), mErrorCount(0) {
+
+    mpProgram = ConversionProgram::compile(mToc, mrRegistry);
+}
+
+void CompiledBackConverter::apply(const VectorOfDoubles& vec, void* data) {
+
+    if (!vec.empty()) mpProgram->scatter(&vec[0], vec.size(), data, mPolicy, &mErrorCount);
+}
+
+int CompiledBackConverter::apply(const double* vec, int size, void* data) {
+
+    if (size <= 0) return 0;
+
+    return mpProgram->scatter(vec, size, data, mPolicy, &mErrorCount);
+}
+
+int CompiledBackConverter::apply(const double* vec, int size, 
+        const std::vector<unsigned int>& shape, void* data) {
+
+    return mpProgram->scatter(vec, std::max(size, 0), data, shape, mPolicy, 
+            &mErrorCount);
+}
+
+void CompiledBackConverter::apply(const VectorOfDoubles& vec, 
+        const std::vector<unsigned int>& shape, void* data) {
+
+    mpProgram->scatter(vec.empty() ? 0 : &vec[0], vec.size(), data, shape, mPolicy,
+            &mErrorCount);
+}
+
+void CompiledBackConverter::applyBatch(const double* vectors, int size, 
+        int outer_stride, int count, void* const* targets) {
+
+    if (size <= 0 || count <= 0) return;
+
+    if (mpProgram->isFlat()) {
+        mpProgram->scatterBatch(vectors, size, outer_stride, count, targets, mPolicy, 
+                &mErrorCount);
+        return;
+    }
+
+    for (int i = 0; i < count; i++, vectors += outer_stride)
+        mpProgram->scatter(vectors, size, targets[i], mPolicy, &mErrorCount);
+}
+
+void CompiledBackConverter::setSlice(const std::string& slice) {
+
+    SliceMaskPointer mask = SliceMask::create(mToc, slice);
+
+    mpProgram = ConversionProgram::compile(mToc, mrRegistry, mask.get());
+}
@@ -5,15 +5,19 @@
 #ifndef TYPETOVECTOR_BACKCONVERTER_HPP
 #define TYPETOVECTOR_BACKCONVERTER_HPP
 
+#include <stdexcept>
+#include <vector>
+
 #include <Eigen/Core>
 #include <typelib/value.hh>
 
 #include "Definitions.hpp"
 #include "VectorToc.hpp"
+#include "CompiledConverter.hpp"
 
 namespace type_to_vector {
 
-class SliceMatcher;
+class SliceAutomaton;
 
 /** Base class for the back converters. */
 class AbstractBackConverter {
@@ -36,12 +40,58 @@ public:
     void fromEigen(const Eigen::DenseBase<Derived>& vec, void* target) {
 
         VectorOfDoubles vod;
-        vod.resize(vec.size());
-        for(int i = 0; i < vec.size(); i++) vod[i] = vec.data()[i];
+        vod.reserve(vec.size());
+        for(int j = 0; j < vec.cols(); j++) 
+            for(int i = 0; i < vec.rows(); i++) vod.push_back(vec(i,j));
 
         apply(vod, target);  
     }
 
+    /** Fills a batch of targets, column \c i of \p vectors goes to \c targets[i].
+     *
+     * \param size is the number of values of each column.
+     * \param outer_stride is the number of doubles from one column to the next,
+     *  e.g. the rows of the matrix a block of columns is taken from.
+     * \param vectors points to the first column. */
+    virtual void applyBatch(const double* vectors, int size, int outer_stride, int count,
+            void* const* targets);
+
+    /** Fills a batch of targets from columns that follow each other. */
+    void applyBatch(const double* vectors, int size, int count, void* const* targets) {
+        applyBatch(vectors, size, size, count, targets);
+    }
+
+    /** Fills a batch of targets from the columns of \p vectors.
+     *
+     * \p vectors is a double matrix or a block of one, so blocks need no copy.
+     * Its columns need contiguous values, a row vector has one value each.
+     * \throws std::runtime_error if the values of a column are not contiguous. */
+    template <typename Derived>
+    void applyBatch(const Eigen::DenseBase<Derived>& vectors, void* const* targets) {
+
+        // a row major matrix steps through a column with its outer stride
+        int row_step = Derived::IsRowMajor ? vectors.outerStride() : vectors.innerStride();
+        int column_step = Derived::IsRowMajor ? vectors.innerStride() : vectors.outerStride();
+
+        if (vectors.rows() > 1 && row_step != 1)
+            throw std::runtime_error("batch columns need to be contiguous");
+
+        applyBatch(vectors.derived().data(), vectors.rows(), column_step,
+                vectors.cols(), targets);
+    }
+
+    /** Fills a batch of targets that are \p stride bytes apart, e.g. in an array. */
+    template <typename Derived>
+    void applyBatch(const Eigen::DenseBase<Derived>& vectors, void* first, int stride) {
+
+        std::vector<void*> targets(vectors.cols());
+
+        for (int i = 0; i < vectors.cols(); i++)
+            targets[i] = static_cast<uint8_t*>(first) + i*stride;
+
+        applyBatch(vectors, targets.empty() ? 0 : &targets[0]);
+    }
+
     const VectorToc mToc;
 };
 
@@ -65,7 +115,7 @@ protected:
     virtual void visit(const VectorValueInfo& info);
 
     void* mpData;
-    SliceMatcher* mpMatcher;
+    SliceAutomaton* mpMatcher;
     const VectorOfDoubles* mpVec;
     unsigned int mElementCounter;
 };
@@ -83,7 +133,8 @@ class BackConverter : public FlatBackConverter {
 
 public:
     BackConverter(const VectorToc& toc, const Typelib::Registry& registry) : 
-        FlatBackConverter(toc), mrRegistry(registry) {}
+        FlatBackConverter(VectorToc::withResolvedContainers(toc, registry)), 
+        mrRegistry(registry) {}
 
     virtual void apply(const VectorOfDoubles& vec, void* data);
 
@@ -98,5 +149,82 @@ protected:
     utilmm::stringlist mPlaceStack;
 };
 
+/** Fills the type with data from a vector with a compiled program.
+ *
+ * Does the same as BackConverter. The toc, and the slice if one is set, are 
+ * compiled once into a ConversionProgram, that is run backwards: the values of
+ * the vector are scattered to their byte offsets in flat loops per scalar kind,
+ * without visitors, cast functions or matching of places.
+ *
+ * Other than BackConverter it can resize the containers of the type from a 
+ * shape in the same pass.
+ */
+class CompiledBackConverter : public AbstractBackConverter {
+
+public:
+    CompiledBackConverter(const VectorToc& toc, const Typelib::Registry& registry);
+
+    virtual void apply(const VectorOfDoubles& vec, void* data);
+
+    /** Fills the type from \p size values at \p vec.
+     *
+     * \returns the number of values written. */
+    int apply(const double* vec, int size, void* data);
+
+    /** Fills the type and resizes its containers to \p shape.
+     *
+     * \p shape holds the element counts of the containers as given by 
+     * ConversionProgram::getShape, e.g. for the data \p vec was converted from.
+     * \returns the number of values written. */
+    int apply(const double* vec, int size, const std::vector<unsigned int>& shape, 
+            void* data);
+
+    /** Fills the type and resizes its containers to \p shape. */
+    void apply(const VectorOfDoubles& vec, const std::vector<unsigned int>& shape,
+            void* data);
+
+    using AbstractBackConverter::fromEigen;
+
+    /** Puts data from a double eigen vector/matrix into the target without a copy. 
+     *
+     * Other scalars, expressions and row major matrices, whose storage is not
+     * in the column by column order, are copied, see AbstractBackConverter. */
+    template <int Rows, int Cols, int Options, int MaxRows, int MaxCols>
+    void fromEigen(const Eigen::Matrix<double, Rows, Cols, Options, MaxRows, MaxCols>& vec,
+            void* target) {
+
+        if ( (Options & Eigen::RowMajor) && vec.rows() > 1 && vec.cols() > 1 )
+            AbstractBackConverter::fromEigen(vec, target);
+        else
+            apply(vec.data(), vec.size(), target);
+    }
+
+    using AbstractBackConverter::applyBatch;
+
+    /** Writes the batch run by run for flat programs, without a copy. */
+    void applyBatch(const double* vectors, int size, int outer_stride, int count, 
+            void* const* targets);
+
+    /** Sets a slice and compiles the toc for it. "" is no slice. */
+    void setSlice(const std::string& slice);
+
+    /** Sets how values are cast to integers, BackCastTruncate by default. */
+    void setBackCastPolicy(BackCastPolicy policy) { mPolicy = policy; }
+    BackCastPolicy getBackCastPolicy() const { return mPolicy; }
+
+    /** The number of values out of range since the last reset, counted with
+     *  BackCastChecked. */
+    unsigned int getErrorCount() const { return mErrorCount; }
+    void resetErrorCount() { mErrorCount = 0; }
+
+    const ConversionProgram& getProgram() const { return *mpProgram; }
+
+protected:
+    const Typelib::Registry& mrRegistry;
+    ConversionProgramPointer mpProgram;
+    BackCastPolicy mPolicy;
+    unsigned int mErrorCount;
+};
+
 } // namespace type_to_vector
 #endif // TYPETOVECTOR_BACKCONVERTER_HPP
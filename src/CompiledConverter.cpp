@@ -0,0 +1,1194 @@
+// \file  CompiledConverter.cpp
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <boost/lexical_cast.hpp>
+#include <typelib/registry.hh>
+
+#include "ConversionKernels.hpp"
+#include "CompiledConverter.hpp"
+
+using namespace type_to_vector;
+
+namespace {
+
+template <typename T>
+inline double readValue (const uint8_t* ptr) { 
+    return double(*reinterpret_cast<const T*>(ptr)); 
+}
+
+template <>
+inline double readValue<void> (const uint8_t* ptr) { return 0.0; }
+
+/** The kernels are templates on the output type \c Out, double or float. */
+template <typename T, typename Out>
+void convertTypedRun (const uint8_t* base, const ConversionRun& run, Out* out) {
+
+    const unsigned int* offset = &run.offsets[0];
+    const unsigned int* index = &run.indices[0];
+    const unsigned int n = run.offsets.size();
+
+    for ( unsigned int i=0; i<n; i++ )
+        out[index[i]] = Out(readValue<T>(base + offset[i]));
+}
+
+template <typename T, typename Out>
+void convertTypedRunBatch (const void* const* samples, int count, const ConversionRun& run, 
+        Out* out, int stride) {
+
+    for ( int s=0; s<count; s++, out += stride )
+        convertTypedRun<T>(static_cast<const uint8_t*>(samples[s]), run, out);
+}
+
+template <typename T, typename Out>
+void convertStridedRun (const uint8_t* base, const StridedRun& run, Out* out) {
+
+    convertStrided<T>(base + run.offset, run.stride, run.count, out + run.index);
+}
+
+template <typename T, typename Out>
+void convertStridedRunBatch (const void* const* samples, int count, const StridedRun& run,
+        Out* out, int stride) {
+
+    for ( int s=0; s<count; s++, out += stride )
+        convertStridedRun<T>(static_cast<const uint8_t*>(samples[s]), run, out);
+}
+
+/** Calls the function instantiation for a scalar kind. */
+#define TYPETOVECTOR_DISPATCH_KIND(kind, FUN, ARGS) \
+    switch (kind) { \
+    case SInt8: FUN<int8_t> ARGS; break; \
+    case SInt16: FUN<int16_t> ARGS; break; \
+    case SInt32: FUN<int32_t> ARGS; break; \
+    case SInt64: FUN<int64_t> ARGS; break; \
+    case UInt8: FUN<uint8_t> ARGS; break; \
+    case UInt16: FUN<uint16_t> ARGS; break; \
+    case UInt32: FUN<uint32_t> ARGS; break; \
+    case UInt64: FUN<uint64_t> ARGS; break; \
+    case Float32: FUN<float> ARGS; break; \
+    case Float64: FUN<double> ARGS; break; \
+    case LongDouble: FUN<long double> ARGS; break; \
+    case NullScalar: FUN<void> ARGS; break; \
+    default: \
+        throw std::runtime_error("unknown scalar kind in conversion run"); \
+    }
+
+template <typename Out>
+void convertRun (const uint8_t* base, const ConversionRun& run, Out* out) {
+
+    TYPETOVECTOR_DISPATCH_KIND(run.kind, convertTypedRun, (base, run, out))
+}
+
+template <typename Out>
+void convertRunBatch (const void* const* samples, int count, const ConversionRun& run, 
+        Out* out, int stride) {
+
+    TYPETOVECTOR_DISPATCH_KIND(run.kind, convertTypedRunBatch, 
+            (samples, count, run, out, stride))
+}
+
+template <typename Out>
+void convertRun (const uint8_t* base, const StridedRun& run, Out* out) {
+
+    TYPETOVECTOR_DISPATCH_KIND(run.kind, convertStridedRun, (base, run, out))
+}
+
+template <typename Out>
+void convertRunBatch (const void* const* samples, int count, const StridedRun& run, 
+        Out* out, int stride) {
+
+    TYPETOVECTOR_DISPATCH_KIND(run.kind, convertStridedRunBatch, 
+            (samples, count, run, out, stride))
+}
+
+/** Converts a run and transforms the values as given by the block. */
+template <typename T, typename Out>
+void convertTypedRunAffine (const uint8_t* base, const ConversionRun& run, 
+        const ConversionBlock& block, Out* out) {
+
+    const unsigned int* offset = &run.offsets[0];
+    const unsigned int* index = &run.indices[0];
+    const unsigned int n = run.offsets.size();
+
+    if ( block.scales.empty() ) {
+
+        const double scale = block.scale, shift = block.offset;
+
+        for ( unsigned int i=0; i<n; i++ )
+            out[index[i]] = Out(readValue<T>(base + offset[i]) * scale + shift);
+
+    } else {
+
+        const double* scales = &block.scales[0];
+        const double* shifts = &block.offsets[0];
+
+        for ( unsigned int i=0; i<n; i++ )
+            out[index[i]] = Out(readValue<T>(base + offset[i]) * scales[index[i]] + 
+                shifts[index[i]]);
+    }
+}
+
+template <typename Out>
+void convertRunAffine (const uint8_t* base, const ConversionRun& run, 
+        const ConversionBlock& block, Out* out) {
+
+    TYPETOVECTOR_DISPATCH_KIND(run.kind, convertTypedRunAffine, (base, run, block, out))
+}
+
+/** Transforms \p n converted values of the output index \p index on into \p out. */
+template <typename Out>
+void transformStrided (const double* values, unsigned int index, unsigned int n,
+        const ConversionBlock& block, Out* out) {
+
+    Out* dest = out + index;
+
+    if ( block.scales.empty() ) {
+
+        const double scale = block.scale, shift = block.offset;
+
+        for ( unsigned int i=0; i<n; i++ )
+            dest[i] = Out(values[i] * scale + shift);
+
+    } else {
+
+        const double* scales = &block.scales[index];
+        const double* shifts = &block.offsets[index];
+
+        for ( unsigned int i=0; i<n; i++ )
+            dest[i] = Out(values[i] * scales[i] + shifts[i]);
+    }
+}
+
+/** Converts a strided run and transforms the values while they are cached. */
+inline void convertStridedAffine (const uint8_t* base, const StridedRun& run, 
+        const ConversionBlock& block, double* out) {
+
+    convertRun(base, run, out);
+    transformStrided(out + run.index, run.index, run.count, block, out);
+}
+
+/** Number of values a strided run with float output converts at once. */
+const unsigned int StridedChunkSize = 256;
+
+/** Converts a strided run in chunks of doubles and transforms them before 
+ *  narrowing, like the other runs. */
+template <typename Out>
+void convertStridedAffine (const uint8_t* base, const StridedRun& run, 
+        const ConversionBlock& block, Out* out) {
+
+    double values[StridedChunkSize];
+    StridedRun part = run;
+    part.index = 0;
+
+    for ( unsigned int done=0; done<run.count; done += part.count ) {
+
+        part.offset = run.offset + done * run.stride;
+        part.count = std::min(run.count - done, StridedChunkSize);
+
+        convertRun(base, part, values);
+        transformStrided(values, run.index + done, part.count, block, out);
+    }
+}
+
+/** Converts the runs of a block, \p out is the output of the block. */
+template <typename Out>
+void convertBlock (const uint8_t* base, const ConversionBlock& block, Out* out) {
+
+    std::vector<ConversionRun>::const_iterator rit = block.runs.begin();
+    std::vector<StridedRun>::const_iterator sit = block.stridedRuns.begin();
+
+    if ( !block.hasAffine() ) {
+
+        for ( ; rit != block.runs.end(); rit++ )
+            convertRun(base, *rit, out);
+
+        for ( ; sit != block.stridedRuns.end(); sit++ )
+            convertRun(base, *sit, out);
+
+        return;
+    }
+
+    for ( ; rit != block.runs.end(); rit++ )
+        convertRunAffine(base, *rit, block, out);
+
+    for ( ; sit != block.stridedRuns.end(); sit++ )
+        convertStridedAffine(base, *sit, block, out);
+}
+
+/** Converts a batch of samples with a flat program. */
+template <typename Out>
+void runBatchInto (const ConversionProgram& program, const void* const* samples, 
+        int count, Out* out, int stride) {
+
+    if ( !program.isFlat() ) 
+        throw std::runtime_error("batch runs are only possible for flat programs");
+
+    if ( program.empty() ) return;
+
+    const ConversionBlock& block = program.front();
+
+    if ( block.hasAffine() ) {
+        for ( int i=0; i<count; i++ )
+            convertBlock(static_cast<const uint8_t*>(samples[i]), block, out + i*stride);
+        return;
+    }
+
+    std::vector<ConversionRun>::const_iterator rit = block.runs.begin();
+
+    for ( ; rit != block.runs.end(); rit++ )
+        convertRunBatch(samples, count, *rit, out, stride);
+
+    std::vector<StridedRun>::const_iterator sit = block.stridedRuns.begin();
+
+    for ( ; sit != block.stridedRuns.end(); sit++ )
+        convertRunBatch(samples, count, *sit, out, stride);
+}
+
+/** The values are transformed in double and narrowed once for float outputs. */
+template <typename T, typename Out>
+void runFusedTyped (const uint8_t* base, const FusedProgram::Run& run, Out* const* outs) {
+
+    const unsigned int n = run.offsets.size();
+    const FusedProgram::Target* targets = &run.targets[0];
+    const unsigned int* first = &run.firstTarget[0];
+
+    for ( unsigned int i=0; i<n; i++ ) {
+
+        double value = readValue<T>(base + run.offsets[i]);
+
+        for ( unsigned int t = first[i]; t < first[i+1]; t++ )
+            outs[targets[t].output][targets[t].index] = 
+                Out(value * targets[t].factor + targets[t].offset);
+    }
+}
+
+template <typename Out>
+void runFused (const uint8_t* base, const FusedProgram::Run& run, Out* const* outs) {
+
+    TYPETOVECTOR_DISPATCH_KIND(run.kind, runFusedTyped, (base, run, outs))
+}
+
+template <typename T, typename Cast>
+void scatterRunCast (const double* in, unsigned int n, const ConversionRun& run, 
+        uint8_t* base, Cast& cast) {
+
+    const unsigned int* offset = &run.offsets[0];
+    const unsigned int* index = &run.indices[0];
+
+    for ( unsigned int i=0; i<n; i++ )
+        *reinterpret_cast<T*>(base + offset[i]) = cast(in[index[i]]);
+}
+
+template <typename T>
+void scatterRun (const double* in, unsigned int limit, const ConversionRun& run, 
+        uint8_t* base, BackCastPolicy policy, unsigned int& errors) {
+
+    // the indices of a run are ascending
+    const unsigned int n = std::lower_bound(run.indices.begin(), run.indices.end(), limit)
+        - run.indices.begin();
+
+    if ( !std::numeric_limits<T>::is_integer ) policy = BackCastTruncate;
+
+    switch ( policy ) {
+    case BackCastSaturate: {
+        SaturateCast<T> cast;
+        scatterRunCast<T>(in, n, run, base, cast);
+        break;
+    }
+    case BackCastRound: {
+        RoundCast<T> cast;
+        scatterRunCast<T>(in, n, run, base, cast);
+        break;
+    }
+    case BackCastChecked: {
+        CheckedCast<T> cast;
+        scatterRunCast<T>(in, n, run, base, cast);
+        errors += cast.errors;
+        break;
+    }
+    default: {
+        const unsigned int* offset = &run.offsets[0];
+        const unsigned int* index = &run.indices[0];
+
+        for ( unsigned int i=0; i<n; i++ )
+            *reinterpret_cast<T*>(base + offset[i]) = T(in[index[i]]);
+    }
+    }
+}
+
+template <>
+void scatterRun<void> (const double* in, unsigned int limit, const ConversionRun& run,
+        uint8_t* base, BackCastPolicy policy, unsigned int& errors) {}
+
+template <typename T>
+void scatterStridedRun (const double* in, unsigned int limit, const StridedRun& run,
+        uint8_t* base, BackCastPolicy policy, unsigned int& errors) {
+
+    if ( limit <= run.index ) return;
+
+    in += run.index;
+    base += run.offset;
+    unsigned int count = std::min(run.count, limit - run.index);
+
+    if ( !std::numeric_limits<T>::is_integer ) policy = BackCastTruncate;
+
+    switch ( policy ) {
+    case BackCastSaturate: {
+        SaturateCast<T> cast;
+        storeStridedCast<T>(in, count, base, run.stride, cast);
+        break;
+    }
+    case BackCastRound: {
+        RoundCast<T> cast;
+        storeStridedCast<T>(in, count, base, run.stride, cast);
+        break;
+    }
+    case BackCastChecked: {
+        CheckedCast<T> cast;
+        storeStridedCast<T>(in, count, base, run.stride, cast);
+        errors += cast.errors;
+        break;
+    }
+    default:
+        storeStrided<T>(in, count, base, run.stride);
+    }
+}
+
+template <>
+void scatterStridedRun<void> (const double* in, unsigned int limit, const StridedRun& run,
+        uint8_t* base, BackCastPolicy policy, unsigned int& errors) {}
+
+template <typename T>
+void scatterRunBatch (const double* in, unsigned int limit, int stride, int count, 
+        const ConversionRun& run, void* const* samples, BackCastPolicy policy, 
+        unsigned int& errors) {
+
+    for ( int s=0; s<count; s++, in += stride )
+        scatterRun<T>(in, limit, run, static_cast<uint8_t*>(samples[s]), policy, errors);
+}
+
+template <typename T>
+void scatterStridedRunBatch (const double* in, unsigned int limit, int stride, int count,
+        const StridedRun& run, void* const* samples, BackCastPolicy policy, 
+        unsigned int& errors) {
+
+    for ( int s=0; s<count; s++, in += stride )
+        scatterStridedRun<T>(in, limit, run, static_cast<uint8_t*>(samples[s]), policy,
+                errors);
+}
+
+/** Writes the first \p limit values of a block back, \p in is the output of the
+ *  block. */
+void scatterBlock (const double* in, unsigned int limit, const ConversionBlock& block,
+        uint8_t* base, BackCastPolicy policy, unsigned int& errors) {
+
+    std::vector<ConversionRun>::const_iterator rit = block.runs.begin();
+    std::vector<StridedRun>::const_iterator sit = block.stridedRuns.begin();
+
+    for ( ; rit != block.runs.end(); rit++ )
+        TYPETOVECTOR_DISPATCH_KIND(rit->kind, scatterRun, 
+                (in, limit, *rit, base, policy, errors))
+
+    for ( ; sit != block.stridedRuns.end(); sit++ )
+        TYPETOVECTOR_DISPATCH_KIND(sit->kind, scatterStridedRun, 
+                (in, limit, *sit, base, policy, errors))
+}
+
+} // namespace
+
+
+ConversionBlock::ConversionBlock () : size(0), containerPosition(0), scale(1.0), 
+    offset(0.0) {}
+
+void ConversionBlock::addValue (const VectorValueInfo& info) {
+
+    if ( info.scalarKind == NoScalar )
+        throw std::runtime_error("cannot compile a toc value without scalar kind");
+
+    std::vector<ConversionRun>::iterator it = runs.begin();
+
+    for ( ; it != runs.end(); it++ )
+        if ( it->kind == info.scalarKind ) break;
+
+    if ( it == runs.end() ) {
+        runs.push_back(ConversionRun(info.scalarKind));
+        it = runs.end()-1;
+    }
+
+    it->offsets.push_back(info.position);
+    it->indices.push_back(size);
+    places.push_back(info.placeDescription.toString());
+    size++;
+}
+
+
+void ConversionBlock::findStridedRuns (unsigned int min_count) {
+
+    std::vector<ConversionRun> remaining;
+
+    std::vector<ConversionRun>::const_iterator it = runs.begin();
+
+    for ( ; it != runs.end(); it++ ) {
+
+        const std::vector<unsigned int>& offsets = it->offsets;
+        const std::vector<unsigned int>& indices = it->indices;
+        unsigned int n = offsets.size();
+
+        ConversionRun rest(it->kind);
+
+        unsigned int i = 0;
+
+        while ( i < n ) {
+
+            unsigned int j = i;
+
+            if ( i+1 < n && indices[i+1] == indices[i]+1 && offsets[i+1] > offsets[i] ) {
+
+                unsigned int stride = offsets[i+1] - offsets[i];
+
+                j = i+1;
+                while ( j+1 < n && indices[j+1] == indices[j]+1 && 
+                        offsets[j+1] == offsets[j] + stride )
+                    j++;
+
+                if ( j-i+1 >= min_count ) {
+
+                    StridedRun sr;
+                    sr.kind = it->kind;
+                    sr.offset = offsets[i];
+                    sr.stride = stride;
+                    sr.index = indices[i];
+                    sr.count = j-i+1;
+
+                    stridedRuns.push_back(sr);
+
+                    i = j+1;
+                    continue;
+                }
+            }
+
+            for ( ; i <= j; i++ ) {
+                rest.offsets.push_back(offsets[i]);
+                rest.indices.push_back(indices[i]);
+            }
+        }
+
+        if ( !rest.offsets.empty() ) remaining.push_back(rest);
+    }
+
+    runs = remaining;
+}
+
+
+ConversionProgramPointer ConversionProgram::compile (const VectorToc& toc,
+        const Typelib::Registry& registry, const SliceMask* mask) {
+
+    return compile(toc, registry, mask, 0);
+}
+
+ConversionProgramPointer ConversionProgram::compile (const VectorToc& toc,
+        const Typelib::Registry& registry, const SliceMask* mask, int level) {
+
+    ConversionProgramPointer program(new ConversionProgram());
+    program->push_back(ConversionBlock());
+
+    for ( unsigned int i=0; i<toc.size(); i++ ) {
+
+        const VectorValueInfo& info = toc[i];
+        const SliceMaskEntry* entry = mask ? &(*mask)[i] : 0;
+
+        if ( entry && entry->state == SliceMaskEntry::Skip ) continue;
+
+        if ( info.content.get() ) {
+
+            if ( level >= MaxContainerDepth )
+                throw std::runtime_error("containers are nested too deep for a compilation");
+
+            ConversionBlock& block = program->back();
+
+            if ( info.container.isResolved() ) 
+                block.container = info.container;
+            else {
+                const Typelib::Type* type = registry.get(info.containerType);
+
+                if ( !type || type->getCategory() != Typelib::Type::Container )
+                    throw std::runtime_error("cannot resolve container " + info.containerType);
+
+                block.container = ContainerHandle(
+                        static_cast<const Typelib::Container&>(*type));
+            }
+
+            block.containerPosition = info.position;
+            block.containerPlace = info.placeDescription.toString();
+            block.content = compile(*(info.content), registry, 
+                    entry ? entry->content.get() : 0, level+1);
+            if ( entry ) block.slice = *entry;
+            block.findStridedRuns();
+
+            program->push_back(ConversionBlock());
+
+        } else if ( entry && entry->state == SliceMaskEntry::Check ) {
+
+            if ( program->back().size != 0 ) {
+                program->back().findStridedRuns();
+                program->push_back(ConversionBlock());
+            }
+
+            program->back().slice = *entry;
+            program->back().addValue(info);
+
+            program->push_back(ConversionBlock());
+
+        } else
+            program->back().addValue(info);
+    }
+
+    program->back().findStridedRuns();
+
+    if ( program->back().size == 0 ) program->pop_back();
+
+    return program;
+}
+
+bool ConversionProgram::isFlat () const {
+
+    return empty() || ( size() == 1 && !front().container.isResolved() && 
+            front().slice.state != SliceMaskEntry::Check );
+}
+
+unsigned int ConversionProgram::getOutputSize (const void* data) const {
+
+    int indices[MaxContainerDepth];
+
+    return getOutputSize(data, indices, 0);
+}
+
+unsigned int ConversionProgram::getOutputSize (const void* data, int* indices, 
+        int level) const {
+
+    const uint8_t* base = static_cast<const uint8_t*>(data);
+    unsigned int n = 0;
+
+    for ( const_iterator it = begin(); it != end(); it++ ) {
+
+        if ( it->slice.state != SliceMaskEntry::Check || it->slice.fits(indices) )
+            n += it->size;
+
+        if ( !it->container.isResolved() ) continue;
+
+        const void* ptr = base + it->containerPosition;
+        unsigned int ecnt = it->container.getElementCount(ptr);
+        if ( ecnt == 0 ) continue;
+
+        if ( it->content->isFlat() && it->slice.allElements ) {
+            n += ecnt * it->content->getOutputSize(0);
+            continue;
+        }
+
+        const uint8_t* elements = it->container.getElements(ptr);
+
+        for ( unsigned int i=0; i<ecnt; i++ ) {
+
+            if ( !it->slice.needsElement(i) ) continue;
+
+            indices[level] = i;
+            n += it->content->getOutputSize(elements + i*it->container.elementSize, indices, 
+                    level+1);
+        }
+    }
+
+    return n;
+}
+
+unsigned int ConversionProgram::run (const void* data, double* out) const {
+
+    int indices[MaxContainerDepth];
+
+    return run(data, out, indices, 0);
+}
+
+unsigned int ConversionProgram::run (const void* data, float* out) const {
+
+    int indices[MaxContainerDepth];
+
+    return run(data, out, indices, 0);
+}
+
+template <typename Out>
+unsigned int ConversionProgram::run (const void* data, Out* out, int* indices, 
+        int level) const {
+
+    const uint8_t* base = static_cast<const uint8_t*>(data);
+    Out* cursor = out;
+
+    for ( const_iterator it = begin(); it != end(); it++ ) {
+
+        if ( it->slice.state != SliceMaskEntry::Check || it->slice.fits(indices) ) {
+            convertBlock(base, *it, cursor);
+            cursor += it->size;
+        }
+
+        if ( !it->container.isResolved() ) continue;
+
+        const void* ptr = base + it->containerPosition;
+        unsigned int ecnt = it->container.getElementCount(ptr);
+        if ( ecnt == 0 ) continue;
+
+        const uint8_t* elements = it->container.getElements(ptr);
+
+        for ( unsigned int i=0; i<ecnt; i++ ) {
+
+            if ( !it->slice.needsElement(i) ) continue;
+
+            indices[level] = i;
+            cursor += it->content->run(elements + i*it->container.elementSize, cursor, indices,
+                    level+1);
+        }
+    }
+
+    return cursor - out;
+}
+
+unsigned int ConversionProgram::scatter (const double* in, unsigned int size, 
+        void* data, BackCastPolicy policy, unsigned int* errors) const {
+
+    int indices[MaxContainerDepth];
+    unsigned int shape_idx = 0, out_of_range = 0;
+
+    unsigned int n = scatter(in, size, data, indices, 0, 0, shape_idx, policy, 
+            out_of_range);
+
+    if ( errors ) *errors += out_of_range;
+
+    return n;
+}
+
+unsigned int ConversionProgram::scatter (const double* in, unsigned int size, 
+        void* data, const std::vector<unsigned int>& shape, BackCastPolicy policy,
+        unsigned int* errors) const {
+
+    int indices[MaxContainerDepth];
+    unsigned int shape_idx = 0, out_of_range = 0;
+
+    unsigned int n = scatter(in, size, data, indices, 0, &shape, shape_idx, policy,
+            out_of_range);
+
+    if ( errors ) *errors += out_of_range;
+
+    return n;
+}
+
+unsigned int ConversionProgram::scatter (const double* in, unsigned int size, void* data,
+        int* indices, int level, const std::vector<unsigned int>* shape, 
+        unsigned int& shape_idx, BackCastPolicy policy, unsigned int& errors) const {
+
+    uint8_t* base = static_cast<uint8_t*>(data);
+    unsigned int n = 0;
+
+    // with a shape the containers after the last value are resized as well
+    for ( const_iterator it = begin(); it != end() && (n < size || shape); it++ ) {
+
+        if ( it->slice.state != SliceMaskEntry::Check || it->slice.fits(indices) ) {
+            unsigned int limit = std::min(it->size, size - n);
+            scatterBlock(in + n, limit, *it, base, policy, errors);
+            n += limit;
+        }
+
+        if ( !it->container.isResolved() ) continue;
+
+        void* ptr = base + it->containerPosition;
+
+        if ( shape ) {
+            if ( shape_idx >= shape->size() )
+                throw std::runtime_error("the shape has less element counts than containers");
+            it->container.resize(ptr, (*shape)[shape_idx++]);
+        }
+
+        unsigned int ecnt = it->container.getElementCount(ptr);
+        if ( ecnt == 0 ) continue;
+
+        uint8_t* elements = const_cast<uint8_t*>(it->container.getElements(ptr));
+
+        for ( unsigned int i=0; i<ecnt && (n < size || shape); i++ ) {
+
+            if ( !it->slice.needsElement(i) ) continue;
+
+            indices[level] = i;
+            n += it->content->scatter(in + n, size - n, elements + i*it->container.elementSize,
+                    indices, level+1, shape, shape_idx, policy, errors);
+        }
+    }
+
+    return n;
+}
+
+void ConversionProgram::scatterBatch (const double* in, unsigned int size, int stride,
+        int count, void* const* samples, BackCastPolicy policy, 
+        unsigned int* errors) const {
+
+    if ( !isFlat() ) 
+        throw std::runtime_error("batch runs are only possible for flat programs");
+
+    if ( empty() ) return;
+
+    unsigned int limit = std::min(front().size, size);
+    unsigned int out_of_range = 0;
+
+    std::vector<ConversionRun>::const_iterator rit = front().runs.begin();
+
+    for ( ; rit != front().runs.end(); rit++ )
+        TYPETOVECTOR_DISPATCH_KIND(rit->kind, scatterRunBatch, 
+                (in, limit, stride, count, *rit, samples, policy, out_of_range))
+
+    std::vector<StridedRun>::const_iterator sit = front().stridedRuns.begin();
+
+    for ( ; sit != front().stridedRuns.end(); sit++ )
+        TYPETOVECTOR_DISPATCH_KIND(sit->kind, scatterStridedRunBatch, 
+                (in, limit, stride, count, *sit, samples, policy, out_of_range))
+
+    if ( errors ) *errors += out_of_range;
+}
+
+void ConversionProgram::runBatch (const void* const* samples, int count, double* out,
+        int stride) const {
+
+    runBatchInto(*this, samples, count, out, stride);
+}
+
+void ConversionProgram::runBatch (const void* const* samples, int count, float* out,
+        int stride) const {
+
+    runBatchInto(*this, samples, count, out, stride);
+}
+
+ConversionProgramPointer ConversionProgram::clone () const {
+
+    ConversionProgramPointer program(new ConversionProgram(*this));
+
+    for ( iterator it = program->begin(); it != program->end(); it++ )
+        if ( it->content ) it->content = it->content->clone();
+
+    return program;
+}
+
+void ConversionProgram::multiply (double factor) {
+
+    for ( iterator it = begin(); it != end(); it++ ) {
+
+        it->scale *= factor;
+        it->offset *= factor;
+
+        for ( unsigned int i=0; i<it->scales.size(); i++ ) {
+            it->scales[i] *= factor;
+            it->offsets[i] *= factor;
+        }
+
+        if ( it->content ) it->content->multiply(factor);
+    }
+}
+
+void ConversionProgram::setAffine (double scale, double offset) {
+
+    for ( iterator it = begin(); it != end(); it++ ) {
+
+        it->scale = scale;
+        it->offset = offset;
+        it->scales.clear();
+        it->offsets.clear();
+
+        if ( it->content ) it->content->setAffine(scale, offset);
+    }
+}
+
+void ConversionProgram::setAffine (const std::vector<double>& scales, 
+        const std::vector<double>& offsets) {
+
+    if ( empty() ) {
+        transform(scales, offsets);
+        return;
+    }
+
+    front().scale = 1.0;
+    front().offset = 0.0;
+    front().scales.clear();
+    front().offsets.clear();
+
+    transform(scales, offsets);
+}
+
+void ConversionProgram::transform (const std::vector<double>& scales, 
+        const std::vector<double>& offsets) {
+
+    if ( !isFlat() )
+        throw std::runtime_error("values can only be transformed one by one in flat programs");
+
+    unsigned int n = empty() ? 0 : front().size;
+
+    if ( scales.size() != n || offsets.size() != n )
+        throw std::runtime_error("transformation does not fit the output size");
+
+    if ( empty() ) return;
+
+    ConversionBlock& block = front();
+
+    if ( block.scales.empty() ) {
+        block.scales.assign(n, block.scale);
+        block.offsets.assign(n, block.offset);
+        block.scale = 1.0;
+        block.offset = 0.0;
+    }
+
+    for ( unsigned int i=0; i<n; i++ ) {
+        block.offsets[i] = block.offsets[i] * scales[i] + offsets[i];
+        block.scales[i] *= scales[i];
+    }
+}
+
+void ConversionProgram::getShape (const void* data, 
+        std::vector<unsigned int>& shape) const {
+
+    int indices[MaxContainerDepth];
+
+    getShape(data, shape, indices, 0);
+}
+
+void ConversionProgram::getShape (const void* data, std::vector<unsigned int>& shape,
+        int* indices, int level) const {
+
+    const uint8_t* base = static_cast<const uint8_t*>(data);
+
+    for ( const_iterator it = begin(); it != end(); it++ ) {
+
+        if ( !it->container.isResolved() ) continue;
+
+        const void* ptr = base + it->containerPosition;
+        unsigned int ecnt = it->container.getElementCount(ptr);
+        shape.push_back(ecnt);
+        if ( ecnt == 0 || it->content->isFlat() ) continue;
+
+        const uint8_t* elements = it->container.getElements(ptr);
+
+        for ( unsigned int i=0; i<ecnt; i++ ) {
+
+            if ( !it->slice.needsElement(i) ) continue;
+
+            indices[level] = i;
+            it->content->getShape(elements + i*it->container.elementSize, shape, indices,
+                    level+1);
+        }
+    }
+}
+
+void ConversionProgram::createPlaces (const void* data,
+        utilmm::stringlist& place_stack, StringVector& places) const {
+
+    int indices[MaxContainerDepth];
+
+    createPlaces(data, place_stack, places, indices, 0);
+}
+
+void ConversionProgram::createPlaces (const void* data,
+        utilmm::stringlist& place_stack, StringVector& places, int* indices, 
+        int level) const {
+
+    const uint8_t* base = static_cast<const uint8_t*>(data);
+
+    for ( const_iterator it = begin(); it != end(); it++ ) {
+
+        if ( it->slice.state != SliceMaskEntry::Check || it->slice.fits(indices) ) {
+
+            StringVector::const_iterator pit = it->places.begin();
+
+            for ( ; pit != it->places.end(); pit++ ) {
+
+                if ( *pit != "" ) place_stack.push_back(*pit);
+                places.push_back(utilmm::join(place_stack, "."));
+                if ( *pit != "" ) place_stack.pop_back();
+            }
+        }
+
+        if ( !it->container.isResolved() ) continue;
+
+        const void* ptr = base + it->containerPosition;
+        unsigned int ecnt = it->container.getElementCount(ptr);
+        if ( ecnt == 0 ) continue;
+
+        const uint8_t* elements = it->container.getElements(ptr);
+
+        place_stack.push_back(it->containerPlace);
+        int istar = place_stack.back().size()-1;
+
+        for ( unsigned int i=0; i<ecnt; i++ ) {
+
+            if ( !it->slice.needsElement(i) ) continue;
+
+            place_stack.back().replace(place_stack.back().begin()+istar,
+                    place_stack.back().end(),
+                    boost::lexical_cast<std::string>(i));
+
+            indices[level] = i;
+            it->content->createPlaces(elements + i*it->container.elementSize, place_stack, places,
+                    indices, level+1);
+        }
+
+        place_stack.pop_back();
+    }
+}
+
+
+namespace {
+
+/** The target of a value with the transformation of its block and a factor. */
+FusedProgram::Target makeTarget (const ConversionBlock& block, unsigned int output,
+        unsigned int index, double factor) {
+
+    FusedProgram::Target target;
+    target.output = output;
+    target.index = index;
+
+    if ( block.scales.empty() ) {
+        target.factor = factor * block.scale;
+        target.offset = factor * block.offset;
+    } else {
+        target.factor = factor * block.scales[index];
+        target.offset = factor * block.offsets[index];
+    }
+
+    return target;
+}
+
+} // namespace
+
+FusedProgramPointer FusedProgram::fuse (
+        const std::vector<ConversionProgramPointer>& programs,
+        const std::vector<double>& factors) {
+
+    // the targets of each value, ordered by kind and offset
+    typedef std::map<std::pair<int, unsigned int>, std::vector<Target> > TargetMap;
+    TargetMap values;
+
+    FusedProgramPointer fused(new FusedProgram());
+
+    for ( unsigned int p=0; p<programs.size(); p++ ) {
+
+        const ConversionProgram& program = *programs[p];
+
+        if ( !program.isFlat() ) 
+            throw std::runtime_error("only flat programs can be fused");
+
+        fused->outputSizes.push_back(program.empty() ? 0 : program.front().size);
+
+        if ( program.empty() ) continue;
+
+        const ConversionBlock& block = program.front();
+
+        for ( unsigned int r=0; r<block.runs.size(); r++ ) {
+
+            const ConversionRun& run = block.runs[r];
+
+            for ( unsigned int i=0; i<run.offsets.size(); i++ ) {
+                Target target = makeTarget(block, p, run.indices[i], factors.at(p));
+                values[std::make_pair(int(run.kind), run.offsets[i])].push_back(target);
+            }
+        }
+
+        for ( unsigned int r=0; r<block.stridedRuns.size(); r++ ) {
+
+            const StridedRun& run = block.stridedRuns[r];
+
+            for ( unsigned int i=0; i<run.count; i++ ) {
+                Target target = makeTarget(block, p, run.index + i, factors.at(p));
+                values[std::make_pair(int(run.kind), run.offset + i*run.stride)]
+                    .push_back(target);
+            }
+        }
+    }
+
+    for ( TargetMap::const_iterator it = values.begin(); it != values.end(); it++ ) {
+
+        ScalarKind kind = ScalarKind(it->first.first);
+
+        if ( fused->runs.empty() || fused->runs.back().kind != kind ) {
+            fused->runs.push_back(Run());
+            fused->runs.back().kind = kind;
+            fused->runs.back().firstTarget.push_back(0);
+        }
+
+        Run& run = fused->runs.back();
+        run.offsets.push_back(it->first.second);
+        run.targets.insert(run.targets.end(), it->second.begin(), it->second.end());
+        run.firstTarget.push_back(run.targets.size());
+    }
+
+    return fused;
+}
+
+void FusedProgram::run (const void* data, double* const* outs) const {
+
+    const uint8_t* base = static_cast<const uint8_t*>(data);
+
+    for ( std::vector<Run>::const_iterator it = runs.begin(); it != runs.end(); it++ )
+        runFused(base, *it, outs);
+}
+
+void FusedProgram::run (const void* data, float* const* outs) const {
+
+    const uint8_t* base = static_cast<const uint8_t*>(data);
+
+    for ( std::vector<Run>::const_iterator it = runs.begin(); it != runs.end(); it++ )
+        runFused(base, *it, outs);
+}
+
+
+CompiledConverter::CompiledConverter (const VectorToc& toc,
+        const Typelib::Registry& registry) :
+    AbstractConverter(toc), mrRegistry(registry), mPlacesValid(false), 
+    mScale(1.0), mOffset(0.0) {
+
+    compile(0);
+}
+
+void CompiledConverter::compile (const SliceMask* mask) {
+
+    ConversionProgramPointer program = ConversionProgram::compile(mToc, mrRegistry, mask);
+
+    int size = program->isFlat() ? program->getOutputSize(0) : -1;
+
+    if ( !mScales.empty() && size != int(mScales.size()) ) {
+        mScales.clear();
+        mOffsets.clear();
+    }
+
+    if ( mScales.empty() ) program->setAffine(mScale, mOffset);
+    else program->setAffine(mScales, mOffsets);
+
+    mpProgram = program;
+    mOutputSize = size;
+}
+
+void CompiledConverter::setSlice (const std::string& slice) {
+
+    SliceMaskPointer mask = SliceMask::create(mToc, slice);
+
+    compile(mask.get());
+
+    mPlaceVector.clear();
+    mPlacesValid = false;
+    placesChanged();
+}
+
+void CompiledConverter::setAffine (double scale, double offset) {
+
+    mScale = scale;
+    mOffset = offset;
+    mScales.clear();
+    mOffsets.clear();
+
+    // a new program, so fused programs made of the old one are rebuilt
+    ConversionProgramPointer program = mpProgram->clone();
+    program->setAffine(scale, offset);
+    mpProgram = program;
+}
+
+void CompiledConverter::setAffine (const VectorOfDoubles& scales, 
+        const VectorOfDoubles& offsets) {
+
+    if ( mOutputSize < 0 )
+        throw std::runtime_error("values can only be transformed one by one for a "
+                "fixed output size");
+
+    ConversionProgramPointer program = mpProgram->clone();
+    program->setAffine(scales, offsets);
+    mpProgram = program;
+
+    mScales = scales;
+    mOffsets = offsets;
+}
+
+int CompiledConverter::getOutputSize () const {
+
+    return mOutputSize;
+}
+
+ConversionProgramPointer CompiledConverter::getFlatProgram (double& factor) const {
+
+    factor = 1.0;
+
+    return mpProgram->isFlat() ? mpProgram : ConversionProgramPointer();
+}
+
+int CompiledConverter::applyInto (void* data, double* out, int size) {
+
+    int n = mOutputSize >= 0 ? mOutputSize : mpProgram->getOutputSize(data);
+
+    if ( n > size ) 
+        throw std::runtime_error("output buffer is too small for the conversion");
+
+    return mpProgram->run(data, out);
+}
+
+int CompiledConverter::applyInto (void* data, float* out, int size) {
+
+    int n = mOutputSize >= 0 ? mOutputSize : mpProgram->getOutputSize(data);
+
+    if ( n > size ) 
+        throw std::runtime_error("output buffer is too small for the conversion");
+
+    return mpProgram->run(data, out);
+}
+
+VectorOfDoubles CompiledConverter::apply (void* data, bool create_place_vector) {
+
+    mVector.resize(mpProgram->getOutputSize(data));
+
+    if ( !mVector.empty() ) mpProgram->run(data, &mVector[0]);
+
+    if ( create_place_vector ) {
+
+        // the places only change with the shape of the data
+        mNewShape.clear();
+        mpProgram->getShape(data, mNewShape);
+
+        if ( !mPlacesValid || mNewShape != mShape ) {
+
+            mPlaceVector.clear();
+            utilmm::stringlist place_stack;
+            mpProgram->createPlaces(data, place_stack, mPlaceVector);
+
+            mShape.swap(mNewShape);
+            mPlacesValid = true;
+            placesChanged();
+        }
+    }
+
+    setPlacesRequested(create_place_vector);
+
+    return mVector;
+}
+
+void CompiledConverter::applyBatch (void* const* samples, int count, 
+        Eigen::MatrixXd& result) {
+
+    if ( mOutputSize < 0 ) {
+        AbstractConverter::applyBatch(samples, count, result);
+        return;
+    }
+
+    result.resize(mOutputSize, count);
+
+    mpProgram->runBatch(samples, count, result.data(), mOutputSize);
+}
+
+void CompiledConverter::applyBatch (void* const* samples, int count, 
+        Eigen::MatrixXf& result) {
+
+    if ( mOutputSize < 0 ) {
+        AbstractConverter::applyBatch(samples, count, result);
+        return;
+    }
+
+    result.resize(mOutputSize, count);
+
+    mpProgram->runBatch(samples, count, result.data(), mOutputSize);
+}
@@ -0,0 +1,349 @@
+/**
+ * \file  CompiledConverter.hpp
+ *
+ * \brief Conversion to vectors with a toc compiled into a flat program.
+ *
+ * A VectorToc is compiled once into a list of blocks. Each block holds the
+ * values of a flat part of the toc grouped by their scalar kind, so a conversion
+ * is a tight loop per kind without visitors, virtual calls or cast functions.
+ * Long runs of equally strided values, like arrays, are converted by vectorized
+ * kernels. Containers end a block and carry the program for their elements.
+ *
+ * The output is double or float, the kernels are instantiated for both.
+ *
+ * A slice is resolved into a SliceMask before the compilation. Values not in the
+ * slice are left out, values that depend on the container indices get a block of
+ * their own that is only run if the indices fit.
+ */
+
+#ifndef TYPETOVECTOR_COMPILEDCONVERTER_HPP
+#define TYPETOVECTOR_COMPILEDCONVERTER_HPP
+
+#include <vector>
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+#include <typelib/typemodel.hh>
+#include <utilmm/stringtools.hh>
+
+#include "Definitions.hpp"
+#include "Converter.hpp"
+#include "SliceMask.hpp"
+
+namespace type_to_vector {
+
+/** All values of one scalar kind in a block of a conversion program.
+ *
+ * The value at \c offsets[i] in the data goes to \c indices[i] in the output of
+ * the block. */
+struct ConversionRun {
+    ScalarKind kind;
+    std::vector<unsigned int> offsets; //!< Byte offsets of the values in the data.
+    std::vector<unsigned int> indices; //!< Indices of the values in the block output.
+
+    ConversionRun (ScalarKind k=NoScalar) : kind(k) {}
+};
+
+/** Values of one scalar kind that are equally strided in the data and follow each
+ *  other in the output.
+ *
+ * They are converted with the kernels in ConversionKernels.hpp. */
+struct StridedRun {
+    ScalarKind kind;
+    unsigned int offset; //!< Byte offset of the first value in the data.
+    unsigned int stride; //!< Distance between the values in bytes.
+    unsigned int index; //!< Index of the first value in the block output.
+    unsigned int count; //!< Number of values.
+};
+
+/** A flat part of a toc, that might be followed by a container. */
+struct ConversionBlock {
+    std::vector<ConversionRun> runs; //!< The values grouped by their kind.
+    std::vector<StridedRun> stridedRuns; //!< Strided values taken out of the runs.
+    unsigned int size; //!< Number of values produced by the runs.
+    StringVector places; //!< Place descriptions of the values in output order.
+
+    ContainerHandle container; //!< The container, not resolved if there is none.
+    unsigned int containerPosition; //!< Byte offset of the container in the data.
+    std::string containerPlace; //!< Place description of the container.
+    ConversionProgramPointer content; //!< Program for a single container element.
+
+    /** For a value with the state Check the condition of the block, else the
+     *  elements of the container that are converted. */
+    SliceMaskEntry slice;
+
+    double scale; //!< The values of the runs become value*scale + offset.
+    double offset;
+    std::vector<double> scales; //!< Per value scales, replace scale and offset if set.
+    std::vector<double> offsets; //!< Per value offsets, as many as scales.
+
+    ConversionBlock ();
+
+    /** True if the values of the runs are transformed after the conversion. */
+    bool hasAffine () const { 
+        return !scales.empty() || scale != 1.0 || offset != 0.0; 
+    }
+
+    /** Adds a value of the toc to the runs. */
+    void addValue (const VectorValueInfo& info);
+
+    /** Moves at least \p min_count strided values of a run into a StridedRun. */
+    void findStridedRuns (unsigned int min_count=4);
+};
+
+/** A VectorToc compiled into a linear list of ConversionBlock. */
+struct ConversionProgram : public std::vector<ConversionBlock> {
+
+    /** Maximum number of nested containers. */
+    static const int MaxContainerDepth = 32;
+
+    /** Compiles a toc.
+     *
+     * \param registry is needed to resolve the containers in the toc.
+     * \param mask is the slice resolved for the toc, 0 means everything.
+     * \throws std::runtime_error if a container cannot be resolved, a value has
+     * no scalar kind or the containers are nested deeper than MaxContainerDepth. */
+    static ConversionProgramPointer compile (const VectorToc& toc,
+            const Typelib::Registry& registry, const SliceMask* mask=0);
+
+    /** True if there are no containers and no conditional blocks, the output size 
+     *  is fixed then. */
+    bool isFlat () const;
+
+    /** The number of values a conversion of \p data gives. */
+    unsigned int getOutputSize (const void* data) const;
+
+    /** Converts \p data into \p out.
+     *
+     * \p out needs to have room for getOutputSize(data) values.
+     * \returns the number of values written. */
+    unsigned int run (const void* data, double* out) const;
+
+    /** Converts \p data into floats, \see run(const void*, double*) */
+    unsigned int run (const void* data, float* out) const;
+
+    /** Converts a batch of samples with a flat program.
+     *
+     * The values of sample \c i are written to \c out+i*stride.
+     * Each run is converted for all samples at once. */
+    void runBatch (const void* const* samples, int count, double* out,
+            int stride) const;
+
+    /** Converts a batch of samples into floats with a flat program. */
+    void runBatch (const void* const* samples, int count, float* out,
+            int stride) const;
+
+    /** Writes the values of \p in back into \p data, the inverse of run.
+     *
+     * The values go to the places run would take them from, as long as there
+     * are values left. Containers are not resized and the transformations 
+     * of the program are not inverted.
+     * \param policy is the cast to integer values.
+     * \param errors is increased by the number of values out of range, if
+     *  \p policy is BackCastChecked.
+     * \returns the number of values written. */
+    unsigned int scatter (const double* in, unsigned int size, void* data,
+            BackCastPolicy policy=BackCastTruncate, unsigned int* errors=0) const;
+
+    /** Writes the values of \p in back into \p data and resizes the containers.
+     *
+     * \p shape gives the element counts of the containers in the order of 
+     * getShape, so the shape of the data the values were converted from
+     * restores its containers. All containers are resized, also those after
+     * the last value.
+     * \returns the number of values written.
+     * \throws std::runtime_error if \p shape has not enough element counts. */
+    unsigned int scatter (const double* in, unsigned int size, void* data,
+            const std::vector<unsigned int>& shape, 
+            BackCastPolicy policy=BackCastTruncate, unsigned int* errors=0) const;
+
+    /** Writes a batch of samples back with a flat program.
+     *
+     * The values for sample \c i are taken from \c in+i*stride, at most 
+     * \p size of them. Each run is written for all samples at once. 
+     * \see scatter */
+    void scatterBatch (const double* in, unsigned int size, int stride, int count,
+            void* const* samples, BackCastPolicy policy=BackCastTruncate, 
+            unsigned int* errors=0) const;
+
+    /** A deep copy, that does not share the programs of the containers. */
+    ConversionProgramPointer clone () const;
+
+    /** Multiplies all values of the program by \p factor after the current
+     *  transformation. */
+    void multiply (double factor);
+
+    /** Transforms all values of the program to value*scale + offset.
+     *
+     * This is done during the conversion, so it costs nearly nothing. It
+     * replaces a previous transformation, also in the container programs. */
+    void setAffine (double scale, double offset=0.0);
+
+    /** Transforms each value of a flat program on its own.
+     *
+     * \throws std::runtime_error if the program is not flat or the sizes do 
+     *  not fit the output size. */
+    void setAffine (const std::vector<double>& scales, const std::vector<double>& offsets);
+
+    /** Transforms each value of a flat program after its current transformation.
+     *
+     * \throws std::runtime_error if the program is not flat or the sizes do 
+     *  not fit the output size. */
+    void transform (const std::vector<double>& scales, const std::vector<double>& offsets);
+
+    /** Appends the element counts of the containers in \p data to \p shape.
+     *
+     * The places of a conversion only depend on this shape. */
+    void getShape (const void* data, std::vector<unsigned int>& shape) const;
+
+    /** Appends the place descriptions for a conversion of \p data to \p places.
+     *
+     * \param place_stack holds the places of the enclosing levels. */
+    void createPlaces (const void* data, utilmm::stringlist& place_stack,
+            StringVector& places) const;
+
+private:
+    static ConversionProgramPointer compile (const VectorToc& toc,
+            const Typelib::Registry& registry, const SliceMask* mask, int level);
+
+    /** \param indices are the indices of the elements of the enclosing containers.
+     *  \param level is the number of enclosing containers. */
+    unsigned int getOutputSize (const void* data, int* indices, int level) const;
+    template <typename Out>
+    unsigned int run (const void* data, Out* out, int* indices, int level) const;
+    /** \param shape are the element counts to resize to, 0 to keep the sizes.
+     *  \param shape_idx is the index of the next element count in \p shape. */
+    unsigned int scatter (const double* in, unsigned int size, void* data, int* indices,
+            int level, const std::vector<unsigned int>* shape, 
+            unsigned int& shape_idx, BackCastPolicy policy, unsigned int& errors) const;
+    void getShape (const void* data, std::vector<unsigned int>& shape, int* indices,
+            int level) const;
+    void createPlaces (const void* data, utilmm::stringlist& place_stack,
+            StringVector& places, int* indices, int level) const;
+};
+
+/** Flat programs of several conversions fused, so each value of the data is read
+ *  once and scattered to all outputs that need it.
+ *
+ * Strided runs of the programs are taken apart, they do not pay off when the
+ * values go to several outputs. */
+struct FusedProgram {
+
+    /** Where a value goes to. */
+    struct Target {
+        unsigned int output; //!< Index of the fused program.
+        unsigned int index; //!< Index in the output of the program.
+        double factor;
+        double offset; //!< Added after the factor.
+    };
+
+    /** All values of one scalar kind.
+     *
+     * The value at \c offsets[i] goes to the targets from \c firstTarget[i] to
+     * \c firstTarget[i+1]. */
+    struct Run {
+        ScalarKind kind;
+        std::vector<unsigned int> offsets;
+        std::vector<unsigned int> firstTarget;
+        std::vector<Target> targets;
+    };
+
+    std::vector<Run> runs;
+    std::vector<unsigned int> outputSizes; //!< Output size of each program.
+
+    /** Fuses flat programs.
+     *
+     * \param factors are the factors for the values of each program, they
+     *  are applied after the transformations of the programs.
+     * \throws std::runtime_error if a program is not flat. */
+    static boost::shared_ptr<FusedProgram> fuse (
+            const std::vector<ConversionProgramPointer>& programs,
+            const std::vector<double>& factors);
+
+    /** Converts \p data for all programs, \c outs[i] has to have room for
+     *  \c outputSizes[i] values. */
+    void run (const void* data, double* const* outs) const;
+
+    /** Converts \p data for all programs into float outputs. */
+    void run (const void* data, float* const* outs) const;
+};
+
+typedef boost::shared_ptr<FusedProgram> FusedProgramPointer;
+
+/** Converts data with a toc compiled into a ConversionProgram.
+ *
+ * The results are the same as of ConvertToVector. The toc is compiled once
+ * during construction and again when a slice is set.
+ *
+ * \warning std containers are handled, but for other containers it might not work. */
+class CompiledConverter : public AbstractConverter {
+
+    const Typelib::Registry& mrRegistry;
+    ConversionProgramPointer mpProgram;
+    int mOutputSize; //!< The fixed output size, -1 if the program has containers.
+
+    std::vector<unsigned int> mShape; //!< Shape of the last data with places.
+    std::vector<unsigned int> mNewShape; //!< Buffer for the shape of new data.
+    bool mPlacesValid; //!< mPlaceVector was created for mShape.
+
+    double mScale, mOffset; //!< Transformation of all values.
+    std::vector<double> mScales, mOffsets; //!< Transformation of each value.
+
+    /** Compiles the toc for a slice and sets the transformation. */
+    void compile (const SliceMask* mask);
+
+public:
+    /** Construction of the converter.
+     *
+     * \param toc is the \c VectorToc that describes the data.
+     * \param registry is needed to resolve the containers during compilation.
+     */
+    CompiledConverter (const VectorToc& toc, const Typelib::Registry& registry);
+
+    VectorOfDoubles apply (void* data, bool create_place_vector = false);
+
+    using AbstractConverter::applyInto;
+
+    /** Converts without any heap allocation. */
+    int applyInto (void* data, double* out, int size);
+
+    /** Converts into floats without any heap allocation. */
+    int applyInto (void* data, float* out, int size);
+
+    int getOutputSize () const;
+    int getOutputSize (void* data) { return mpProgram->getOutputSize(data); }
+
+    using AbstractConverter::applyBatch;
+
+    /** Converts the batch run by run for flat programs. */
+    void applyBatch (void* const* samples, int count, Eigen::MatrixXd& result);
+
+    /** Converts the batch into floats run by run for flat programs. */
+    void applyBatch (void* const* samples, int count, Eigen::MatrixXf& result);
+
+    /** Sets a slice and compiles the toc for it. "" is no slice.
+     *
+     * A transformation of each value is dropped if the output size changes. */
+    void setSlice (const std::string& slice);
+
+    /** Transforms the converted values to value*scale + offset.
+     *
+     * The transformation is done by the conversion kernels, so a scaled 
+     * conversion costs the same as a plain one. */
+    void setAffine (double scale, double offset=0.0);
+
+    /** Transforms each converted value with its own scale and offset.
+     *
+     * \throws std::runtime_error if the output size is not fixed or does not
+     *  fit the sizes of \p scales and \p offsets. */
+    void setAffine (const VectorOfDoubles& scales, const VectorOfDoubles& offsets);
+
+    const ConversionProgram& getProgram () const { return *mpProgram; }
+
+    /** The program if it is flat. */
+    ConversionProgramPointer getFlatProgram (double& factor) const;
+};
+
+} // namespace type_to_vector
+
+#endif // TYPETOVECTOR_COMPILEDCONVERTER_HPP
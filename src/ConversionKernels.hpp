@@ -0,0 +1,295 @@
+/**
+ * \file  ConversionKernels.hpp
+ *
+ * \brief Kernels to convert runs of equally strided scalars to doubles or floats
+ *  and back.
+ *
+ * The generic versions are plain loops the compiler can vectorize. The casts for
+ * the BackCastPolicy clamp with selects instead of branches, so they vectorize
+ * as well. If the library is compiled with AVX2 enabled (the CMake option
+ * TYPETOVECTOR_AVX2, or -mavx2 or -march=native in the flags) floats, doubles and
+ * 32 bit integers are converted to doubles and gathered with vector instructions.
+ * The gathers take 32 bit offsets, larger strides use the plain loops.
+ */
+
+#ifndef TYPETOVECTOR_CONVERSIONKERNELS_HPP
+#define TYPETOVECTOR_CONVERSIONKERNELS_HPP
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdint.h>
+
+#include "NumericConverter.hpp"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace type_to_vector {
+
+/** Converts \p count values of type T that are \p stride bytes apart. */
+template <typename T>
+inline void convertStrided (const uint8_t* src, unsigned int stride, unsigned int count,
+        double* out) {
+
+    if ( stride == sizeof(T) ) {
+
+        const T* values = reinterpret_cast<const T*>(src);
+
+        for ( unsigned int i=0; i<count; i++ )
+            out[i] = double(values[i]);
+
+    } else {
+
+        for ( unsigned int i=0; i<count; i++, src += stride )
+            out[i] = double(*reinterpret_cast<const T*>(src));
+    }
+}
+
+/** Null values are always zero. */
+template <>
+inline void convertStrided<void> (const uint8_t* /*src*/, unsigned int /*stride*/,
+        unsigned int count, double* out) {
+
+    std::fill(out, out+count, 0.0);
+}
+
+#ifdef __AVX2__
+
+/** The largest stride whose gather offsets 0 to 3*stride fit into an int. */
+const unsigned int MaxGatherStride = INT_MAX / 3;
+
+template <>
+inline void convertStrided<float> (const uint8_t* src, unsigned int stride,
+        unsigned int count, double* out) {
+
+    unsigned int i = 0;
+
+    if ( stride == sizeof(float) ) {
+
+        const float* values = reinterpret_cast<const float*>(src);
+
+        for ( ; i+4 <= count; i += 4 )
+            _mm256_storeu_pd(out+i, _mm256_cvtps_pd(_mm_loadu_ps(values+i)));
+
+    } else if ( stride <= MaxGatherStride ) {
+
+        const __m128i vindex = _mm_set_epi32(3*stride, 2*stride, stride, 0);
+
+        for ( ; i+4 <= count; i += 4 )
+            _mm256_storeu_pd(out+i, _mm256_cvtps_pd(_mm_i32gather_ps(
+                    reinterpret_cast<const float*>(src + i*stride), vindex, 1)));
+    }
+
+    for ( ; i<count; i++ )
+        out[i] = double(*reinterpret_cast<const float*>(src + i*stride));
+}
+
+template <>
+inline void convertStrided<int32_t> (const uint8_t* src, unsigned int stride,
+        unsigned int count, double* out) {
+
+    unsigned int i = 0;
+
+    if ( stride == sizeof(int32_t) ) {
+
+        for ( ; i+4 <= count; i += 4 )
+            _mm256_storeu_pd(out+i, _mm256_cvtepi32_pd(_mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(src + i*stride))));
+
+    } else if ( stride <= MaxGatherStride ) {
+
+        const __m128i vindex = _mm_set_epi32(3*stride, 2*stride, stride, 0);
+
+        for ( ; i+4 <= count; i += 4 )
+            _mm256_storeu_pd(out+i, _mm256_cvtepi32_pd(_mm_i32gather_epi32(
+                    reinterpret_cast<const int*>(src + i*stride), vindex, 1)));
+    }
+
+    for ( ; i<count; i++ )
+        out[i] = double(*reinterpret_cast<const int32_t*>(src + i*stride));
+}
+
+template <>
+inline void convertStrided<double> (const uint8_t* src, unsigned int stride,
+        unsigned int count, double* out) {
+
+    if ( stride == sizeof(double) ) {
+        std::memcpy(out, src, count*sizeof(double));
+        return;
+    }
+
+    unsigned int i = 0;
+
+    if ( stride <= MaxGatherStride ) {
+
+        const __m128i vindex = _mm_set_epi32(3*stride, 2*stride, stride, 0);
+
+        for ( ; i+4 <= count; i += 4 )
+            _mm256_storeu_pd(out+i, _mm256_i32gather_pd(
+                    reinterpret_cast<const double*>(src + i*stride), vindex, 1));
+    }
+
+    for ( ; i<count; i++ )
+        out[i] = *reinterpret_cast<const double*>(src + i*stride);
+}
+
+#else
+
+template <>
+inline void convertStrided<double> (const uint8_t* src, unsigned int stride,
+        unsigned int count, double* out) {
+
+    if ( stride == sizeof(double) ) {
+        std::memcpy(out, src, count*sizeof(double));
+        return;
+    }
+
+    for ( unsigned int i=0; i<count; i++, src += stride )
+        out[i] = *reinterpret_cast<const double*>(src);
+}
+
+#endif // __AVX2__
+
+/** Converts \p count values of type T that are \p stride bytes apart to floats. */
+template <typename T>
+inline void convertStrided (const uint8_t* src, unsigned int stride, unsigned int count,
+        float* out) {
+
+    for ( unsigned int i=0; i<count; i++, src += stride )
+        out[i] = float(*reinterpret_cast<const T*>(src));
+}
+
+template <>
+inline void convertStrided<void> (const uint8_t* /*src*/, unsigned int /*stride*/,
+        unsigned int count, float* out) {
+
+    std::fill(out, out+count, 0.0f);
+}
+
+template <>
+inline void convertStrided<float> (const uint8_t* src, unsigned int stride,
+        unsigned int count, float* out) {
+
+    if ( stride == sizeof(float) ) {
+        std::memcpy(out, src, count*sizeof(float));
+        return;
+    }
+
+    for ( unsigned int i=0; i<count; i++, src += stride )
+        out[i] = *reinterpret_cast<const float*>(src);
+}
+
+/** Stores \p count doubles as values of type T that are \p stride bytes apart. */
+template <typename T>
+inline void storeStrided (const double* in, unsigned int count, uint8_t* dst, 
+        unsigned int stride) {
+
+    if ( stride == sizeof(T) ) {
+
+        T* values = reinterpret_cast<T*>(dst);
+
+        for ( unsigned int i=0; i<count; i++ )
+            values[i] = T(in[i]);
+
+    } else {
+
+        for ( unsigned int i=0; i<count; i++, dst += stride )
+            *reinterpret_cast<T*>(dst) = T(in[i]);
+    }
+}
+
+/** Null values have no memory to store to. */
+template <>
+inline void storeStrided<void> (const double* /*in*/, unsigned int /*count*/, 
+        uint8_t* /*dst*/, unsigned int /*stride*/) {}
+
+template <>
+inline void storeStrided<double> (const double* in, unsigned int count, uint8_t* dst,
+        unsigned int stride) {
+
+    if ( stride == sizeof(double) ) {
+        std::memcpy(dst, in, count*sizeof(double));
+        return;
+    }
+
+    for ( unsigned int i=0; i<count; i++, dst += stride )
+        *reinterpret_cast<double*>(dst) = in[i];
+}
+
+/** The range of doubles that can be cast to the integer type T.
+ *
+ * The maximum of 64 bit integers is not a double, the next lower double is taken. */
+template <typename T>
+struct BackCastRange {
+    static double lowest () { return double(std::numeric_limits<T>::min()); }
+    static double highest () {
+        const int digits = std::numeric_limits<T>::digits;
+        return digits > 53 ? std::ldexp(1.0, digits) - std::ldexp(1.0, digits-53)
+            : double(std::numeric_limits<T>::max());
+    }
+};
+
+/** Cast for BackCastSaturate. */
+template <typename T>
+struct SaturateCast {
+    const double lowest, highest;
+
+    SaturateCast () : lowest(BackCastRange<T>::lowest()), 
+        highest(BackCastRange<T>::highest()) {}
+
+    T operator() (double value) const {
+        value = value > lowest ? value : lowest;
+        return T(value < highest ? value : highest);
+    }
+};
+
+/** Cast for BackCastRound. */
+template <typename T>
+struct RoundCast : public SaturateCast<T> {
+    T operator() (double value) const { 
+        return SaturateCast<T>::operator()(::rint(value)); 
+    }
+};
+
+/** Cast for BackCastChecked, counts the values out of range in \c errors. */
+template <typename T>
+struct CheckedCast : public SaturateCast<T> {
+    unsigned int errors;
+
+    CheckedCast () : errors(0) {}
+
+    T operator() (double value) {
+        value = ::rint(value);
+        errors += !(value >= this->lowest && value <= this->highest);
+        return SaturateCast<T>::operator()(value);
+    }
+};
+
+/** Stores \p count doubles as values of type T with \p cast. 
+ *
+ * \see storeStrided */
+template <typename T, typename Cast>
+inline void storeStridedCast (const double* in, unsigned int count, uint8_t* dst, 
+        unsigned int stride, Cast& cast) {
+
+    if ( stride == sizeof(T) ) {
+
+        T* values = reinterpret_cast<T*>(dst);
+
+        for ( unsigned int i=0; i<count; i++ )
+            values[i] = cast(in[i]);
+
+    } else {
+
+        for ( unsigned int i=0; i<count; i++, dst += stride )
+            *reinterpret_cast<T*>(dst) = cast(in[i]);
+    }
+}
+
+} // namespace type_to_vector
+
+#endif // TYPETOVECTOR_CONVERSIONKERNELS_HPP
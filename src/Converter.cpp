@@ -1,12 +1,13 @@
 // \file  Converter.cpp
 
 #include <stdexcept>
+#include <algorithm>
 #include <boost/lexical_cast.hpp>
 #include <typelib/registry.hh>
 
-#include "SliceMatcher.hpp"
-
 #include "Converter.hpp"
+#include "CompiledConverter.hpp"
+#include "MatrixBuffer.hpp"
 
 using namespace type_to_vector;
 
@@ -19,6 +20,135 @@ VectorOfDoubles AbstractConverter::applyToValue (const Typelib::Value& value,
     return apply(value.getData(), create_place_vector);
 }
 
+int AbstractConverter::getOutputSize (void* data) {
+
+    int n = getOutputSize();
+
+    if ( n >= 0 ) return n;
+
+    return applyToScratch(data).size();
+}
+
+const VectorOfDoubles& AbstractConverter::applyToScratch (void* data) {
+
+    bool places_requested = mPlacesRequested;
+    unsigned int place_version = mPlaceVersion;
+
+    // apply fills mVector, that keeps the capacity of the scratch meanwhile
+    mVector.swap(mScratchVector);
+
+    try {
+        apply(data, false);
+    } catch (...) {
+        mVector.swap(mScratchVector);
+        mPlacesRequested = places_requested;
+        mPlaceVersion = place_version;
+        throw;
+    }
+
+    mVector.swap(mScratchVector);
+
+    // a conversion without places does not change the place vector
+    mPlacesRequested = places_requested;
+    mPlaceVersion = place_version;
+
+    return mScratchVector;
+}
+
+ConversionProgramPointer AbstractConverter::getFlatProgram (double& factor) const {
+
+    factor = 1.0;
+
+    return ConversionProgramPointer();
+}
+
+int AbstractConverter::applyInto (void* data, double* out, int size) {
+
+    const VectorOfDoubles& vec = applyToScratch(data);
+
+    if ( int(vec.size()) > size ) 
+        throw std::runtime_error("output buffer is too small for the conversion");
+
+    std::copy(vec.begin(), vec.end(), out);
+
+    return vec.size();
+}
+
+int AbstractConverter::applyInto (void* data, float* out, int size) {
+
+    const VectorOfDoubles& vec = applyToScratch(data);
+
+    if ( int(vec.size()) > size ) 
+        throw std::runtime_error("output buffer is too small for the conversion");
+
+    std::copy(vec.begin(), vec.end(), out);
+
+    return vec.size();
+}
+
+void AbstractConverter::applyBatch (void* const* samples, int count, 
+        Eigen::MatrixXd& result) {
+
+    if ( count == 0 ) {
+        result.resize(std::max(getOutputSize(), 0), 0);
+        return;
+    }
+
+    int n = getOutputSize(samples[0]);
+
+    result.resize(n, count);
+
+    for ( int i=0; i<count; i++ )
+        if ( applyInto(samples[i], result.col(i).data(), n) != n )
+            throw std::runtime_error("samples of a batch give different vector sizes");
+}
+
+void AbstractConverter::applyBatch (void* first, int stride, int count, 
+        Eigen::MatrixXd& result) {
+
+    std::vector<void*> samples(count);
+
+    for ( int i=0; i<count; i++ )
+        samples[i] = first + i*stride;
+
+    applyBatch(count ? &samples[0] : 0, count, result);
+}
+
+void AbstractConverter::applyBatch (void* const* samples, int count, 
+        Eigen::MatrixXf& result) {
+
+    if ( count == 0 ) {
+        result.resize(std::max(getOutputSize(), 0), 0);
+        return;
+    }
+
+    int n = getOutputSize(samples[0]);
+
+    result.resize(n, count);
+
+    for ( int i=0; i<count; i++ )
+        if ( applyInto(samples[i], result.col(i).data(), n) != n )
+            throw std::runtime_error("samples of a batch give different vector sizes");
+}
+
+void AbstractConverter::applyBatch (void* first, int stride, int count, 
+        Eigen::MatrixXf& result) {
+
+    std::vector<void*> samples(count);
+
+    for ( int i=0; i<count; i++ )
+        samples[i] = first + i*stride;
+
+    applyBatch(count ? &samples[0] : 0, count, result);
+}
+
+const StringVector& AbstractConverter::getPlaceVector () const {
+
+    static const StringVector no_places;
+
+    return mPlacesRequested ? mPlaceVector : no_places;
+}
+
 Eigen::VectorXd AbstractConverter::getEigenVector () {
 
     Eigen::VectorXd result;
@@ -37,32 +167,325 @@ VectorOfDoubles SingleConverter::apply (void* data, bool create_place_vector) {
 
         mVector.push_back(mToc.front().castFun(ptr));
     
-        if ( create_place_vector && mPlaceVector.empty() )
-            mPlaceVector.push_back(mToc.front().placeDescription);
+        if ( create_place_vector && mPlaceVector.empty() ) {
+            mPlaceVector.push_back(mToc.front().placeDescription.toString());
+            placesChanged();
+        }
     }
 
+    setPlacesRequested(create_place_vector);
+
     return mVector;
 }
 
+int SingleConverter::applyInto (void* data, double* out, int size) {
+
+    if ( mToc.front().content.get() ) return 0;
+
+    if ( size < 1 ) 
+        throw std::runtime_error("output buffer is too small for the conversion");
+
+    out[0] = mToc.front().castFun(data + mToc.front().position);
+
+    return 1;
+}
+
+int SingleConverter::applyInto (void* data, float* out, int size) {
+
+    if ( mToc.front().content.get() ) return 0;
+
+    if ( size < 1 ) 
+        throw std::runtime_error("output buffer is too small for the conversion");
+
+    out[0] = mToc.front().castFun(data + mToc.front().position);
+
+    return 1;
+}
+
+int SingleConverter::getOutputSize () const {
+
+    return mToc.front().content.get() ? 0 : 1;
+}
+
+ConversionProgramPointer SingleConverter::getFlatProgram (double& factor) const {
+
+    factor = 1.0;
+
+    if ( !mpFlatProgram ) {
+
+        const VectorValueInfo& info = mToc.front();
+
+        if ( !info.content.get() && info.scalarKind == NoScalar ) 
+            return ConversionProgramPointer();
+
+        mpFlatProgram.reset(new ConversionProgram());
+
+        if ( !info.content.get() ) {
+            mpFlatProgram->push_back(ConversionBlock());
+            mpFlatProgram->back().addValue(info);
+        }
+    }
+
+    return mpFlatProgram;
+}
+
 MultiplyConverter::MultiplyConverter (AbstractConverter::Pointer converter, 
         double factor) : AbstractConverter(converter->getToc()), mpConverter(converter), 
-            mFactor(factor) {}
+            mFactor(factor), mSourceFactor(1.0), mScaledSize(0) {}
+
+const ConversionProgram* MultiplyConverter::getScaledProgram () {
+
+    double factor;
+    ConversionProgramPointer program = getFlatProgram(factor);
+
+    if ( !program ) return 0;
+
+    if ( program != mpSourceProgram || factor != mSourceFactor ) {
+        mpScaledProgram = program->clone();
+        mpScaledProgram->multiply(factor);
+        mpSourceProgram = program;
+        mSourceFactor = factor;
+        mScaledSize = mpScaledProgram->getOutputSize(0);
+    }
+
+    return mpScaledProgram.get();
+}
 
 VectorOfDoubles MultiplyConverter::apply (void* data, bool create_place_vector) {
 
-    mVector = mpConverter->apply(data, create_place_vector);
+    const ConversionProgram* program = 
+        create_place_vector ? 0 : getScaledProgram();
+
+    setPlacesRequested(create_place_vector);
+
+    if ( program ) {
+        mVector.resize(mScaledSize);
+        if ( mScaledSize ) program->run(data, &mVector[0]);
+        return mVector;
+    }
+
+    VectorOfDoubles result = mpConverter->apply(data, create_place_vector);
     
-    VectorOfDoubles::iterator it = mVector.begin();
+    VectorOfDoubles::iterator it = result.begin();
 
-    for ( ; it != mVector.end(); it++)
+    for ( ; it != result.end(); it++)
         *it *= mFactor;
 
-    if ( create_place_vector ) mPlaceVector = mpConverter->getPlaceVector();
-    else mPlaceVector.clear();
+    mVector.swap(result);
 
     return mVector;
 }
 
+ConversionProgramPointer MultiplyConverter::getFlatProgram (double& factor) const {
+
+    ConversionProgramPointer program = mpConverter->getFlatProgram(factor);
+    factor *= mFactor;
+
+    return program;
+}
+
+template<typename Scalar>
+int MultiplyConverter::applyScaled (void* data, Scalar* out, int size) {
+
+    const ConversionProgram* program = getScaledProgram();
+
+    if ( program ) {
+        if ( mScaledSize > size )
+            throw std::runtime_error("output buffer is too small for the conversion");
+        return program->run(data, out);
+    }
+
+    int n = mpConverter->applyInto(data, out, size);
+
+    for ( int i=0; i<n; i++ )
+        out[i] = out[i] * mFactor;
+
+    return n;
+}
+
+int MultiplyConverter::applyInto (void* data, double* out, int size) {
+
+    return applyScaled(data, out, size);
+}
+
+int MultiplyConverter::applyInto (void* data, float* out, int size) {
+
+    return applyScaled(data, out, size);
+}
+
+
+
+NormalizeConverter::NormalizeConverter (AbstractConverter::Pointer converter) :
+    AbstractConverter(converter->getToc()), mpConverter(converter), mSourceFactor(1.0),
+    mNormalizationChanged(false) {}
+
+NormalizeConverter::NormalizeConverter (AbstractConverter::Pointer converter, 
+        const VectorOfDoubles& offsets, const VectorOfDoubles& scales) :
+    AbstractConverter(converter->getToc()), mpConverter(converter), mSourceFactor(1.0),
+    mNormalizationChanged(false) {
+
+    setNormalization(offsets, scales);
+}
+
+void NormalizeConverter::setNormalization (const VectorOfDoubles& offsets, 
+        const VectorOfDoubles& scales) {
+
+    int n = mpConverter->getOutputSize();
+
+    if ( offsets.size() != scales.size() || ( n >= 0 && n != int(scales.size()) ) )
+        throw std::runtime_error("normalization does not fit the output size");
+
+    mOffsets = Eigen::Map<const Eigen::VectorXd>(offsets.empty() ? 0 : &offsets[0], 
+            offsets.size());
+    mScales = Eigen::Map<const Eigen::VectorXd>(scales.empty() ? 0 : &scales[0], 
+            scales.size());
+    mNormalizationChanged = true;
+}
+
+void NormalizeConverter::learn (AbstractMatrixBuffer& buffer, int count, 
+        double min_deviation) {
+
+    int available = std::min(buffer.getPushCount(), buffer.getVectorCount());
+
+    if ( count < 0 || count > available ) count = available;
+
+    if ( count == 0 ) 
+        throw std::runtime_error("cannot learn a normalization from an empty buffer");
+
+    const Eigen::MatrixXd& window = buffer.getMatrix(0, count-1);
+
+    Eigen::VectorXd mean = window.rowwise().mean();
+    Eigen::VectorXd deviation = 
+        ((window.colwise() - mean).array().square().rowwise().sum() / count).sqrt();
+
+    VectorOfDoubles offsets(mean.data(), mean.data() + mean.size());
+    VectorOfDoubles scales(mean.size());
+
+    for ( int i=0; i<mean.size(); i++ )
+        scales[i] = deviation[i] > min_deviation ? 1.0 / deviation[i] : 1.0;
+
+    setNormalization(offsets, scales);
+}
+
+VectorOfDoubles NormalizeConverter::getOffsets () const {
+
+    return VectorOfDoubles(mOffsets.data(), mOffsets.data() + mOffsets.size());
+}
+
+VectorOfDoubles NormalizeConverter::getScales () const {
+
+    return VectorOfDoubles(mScales.data(), mScales.data() + mScales.size());
+}
+
+ConversionProgramPointer NormalizeConverter::getFlatProgram (double& factor) const {
+
+    getNormalizedProgram();
+
+    factor = 1.0;
+
+    return mpNormalizedProgram;
+}
+
+const ConversionProgram* NormalizeConverter::getNormalizedProgram () const {
+
+    double factor;
+    ConversionProgramPointer program = mpConverter->getFlatProgram(factor);
+
+    if ( !program ) {
+        mpSourceProgram.reset();
+        mpNormalizedProgram.reset();
+        return 0;
+    }
+
+    if ( program != mpSourceProgram || factor != mSourceFactor || 
+            mNormalizationChanged ) {
+
+        ConversionProgramPointer normalized = program->clone();
+        normalized->multiply(factor);
+
+        if ( mScales.size() ) {
+
+            std::vector<double> scales(mScales.data(), mScales.data() + mScales.size());
+            std::vector<double> offsets(mScales.size());
+
+            for ( unsigned int i=0; i<offsets.size(); i++ )
+                offsets[i] = -mOffsets[i] * mScales[i];
+
+            normalized->transform(scales, offsets);
+        }
+
+        mpNormalizedProgram = normalized;
+        mpSourceProgram = program;
+        mSourceFactor = factor;
+        mNormalizationChanged = false;
+    }
+
+    return mpNormalizedProgram.get();
+}
+
+template<typename Scalar>
+void NormalizeConverter::normalize (Scalar* values, int n) const {
+
+    if ( !mScales.size() ) return;
+
+    if ( n != mScales.size() )
+        throw std::runtime_error("normalization does not fit the output size");
+
+    for ( int i=0; i<n; i++ )
+        values[i] = (values[i] - mOffsets[i]) * mScales[i];
+}
+
+VectorOfDoubles NormalizeConverter::apply (void* data, bool create_place_vector) {
+
+    const ConversionProgram* program = 
+        create_place_vector ? 0 : getNormalizedProgram();
+
+    setPlacesRequested(create_place_vector);
+
+    if ( program ) {
+        mVector.resize(program->getOutputSize(data));
+        if ( !mVector.empty() ) program->run(data, &mVector[0]);
+        return mVector;
+    }
+
+    VectorOfDoubles result = mpConverter->apply(data, create_place_vector);
+
+    if ( !result.empty() ) normalize(&result[0], result.size());
+    else normalize<double>(0, 0);
+
+    mVector.swap(result);
+
+    return mVector;
+}
+
+template<typename Scalar>
+int NormalizeConverter::applyNormalized (void* data, Scalar* out, int size) {
+
+    const ConversionProgram* program = getNormalizedProgram();
+
+    if ( program ) {
+        if ( int(program->getOutputSize(data)) > size )
+            throw std::runtime_error("output buffer is too small for the conversion");
+        return program->run(data, out);
+    }
+
+    int n = mpConverter->applyInto(data, out, size);
+
+    normalize(out, n);
+
+    return n;
+}
+
+int NormalizeConverter::applyInto (void* data, double* out, int size) {
+
+    return applyNormalized(data, out, size);
+}
+
+int NormalizeConverter::applyInto (void* data, float* out, int size) {
+
+    return applyNormalized(data, out, size);
+}
+
 
 void* FlatConverter::getPosition (const VectorValueInfo& info) {
 
@@ -71,18 +494,35 @@ void* FlatConverter::getPosition (const VectorValueInfo& info) {
     return ptr;
 }
 
-void FlatConverter::push_element (const VectorValueInfo& info) {
+bool FlatConverter::isInSlice () const {
 
-    bool push_this = true;
-    
-    if ( mpMatcher && !mpMatcher->fitsASlice(info.placeDescription) ) 
-        push_this = false;
+    if ( !mpMaskEntry ) return true;
+
+    switch ( mpMaskEntry->state ) {
+    case SliceMaskEntry::Skip: return false;
+    case SliceMaskEntry::Check: 
+        return mpMaskEntry->fits(mIndexStack.empty() ? 0 : &mIndexStack[0]);
+    default: return true;
+    }
+}
+
+void FlatConverter::pushValue (double value) {
 
-    if (mCreatePlaceVector && push_this) 
-        mPlaceVector.push_back(info.placeDescription);
+    if ( !mpOut && !mpFloatOut ) {
+        mVector.push_back(value);
+        return;
+    }
+
+    if ( mOutCount == mOutSize )
+        throw std::runtime_error("output buffer is too small for the conversion");
 
-    if (push_this) mVector.push_back( info.castFun(getPosition(info)) );
+    if ( mpOut ) mpOut[mOutCount++] = value;
+    else mpFloatOut[mOutCount++] = value;
+}
+
+void FlatConverter::push_element (const VectorValueInfo& info) {
 
+    if ( isInSlice() ) pushValue( info.castFun(getPosition(info)) );
 }
 
 void FlatConverter::visit (const VectorValueInfo& info) {
@@ -90,136 +530,322 @@ void FlatConverter::visit (const VectorValueInfo& info) {
     if (!info.content.get()) push_element(info);
 }
 
+void FlatConverter::visit (const VectorToc& toc) {
 
-FlatConverter::FlatConverter (const VectorToc& toc) : 
-    AbstractConverter(toc), mpMatcher(0) {}
+    const SliceMask* mask = mMaskStack.empty() ? 0 : mMaskStack.back();
+
+    for ( unsigned int i=0; i<toc.size(); i++ ) {
 
-FlatConverter::~FlatConverter () {
-    delete mpMatcher;
+        mpMaskEntry = mask ? &(*mask)[i] : 0;
+        visit(toc[i]);
+    }
 }
 
-void FlatConverter::setSlice (const std::string& slice) {
 
-    if ( mpMatcher ) {
-        delete mpMatcher;
-        mpMatcher = 0;
+void FlatConverter::createPlaces () {
+
+    mPlaceVector.clear();
+
+    for ( unsigned int i=0; i<mToc.size(); i++ ) 
+        if ( !mToc[i].content.get() && 
+                ( !mpMask || (*mpMask)[i].state != SliceMaskEntry::Skip ) )
+            mPlaceVector.push_back(mToc[i].placeDescription.toString());
+}
+
+void FlatConverter::updatePlaces (bool create_place_vector) {
+
+    setPlacesRequested(create_place_vector);
+
+    if ( create_place_vector && !mPlacesValid ) {
+        createPlaces();
+        mPlacesValid = true;
+        placesChanged();
     }
+}
+
 
-    if (slice != "") mpMatcher = new SliceMatcher(slice);
+FlatConverter::FlatConverter (const VectorToc& toc) : 
+    AbstractConverter(toc), mPlacesValid(false), mpMaskEntry(0), mpOut(0), 
+    mpFloatOut(0), mOutSize(0), mOutCount(0) {
+    
+    setSlice("");
 }
 
-std::vector<double> FlatConverter::apply (void* data, bool create_place_vector ) {
+void FlatConverter::setSlice (const std::string& slice) {
+
+    mpMask = SliceMask::create(mToc, slice);
 
-    mVector.clear();
     mPlaceVector.clear();
+    mPlacesValid = false;
+    placesChanged();
+
+    mOutputSize = 0;
 
-    mCreatePlaceVector = create_place_vector;
+    for ( unsigned int i=0; i<mToc.size(); i++ ) 
+        if ( !mToc[i].content.get() && 
+                ( !mpMask || (*mpMask)[i].state != SliceMaskEntry::Skip ) )
+            mOutputSize++;
+}
+
+void FlatConverter::convertData (void* data) {
 
     mpData = data;
 
-    VectorTocVisitor::visit(mToc);
+    mMaskStack.clear();
+    mMaskStack.push_back(mpMask.get());
+    mIndexStack.clear();
+
+    visit(mToc);
+}
+
+std::vector<double> FlatConverter::apply (void* data, bool create_place_vector ) {
+
+    mVector.clear();
+
+    convertData(data);
+
+    updatePlaces(create_place_vector);
 
     return mVector;
 }
 
+template<typename Scalar>
+int FlatConverter::applyDirect (void* data, Scalar* out, int size) {
 
-void* ConvertToVector::getPosition (const VectorValueInfo& info) {
+    if ( getOutputSize() > size )
+        throw std::runtime_error("output buffer is too small for the conversion");
 
-    void* ptr = mBaseStack.back() + info.position;
+    setOut(out);
+    mOutSize = size;
+    mOutCount = 0;
 
-    if (!mContainersSizeStack.empty())
-        ptr += mContainersSizeStack.back();
+    try {
+        convertData(data);
+    } catch (...) {
+        setOut((Scalar*)0);
+        throw;
+    }
 
-    return ptr;
+    setOut((Scalar*)0);
+
+    return mOutCount;
 }
 
-void ConvertToVector::push_element (const VectorValueInfo& info) {
+int FlatConverter::applyInto (void* data, double* out, int size) {
 
-    bool push_this = true;
-    
-    if (mCreatePlaceVector || mpMatcher ) {
+    return applyDirect(data, out, size);
+}
 
-        if (info.placeDescription != "" ) mPlaceStack.push_back(info.placeDescription);
+int FlatConverter::applyInto (void* data, float* out, int size) {
 
-        std::string this_place = utilmm::join(mPlaceStack,".");
+    return applyDirect(data, out, size);
+}
 
-        if ( mpMatcher && !mpMatcher->fitsASlice(this_place) )
-            push_this = false;
 
-        if (mCreatePlaceVector && push_this) mPlaceVector.push_back(this_place);
+void* ConvertToVector::getPosition (const VectorValueInfo& info) {
 
-        if (info.placeDescription != "" ) mPlaceStack.pop_back();
-    }
+    void* ptr = mBaseStack.back() + info.position;
 
-    if (push_this) mVector.push_back( info.castFun(getPosition(info)) );
+    if (!mContainersSizeStack.empty())
+        ptr += mContainersSizeStack.back();
 
+    return ptr;
+}
+
+void ConvertToVector::push_element (const VectorValueInfo& info) {
+
+    if ( !isInSlice() ) return;
+
+    if ( mCountOnly ) mValueCount++;
+    else pushValue( info.castFun(getPosition(info)) );
 }
 
 void ConvertToVector::visit (const VectorValueInfo& info) {
 
     if (info.content.get()) {
 
-        const Typelib::Container& t = 
-            static_cast<const Typelib::Container&>(*mrRegistry.get(info.containerType));
+        const SliceMaskEntry* mask_entry = mpMaskEntry;
+
+        if ( mask_entry && mask_entry->state == SliceMaskEntry::Skip ) return;
+
+        const ContainerHandle& container = info.container;
 
         void* ptr = getPosition(info);
 
-        unsigned int ecnt = t.getElementCount( ptr );
+        unsigned int ecnt = container.getElementCount( ptr );
+        mShape.push_back(ecnt);
         if ( ecnt == 0 ) return;
 
-        unsigned int esize = t.getIndirection().getSize();
+        unsigned int esize = container.elementSize;
 
-        std::vector<uint8_t>* vector_ptr = 
-            reinterpret_cast<std::vector<uint8_t>*>( ptr );
-
-        void* base = &(*vector_ptr)[0];
+        void* base = const_cast<uint8_t*>(container.getElements(ptr));
 
         mBaseStack.push_back(base);
         mContainersSizeStack.push_back(0);
-
-        int istar;
-        
-        if (mCreatePlaceVector || mpMatcher ) {
-            mPlaceStack.push_back(info.placeDescription);
-            istar = mPlaceStack.back().size()-1;
-        }
+        mMaskStack.push_back(mask_entry ? mask_entry->content.get() : 0);
+        mIndexStack.push_back(0);
 
         for ( int i=0; i<ecnt; i++) {
 
-            if (mCreatePlaceVector || mpMatcher ) {
+            if ( mask_entry && !mask_entry->needsElement(i) ) continue;
 
-                mPlaceStack.back().replace(mPlaceStack.back().begin()+istar, 
-                        mPlaceStack.back().end(), 
-                        boost::lexical_cast<std::string,int>(i) );
-            }
+            mContainersSizeStack.back() = i*esize;
+            mIndexStack.back() = i;
 
-            VectorTocVisitor::visit(*(info.content));
-            mContainersSizeStack.back() += esize;
+            visit(*(info.content));
         }
 
+        mIndexStack.pop_back();
+        mMaskStack.pop_back();
         mContainersSizeStack.pop_back();
-        if (mCreatePlaceVector || mpMatcher ) mPlaceStack.pop_back();
         mBaseStack.pop_back();
     }
     else push_element(info);
 }
 
+void ConvertToVector::createPlaces () {
+
+    mPlaceVector.clear();
+
+    unsigned int shape_idx = 0;
+    mIndexStack.clear();
+
+    utilmm::stringlist place_stack;
+
+    createPlaces(mToc, mpMask.get(), place_stack, shape_idx);
+
+    mPlaceShape = mShape;
+}
+
+void ConvertToVector::createPlaces (const VectorToc& toc, const SliceMask* mask, 
+        utilmm::stringlist& place_stack, unsigned int& shape_idx) {
+
+    for ( unsigned int i=0; i<toc.size(); i++ ) {
+
+        const VectorValueInfo& info = toc[i];
+        mpMaskEntry = mask ? &(*mask)[i] : 0;
+
+        if ( !info.content.get() ) {
+
+            if ( isInSlice() ) {
+                const Place& place = info.placeDescription;
+                if ( !place.empty() ) place_stack.push_back(place.toString());
+                mPlaceVector.push_back(utilmm::join(place_stack, "."));
+                if ( !place.empty() ) place_stack.pop_back();
+            }
+
+            continue;
+        }
+
+        const SliceMaskEntry* mask_entry = mpMaskEntry;
+
+        if ( mask_entry && mask_entry->state == SliceMaskEntry::Skip ) continue;
+
+        unsigned int ecnt = mShape.at(shape_idx++);
+
+        // the place of a container ends with the *, that is replaced by the index
+        Place container = info.placeDescription.getParent();
+
+        if ( !container.empty() ) place_stack.push_back(container.toString());
+        place_stack.push_back("");
+        mIndexStack.push_back(0);
+
+        for ( unsigned int j=0; j<ecnt; j++ ) {
+
+            if ( mask_entry && !mask_entry->needsElement(j) ) continue;
+
+            mIndexStack.back() = j;
+            place_stack.back() = boost::lexical_cast<std::string>(j);
+
+            createPlaces(*(info.content), mask_entry ? mask_entry->content.get() : 0, 
+                    place_stack, shape_idx);
+        }
+
+        mIndexStack.pop_back();
+        place_stack.pop_back();
+        if ( !container.empty() ) place_stack.pop_back();
+    }
+}
+
 ConvertToVector::ConvertToVector (const VectorToc& toc, const Typelib::Registry& registry) : 
-    FlatConverter(toc), mrRegistry(registry) {}
+    FlatConverter(VectorToc::withResolvedContainers(toc, registry)), mrRegistry(registry), 
+    mCountOnly(false), mValueCount(0), mFlat(toc.isFlat()) {}
 
-std::vector<double> ConvertToVector::apply (void* data, bool create_place_vector) {
+int ConvertToVector::getOutputSize () const {
 
-    mVector.clear();
-    mPlaceVector.clear();
+    return mFlat ? mOutputSize : -1;
+}
 
-    mCreatePlaceVector = create_place_vector;
+int ConvertToVector::getOutputSize (void* data) {
+
+    if ( mFlat ) return mOutputSize;
+
+    // walks the containers like apply, but only counts the values
+    mShape.swap(mScratchShape);
+
+    mCountOnly = true;
+    mValueCount = 0;
+
+    convertData(data);
+
+    mCountOnly = false;
+    mShape.swap(mScratchShape);
+
+    return mValueCount;
+}
+
+void ConvertToVector::convertData (void* data) {
 
     mBaseStack.clear();
     mBaseStack.push_back(data);
     mContainersSizeStack.clear();
-    mPlaceStack.clear();
+    mMaskStack.clear();
+    mMaskStack.push_back(mpMask.get());
+    mIndexStack.clear();
+    mShape.clear();
+
+    visit(mToc);
+}
+
+template<typename Scalar>
+int ConvertToVector::applyKeepingShape (void* data, Scalar* out, int size) {
+
+    // the shape belongs to the places of apply
+    mShape.swap(mScratchShape);
+
+    int n;
+
+    try {
+        n = applyDirect(data, out, size);
+    } catch (...) {
+        mShape.swap(mScratchShape);
+        throw;
+    }
+
+    mShape.swap(mScratchShape);
+
+    return n;
+}
+
+int ConvertToVector::applyInto (void* data, double* out, int size) {
+
+    return applyKeepingShape(data, out, size);
+}
+
+int ConvertToVector::applyInto (void* data, float* out, int size) {
+
+    return applyKeepingShape(data, out, size);
+}
+
+std::vector<double> ConvertToVector::apply (void* data, bool create_place_vector) {
+
+    mVector.clear();
+
+    convertData(data);
+
+    if ( mShape != mPlaceShape ) mPlacesValid = false;
 
-    VectorTocVisitor::visit(mToc);
+    updatePlaces(create_place_vector);
 
     return mVector;
 
@@ -20,14 +20,17 @@
 
 #include "Definitions.hpp"
 #include "VectorToc.hpp"
+#include "SliceMask.hpp"
 
 
 class Typelib::Registry;
 
 namespace type_to_vector {
 
-class SliceMatcher;
+struct ConversionProgram;
+typedef boost::shared_ptr<ConversionProgram> ConversionProgramPointer;
 
+class AbstractMatrixBuffer;
 
 /** Basic functionality of converters. */
 class AbstractConverter {
@@ -37,12 +40,36 @@ protected:
     
     VectorOfDoubles mVector;
     
-    StringVector mPlaceVector;
+    StringVector mPlaceVector; //!< Places of the last conversion that created them.
+
+    bool mPlacesRequested; //!< The last conversion was asked for the places.
+
+    unsigned int mPlaceVersion; //!< Changes whenever getPlaceVector changes.
+
+    /** Sets whether the last conversion was asked for the places. */
+    void setPlacesRequested (bool requested) {
+        if ( requested != mPlacesRequested ) mPlaceVersion++;
+        mPlacesRequested = requested;
+    }
+
+    /** To be called after mPlaceVector was rebuilt. */
+    void placesChanged () { mPlaceVersion++; }
+
+    VectorOfDoubles mScratchVector; //!< Result of applyToScratch.
+
+    /** Runs apply for \p data, but keeps the result of the last apply and the 
+     *  place state as they are.
+     *
+     * \returns the converted values, valid until the next call. */
+    const VectorOfDoubles& applyToScratch (void* data);
       
 public:
     typedef boost::shared_ptr<AbstractConverter> Pointer;
     
-    AbstractConverter (const VectorToc& toc) : mToc(toc) {}
+    AbstractConverter (const VectorToc& toc) : mToc(toc), mPlacesRequested(false),
+        mPlaceVersion(0) {}
+
+    virtual ~AbstractConverter () {}
 
     std::string getTypeName() { return mToc.mType; }
 
@@ -60,18 +87,81 @@ public:
      * To get an eigen vector use getEigenVector after calling apply.
      * \param create_place_vector \see getPlaceVector */ 
     virtual VectorOfDoubles apply (void* data, bool create_place_vector = false) = 0;
+
+    /** The number of values a conversion gives.
+     *
+     * \returns -1 if the number depends on the data, e.g. for containers. */
+    virtual int getOutputSize () const { return -1; }
+
+    /** The number of values a conversion of \p data gives.
+     *
+     * The default implementation converts \p data if the number depends on it,
+     * without touching the result of apply. */
+    virtual int getOutputSize (void* data);
+
+    /** Applies the converter to some data and writes the values to \p out.
+     *
+     * This does not touch the result of apply and creates no place vector.
+     * The default implementation converts into a scratch vector and copies it,
+     * converters that write directly without heap allocations override it.
+     * \param size is the number of values \p out has room for.
+     * \returns the number of values written.
+     * \throws std::runtime_error if \p out is too small. */
+    virtual int applyInto (void* data, double* out, int size);
+
+    /** Applies the converter to some data and writes the values to \p out.
+     *
+     * \see applyInto(void*, double*, int) */
+    int applyInto (void* data, Eigen::Map<Eigen::VectorXd> out) {
+        return applyInto(data, out.data(), out.size());
+    }
+
+    /** Applies the converter to some data and writes the values as floats to \p out.
+     *
+     * The default implementation narrows the values of a conversion into a 
+     * scratch vector, converters with kernels for float output override it.
+     * \see applyInto(void*, double*, int) */
+    virtual int applyInto (void* data, float* out, int size);
+
+    /** \see applyInto(void*, float*, int) */
+    int applyInto (void* data, Eigen::Map<Eigen::VectorXf> out) {
+        return applyInto(data, out.data(), out.size());
+    }
+    
+    /** Converts a batch of samples into the columns of \p result.
+     *
+     * All samples need to give the same number of values, \p result is resized
+     * to that number of rows and \p count columns.
+     * \param samples points to the data of the samples.
+     * \throws std::runtime_error if the samples give different numbers of values. */
+    virtual void applyBatch (void* const* samples, int count, Eigen::MatrixXd& result);
+
+    /** Converts a batch of \p count samples that are \p stride bytes apart, 
+     *  e.g. in an array.
+     *
+     * \see applyBatch(void* const*, int, Eigen::MatrixXd&) */
+    void applyBatch (void* first, int stride, int count, Eigen::MatrixXd& result);
+
+    /** Converts a batch of samples into the float columns of \p result.
+     *
+     * \see applyBatch(void* const*, int, Eigen::MatrixXd&) */
+    virtual void applyBatch (void* const* samples, int count, Eigen::MatrixXf& result);
+
+    /** \see applyBatch(void* first, int stride, int count, Eigen::MatrixXd&) */
+    void applyBatch (void* first, int stride, int count, Eigen::MatrixXf& result);
     
     /** Returns the result of the last conversion as an Eigen::VectorXd. */
     Eigen::VectorXd getEigenVector ();
 
-    /** To get the result of the last conversion. 
+    /** To get the result of the last conversion, also as float vector. 
      *
      * \returns false if there are no data in the vector.*/
     template <typename Derived>
     bool getEigenVector(Eigen::DenseBase<Derived>& vector) const {
 
        if ( !mVector.empty() ) {
-           vector = Eigen::Map<const Eigen::VectorXd>(&(mVector[0]), mVector.size());
+           vector = Eigen::Map<const Eigen::VectorXd>(&(mVector[0]), mVector.size())
+               .template cast<typename Derived::Scalar>();
            return true;
         } else
             return false;
@@ -81,8 +171,23 @@ public:
      *  contains. 
      *
      * Each entry gives the place in the type for the vector element at this index.
-     * Should only be created when create_place_vector was set to true. */
-    StringVector getPlaceVector () { return mPlaceVector; }
+     * It is empty if create_place_vector was false for the last conversion.
+     * Converters keep the places between conversions and only rebuild them
+     * if the shape of the data changes. */
+    virtual const StringVector& getPlaceVector () const;
+
+    /** A number that changes whenever the place vector changes, to cache
+     *  anything made of it. */
+    virtual unsigned int getPlaceVectorVersion () const { return mPlaceVersion; }
+
+    /** The conversion as a flat program, to fuse it with other conversions.
+     *
+     * The program stays the same as long as the conversion does not change.
+     * \param factor is set to the factor the values of the program are 
+     *  multiplied with.
+     * \returns a null pointer if the conversion cannot be given as a flat
+     *  program, the default. */
+    virtual ConversionProgramPointer getFlatProgram (double& factor) const;
 };
 
 /** Only converts a single value (the first one in the toc). */
@@ -92,39 +197,197 @@ public:
 
     VectorOfDoubles apply (void* data, bool create_place_vector = false);
 
+    using AbstractConverter::applyInto;
+    int applyInto (void* data, double* out, int size);
+    int applyInto (void* data, float* out, int size);
+
+    int getOutputSize () const;
+    int getOutputSize (void* data) { return getOutputSize(); }
+
+    ConversionProgramPointer getFlatProgram (double& factor) const;
+
+private:
+    mutable ConversionProgramPointer mpFlatProgram;
 };
 
-/** Can be used to apply a factor to all converted values. */
+/** Can be used to apply a factor to all converted values. 
+ *
+ * If the converter has a flat program, see getFlatProgram, the factor is 
+ * applied by the conversion kernels of a scaled copy of it. */
 class MultiplyConverter: public AbstractConverter {
 
     AbstractConverter::Pointer mpConverter;
     double mFactor;
 
+    ConversionProgramPointer mpSourceProgram; //!< The flat program of mpConverter.
+    double mSourceFactor;
+    ConversionProgramPointer mpScaledProgram; //!< It with the factor applied.
+    int mScaledSize;
+
+    /** The flat program of the converter with the factor applied, or 0 if the 
+     *  converter has no flat program. */
+    const ConversionProgram* getScaledProgram ();
+
+    /** \see applyInto */
+    template<typename Scalar>
+    int applyScaled (void* data, Scalar* out, int size);
+
 public:
     MultiplyConverter (AbstractConverter::Pointer converter, double factor);
     
     virtual VectorOfDoubles apply (void* data, bool create_place_vector = false);
 
+    using AbstractConverter::applyInto;
+    virtual int applyInto (void* data, double* out, int size);
+    virtual int applyInto (void* data, float* out, int size);
+
+    int getOutputSize () const { return mpConverter->getOutputSize(); }
+    int getOutputSize (void* data) { return mpConverter->getOutputSize(data); }
+
+    const StringVector& getPlaceVector () const { 
+        return mPlacesRequested ? mpConverter->getPlaceVector() : 
+            AbstractConverter::getPlaceVector(); 
+    }
+
+    unsigned int getPlaceVectorVersion () const { 
+        return mpConverter->getPlaceVectorVersion() + mPlaceVersion; 
+    }
+
+    ConversionProgramPointer getFlatProgram (double& factor) const;
+
     double getFactor() { return mFactor; }
     void setFactor (double factor) { mFactor = factor; }
 };
 
+/** Normalizes each converted value on its own to (value - offset) * scale.
+ *
+ * The offsets and scales are given or learned from vectors in a buffer, e.g.
+ * to get zero mean and unit variance. If the converter has a flat program, 
+ * the normalization is done by the conversion kernels of a transformed copy 
+ * of it, else in place on the converted values. Without a normalization the
+ * values are passed on. */
+class NormalizeConverter : public AbstractConverter {
+
+    AbstractConverter::Pointer mpConverter;
+    Eigen::VectorXd mOffsets;
+    Eigen::VectorXd mScales;
+
+    mutable ConversionProgramPointer mpSourceProgram; //!< Flat program of mpConverter.
+    mutable double mSourceFactor;
+    mutable ConversionProgramPointer mpNormalizedProgram; //!< It with the normalization.
+    mutable bool mNormalizationChanged;
+
+    /** The normalized flat program of the converter, or 0 if there is none. */
+    const ConversionProgram* getNormalizedProgram () const;
+
+    /** Normalizes \p n values in place, computing in double. */
+    template<typename Scalar>
+    void normalize (Scalar* values, int n) const;
+
+    /** \see applyInto */
+    template<typename Scalar>
+    int applyNormalized (void* data, Scalar* out, int size);
+
+public:
+    NormalizeConverter (AbstractConverter::Pointer converter);
+
+    /** \see setNormalization */
+    NormalizeConverter (AbstractConverter::Pointer converter, 
+            const VectorOfDoubles& offsets, const VectorOfDoubles& scales);
+
+    /** Sets the offset and scale of each value.
+     *
+     * \throws std::runtime_error if the sizes differ from each other or from a
+     *  fixed output size of the converter. */
+    void setNormalization (const VectorOfDoubles& offsets, const VectorOfDoubles& scales);
+
+    /** Learns the normalization to zero mean and unit variance.
+     *
+     * \param count is the number of the most recent vectors in \p buffer to
+     *  learn from, -1 for all pushed ones. A ConcurrentMatrixBuffer can be
+     *  learned from while another thread pushes.
+     * \param min_deviation is the standard deviation below which a value is
+     *  only shifted and not scaled. */
+    void learn (AbstractMatrixBuffer& buffer, int count=-1, double min_deviation=1e-9);
+
+    VectorOfDoubles getOffsets () const;
+    VectorOfDoubles getScales () const;
+
+    virtual VectorOfDoubles apply (void* data, bool create_place_vector = false);
+
+    using AbstractConverter::applyInto;
+    virtual int applyInto (void* data, double* out, int size);
+    virtual int applyInto (void* data, float* out, int size);
+
+    int getOutputSize () const { return mpConverter->getOutputSize(); }
+    int getOutputSize (void* data) { return mpConverter->getOutputSize(data); }
+
+    const StringVector& getPlaceVector () const { 
+        return mPlacesRequested ? mpConverter->getPlaceVector() : 
+            AbstractConverter::getPlaceVector(); 
+    }
+
+    unsigned int getPlaceVectorVersion () const { 
+        return mpConverter->getPlaceVectorVersion() + mPlaceVersion; 
+    }
+
+    /** The normalized program, if the converter has a flat program. */
+    ConversionProgramPointer getFlatProgram (double& factor) const;
+};
+
 /** Only converts the first level of an type. Will not go into containers. */
 class FlatConverter : public AbstractConverter, public VectorTocVisitor {
       
 protected:
     void* mpData;
     
-    bool mCreatePlaceVector;
+    bool mPlacesValid; //!< The cached places fit the slice.
+
+    SliceMaskPointer mpMask; //!< The slice resolved for the toc, null if no slice.
+    std::vector<const SliceMask*> mMaskStack; //!< Masks of the visited tocs.
+    const SliceMaskEntry* mpMaskEntry; //!< Mask entry of the visited value.
+    std::vector<int> mIndexStack; //!< Indices of the visited container elements.
+
+    int mOutputSize; //!< Number of values in the first level matching the slice.
+
+    double* mpOut; //!< Where applyInto writes the values to, else to mVector.
+    float* mpFloatOut;
+    int mOutSize; //!< Room at the output of applyInto.
+    int mOutCount; //!< Number of values written there so far.
 
-    SliceMatcher* mpMatcher;
+    /** Appends a converted value to mVector or the output of applyInto.
+     *
+     * \throws std::runtime_error if the output of applyInto is full. */
+    void pushValue (double value);
+
+    /** Visits \p data, the taken values are given to pushValue. */
+    virtual void convertData (void* data);
+
+    void setOut (double* out) { mpOut = out; }
+    void setOut (float* out) { mpFloatOut = out; }
+
+    /** \see applyInto */
+    template<typename Scalar>
+    int applyDirect (void* data, Scalar* out, int size);
     
     virtual void* getPosition (const VectorValueInfo& info); 
+
+    /** Checks with the slice mask whether the visited value is taken. */
+    bool isInSlice () const;
    
     virtual void push_element (const VectorValueInfo& info);
      
     virtual void visit (const VectorValueInfo& info);
 
+    /** Visits the entries of a toc along with their mask entries. */
+    virtual void visit (const VectorToc& toc);
+
+    /** Builds the place vector from the toc and the slice. */
+    virtual void createPlaces ();
+
+    /** Marks the place vector as requested and creates it if not valid. */
+    void updatePlaces (bool create_place_vector);
+
 public:
     
     /** Construction of the converter.
@@ -132,12 +395,22 @@ public:
      * \param toc is the \c VectorToc that describes the data.
      */
     FlatConverter (const VectorToc& toc);
-
-    virtual ~FlatConverter ();
    
     virtual VectorOfDoubles apply (void* data, bool create_place_vector = false);
+
+    /** Writes the values directly to \p out while visiting the data, without 
+     *  touching mVector. */
+    using AbstractConverter::applyInto;
+    virtual int applyInto (void* data, double* out, int size);
+    virtual int applyInto (void* data, float* out, int size);
+
+    virtual int getOutputSize () const { return mOutputSize; }
+    virtual int getOutputSize (void* data) { return mOutputSize; }
     
-    /** Sets a slice. "" is no slice. */
+    /** Sets a slice. "" is no slice.
+     *
+     * The slice is resolved once into a SliceMask for the toc, the conversion
+     * itself does not match any places. */
     void setSlice (const std::string& slice);
 };
     
@@ -156,15 +429,40 @@ class ConvertToVector : public FlatConverter {
 
     std::vector<void*> mBaseStack;
     std::vector<int> mContainersSizeStack;
-    utilmm::stringlist mPlaceStack;
+
+    /** The element counts of the visited containers in the order of the visit.
+     *
+     * The places only depend on it, so they are cached for mPlaceShape. */
+    std::vector<unsigned int> mShape;
+    std::vector<unsigned int> mPlaceShape;
+    std::vector<unsigned int> mScratchShape; //!< Shape of applyInto and getOutputSize.
+
+    bool mCountOnly; //!< The visit only counts the values, see getOutputSize.
+    int mValueCount;
+
+    /** Creates the places of a toc for the recorded shape.
+     *
+     * Only the places of the toc are interned, the places of the elements are
+     * joined from \p place_stack. */
+    void createPlaces (const VectorToc& toc, const SliceMask* mask, 
+            utilmm::stringlist& place_stack, unsigned int& shape_idx);
 
 protected:
     void* getPosition (const VectorValueInfo& info); 
 
     void push_element (const VectorValueInfo& info);
 
+    using FlatConverter::visit;
     void visit (const VectorValueInfo& info);
 
+    void createPlaces ();
+
+    void convertData (void* data);
+
+    /** \see applyInto */
+    template<typename Scalar>
+    int applyKeepingShape (void* data, Scalar* out, int size);
+
 public:
     /** Construction of the converter.
      *
@@ -175,6 +473,19 @@ public:
     ConvertToVector (const VectorToc& toc, const Typelib::Registry& registry);
 
     VectorOfDoubles apply (void* data, bool create_place_vector = false);
+
+    /** Writes the values directly to \p out, the places stay those of apply. */
+    using FlatConverter::applyInto;
+    int applyInto (void* data, double* out, int size);
+    int applyInto (void* data, float* out, int size);
+
+    int getOutputSize () const;
+
+    /** Counts the values of \p data without converting them. */
+    int getOutputSize (void* data);
+
+private:
+    bool mFlat; //!< True if the toc has no containers.
 };
 
 } // namespace type_to_vector
@@ -1,7 +1,14 @@
 // \file  MatrixBuffer.cpp
 
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "MatrixBuffer.hpp"
 
@@ -9,9 +16,21 @@
 using namespace type_to_vector;
 
 bool AbstractMatrixBuffer::push (const Eigen::VectorXd& v) {
-    bool result = pushVector(v);
-    pushCount++;
-    return result;
+    return countPush(pushVector(v));
+}
+
+int AbstractMatrixBuffer::resolveWindow (int& from, int& to) const {
+
+    if ( from < 0 ) from += vectorCount;
+    if ( to < 0 ) to += vectorCount;
+    if ( from > to ) throw std::runtime_error("! from <= to !");
+
+    int n = to - from + 1;
+
+    if ( to >= vectorCount || n > vectorCount ) 
+        throw std::runtime_error("Cannot give more vectors than in buffer");
+
+    return n;
 }
 
 void AbstractMatrixBuffer::reset() {
@@ -44,30 +63,229 @@ void MatrixBuffer::resetBuffer() {
     mInIdx = vectorCount;
 }
     
+MatrixBufferView MatrixBuffer::getView (int from, int to) const {
+
+    resolveWindow(from, to);
+
+    return MatrixBufferView::ofRing(mMatrix.data(), vectorSize, vectorCount, mInIdx,
+            from, to);
+}
+    
 void MatrixBuffer::fillOutMatrix (int from, int to) {
 
-    if ( from < 0 ) from += vectorCount;
-    if ( to < 0 ) to += vectorCount;
-    if ( from > to ) throw std::runtime_error("! from <= to !");
+    getView(from, to).copyTo(mOutMatrix);
+}
 
-    int n = to - from + 1;
+template<typename Derived>
+bool FloatMatrixBuffer::pushColumn (const Eigen::MatrixBase<Derived>& v) {
 
-    if ( to >= vectorCount || n > vectorCount ) 
-        throw std::runtime_error("Cannot give more vectors than in buffer");
+    if ( v.rows() != mMatrix.rows() ) 
+        throw std::runtime_error("Resize is not allowed for FloatMatrixBuffer");
+    
+    if ( mInIdx > 0 ) mInIdx--;
+    else mInIdx = vectorCount-1;
+
+    mMatrix.col(mInIdx) = v.template cast<float>(); 
+
+    return false;
+}
+
+bool FloatMatrixBuffer::pushVector (const Eigen::VectorXd& v) {
+
+    return pushColumn(v);
+}
+
+bool FloatMatrixBuffer::pushFloat (const Eigen::VectorXf& v) {
+
+    return countPush(pushColumn(v));
+}
+
+void FloatMatrixBuffer::resetBuffer() {
+
+    mMatrix = Eigen::MatrixXf::Zero(vectorSize,vectorCount);
+    mInIdx = vectorCount;
+}
+
+FloatMatrixBufferView FloatMatrixBuffer::getFloatView (int from, int to) const {
+
+    resolveWindow(from, to);
+
+    return FloatMatrixBufferView::ofRing(mMatrix.data(), vectorSize, vectorCount, 
+            mInIdx, from, to);
+}
+
+void FloatMatrixBuffer::fillOutMatrix (int from, int to) {
+
+    FloatMatrixBufferView view = getFloatView(from, to);
+
+    mOutMatrix.resize(vectorSize, view.cols());
+    mOutMatrix.leftCols(view.first().cols()) = view.first().cast<double>();
+    mOutMatrix.rightCols(view.second().cols()) = view.second().cast<double>();
+}
+
+const Eigen::MatrixXf& FloatMatrixBuffer::getFloatMatrix (int from, int to) {
+
+    getFloatView(from, to).copyTo(mOutFloatMatrix);
+    return mOutFloatMatrix;
+}
+
+ConcurrentMatrixBuffer::ConcurrentMatrixBuffer (int vector_size, int vector_count, 
+        int slack) : AbstractMatrixBuffer(vector_size, vector_count), 
+    mCapacity(vector_count + std::max(slack < 0 ? vector_count : slack, 1)), 
+    mSequence(0) {
+
+    mRing = Eigen::MatrixXd::Zero(vector_size, mCapacity);
+}
+
+bool ConcurrentMatrixBuffer::pushVector (const Eigen::VectorXd& v) {
 
-    from += mInIdx;
-    to += mInIdx;
+    if ( v.rows() != mRing.rows() ) 
+        throw std::runtime_error("Resize is not allowed for ConcurrentMatrixBuffer");
 
-    if (from > vectorCount-1) {
+    unsigned long sequence = mSequence.load(boost::memory_order_relaxed);
+    unsigned long count = sequence / 2;
 
-        mOutMatrix = mMatrix.block(0,from-vectorCount,vectorSize,n);
+    mSequence.store(sequence + 1, boost::memory_order_relaxed);
 
-    } else if ( to > vectorCount-1 ) {
+    // a reader that sees any of the new column also sees the odd sequence
+    boost::atomic_thread_fence(boost::memory_order_release);
+
+    mRing.col(count % mCapacity) = v;
+
+    // publishes the column to the reader
+    mSequence.store(sequence + 2, boost::memory_order_release);
+
+    return false;
+}
+
+void ConcurrentMatrixBuffer::resetBuffer () {
+
+    mRing.setZero();
+    mSequence.store(0, boost::memory_order_release);
+}
+
+void ConcurrentMatrixBuffer::fillOutMatrix (int from, int to) {
+
+    int n = resolveWindow(from, to);
+
+    mOutMatrix.resize(vectorSize, n);
+
+    while ( true ) {
+
+        long written = mSequence.load(boost::memory_order_acquire) / 2;
+
+        // column j is the vector pushed as number written-1-from-j
+        for ( int j=0; j<n; j++ ) {
+
+            long index = written - 1 - from - j;
+
+            if ( index < 0 ) mOutMatrix.col(j).setZero();
+            else mOutMatrix.col(j) = mRing.col(index % mCapacity);
+        }
+
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+
+        // pushes that started, including one still writing
+        long started = (mSequence.load(boost::memory_order_relaxed) + 1) / 2;
+
+        // push number k overwrites the column of number k-mCapacity, so all
+        // copied vectors have to be newer than the last started push minus that,
+        // numbers below 0 were zeros and not copied
+        long newest = written - 1 - from;
+        long oldest = std::max(written - 1 - to, 0L);
+
+        if ( newest < 0 || oldest >= started - mCapacity ) return;
+    }
+}
+
+
+MirroredMatrixBuffer::MirroredMatrixBuffer (int vector_size, int vector_count) :
+    AbstractMatrixBuffer(vector_size, vector_count), mpRing(0), mCapacity(0),
+    mRingBytes(0), mInIdx(0) {
+
+#ifdef __linux__
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t column = std::max(vector_size, 1) * sizeof(double);
+
+    // the smallest number of columns that fills whole pages
+    mCapacity = std::max(vector_count, 1);
+    while ( (mCapacity * column) % page != 0 ) mCapacity++;
+
+    mRingBytes = mCapacity * column;
+
+    int fd = memfd_create("type_to_vector_ring", 0);
+
+    if ( fd < 0 ) 
+        throw std::runtime_error("MirroredMatrixBuffer: memfd_create failed");
+
+    if ( ftruncate(fd, mRingBytes) != 0 ) {
+        close(fd);
+        throw std::runtime_error("MirroredMatrixBuffer: cannot size the ring");
+    }
+
+    // reserves the address range for both mappings
+    void* base = mmap(0, 2*mRingBytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    bool mapped = base != MAP_FAILED
+        && mmap(base, mRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                fd, 0) != MAP_FAILED
+        && mmap(static_cast<char*>(base) + mRingBytes, mRingBytes, 
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+
+    close(fd);
+
+    if ( !mapped ) {
+        if ( base != MAP_FAILED ) munmap(base, 2*mRingBytes);
+        throw std::runtime_error("MirroredMatrixBuffer: cannot map the ring");
+    }
+
+    mpRing = static_cast<double*>(base);
+#else
+    throw std::runtime_error("MirroredMatrixBuffer is only available on Linux");
+#endif
+}
+
+MirroredMatrixBuffer::~MirroredMatrixBuffer () {
+
+#ifdef __linux__
+    if ( mpRing ) munmap(mpRing, 2*mRingBytes);
+#endif
+}
+
+bool MirroredMatrixBuffer::pushVector (const Eigen::VectorXd& v) {
+
+    if ( v.rows() != vectorSize ) 
+        throw std::runtime_error("Resize is not allowed for MirroredMatrixBuffer");
+
+    if ( mInIdx > 0 ) mInIdx--;
+    else mInIdx = mCapacity-1;
+
+    Eigen::Map<Eigen::VectorXd>(mpRing + mInIdx*vectorSize, vectorSize) = v;
+
+    return false;
+}
+
+void MirroredMatrixBuffer::resetBuffer () {
+
+    std::memset(mpRing, 0, mRingBytes);
+    mInIdx = 0;
+}
+
+MirroredMatrixBuffer::Window MirroredMatrixBuffer::getWindow (int from, int to) const {
+
+    int n = resolveWindow(from, to);
+
+    return Window(mpRing + (mInIdx+from)*vectorSize, vectorSize, n);
+}
+
+MatrixBufferView MirroredMatrixBuffer::getView (int from, int to) const {
+
+    Window window = getWindow(from, to);
+
+    return MatrixBufferView(window.data(), window.cols(), 0, 0, vectorSize);
+}
 
-        mOutMatrix.resize(vectorSize,n);
-        mOutMatrix << mMatrix.block(0,from,vectorSize,vectorCount-from),
-            mMatrix.block(0,0,vectorSize,to-vectorCount+1);
+void MirroredMatrixBuffer::fillOutMatrix (int from, int to) {
 
-    } else
-        mOutMatrix = mMatrix.block(0,from,vectorSize,n); 
+    mOutMatrix = getWindow(from, to);
 }
@@ -15,6 +15,7 @@
 #define TYPETOVECTOR_MATRIXBUFFER_HPP
 
 #include <Eigen/Core>
+#include <boost/atomic.hpp>
 
 namespace type_to_vector {
 
@@ -37,6 +38,18 @@ protected:
     /** Fill the requested values into mOutMatrix. */ 
     virtual void fillOutMatrix (int from, int to) = 0;
 
+    /** Counts a pushed vector, push and other push methods of subclasses end
+     *  with it.
+     *
+     * \returns \p resized. */
+    bool countPush (bool resized) { pushCount++; return resized; }
+
+    /** Turns negative \p from and \p to into positive ones.
+     *
+     * \returns the number of vectors from \p from to \p to.
+     * \throws std::runtime_error if they do not give a window of the buffer. */
+    int resolveWindow (int& from, int& to) const;
+
 public:
 
     AbstractMatrixBuffer (int vector_size, int vector_count) : vectorSize(vector_size),
@@ -70,15 +83,85 @@ public:
     void reset();
 
     /** Get number of vectors pushed to the buffer. */
-    int getPushCount() { return pushCount;}
+    virtual int getPushCount() { return pushCount;}
 
     /** Is true if the buffer is filled once. */
-    bool isFilled() { return pushCount >= vectorCount; }
+    bool isFilled() { return getPushCount() >= vectorCount; }
 
     int getVectorCount() { return vectorCount; }
     int getVectorSize() { return vectorSize; }
 };
 
+/** A window of a MatrixBuffer without a copy.
+ *
+ * The window is one block of the ring, or two if it wraps around its end. 
+ * The columns of first() followed by those of second() are the columns
+ * getMatrix would give. The view is valid until the next push or reset. */
+template <typename Scalar>
+class BasicMatrixBufferView {
+
+    const Scalar* mpFirst;
+    const Scalar* mpSecond;
+    int mRows, mFirstCols, mSecondCols;
+
+public:
+    typedef Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> > Segment;
+    typedef Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, 1> > Column;
+
+    BasicMatrixBufferView (const Scalar* first, int first_cols, const Scalar* second,
+            int second_cols, int rows) : mpFirst(first), mpSecond(second), 
+        mRows(rows), mFirstCols(first_cols), mSecondCols(second_cols) {}
+
+    /** The window from \p from to \p to of a ring of \p ring_cols columns,
+     *  whose newest column is \p newest. The indices are resolved already. */
+    static BasicMatrixBufferView ofRing (const Scalar* ring, int rows, int ring_cols, 
+            int newest, int from, int to) {
+
+        from += newest;
+        to += newest;
+
+        if ( from > ring_cols-1 ) 
+            return BasicMatrixBufferView(ring + (from-ring_cols)*rows, to-from+1, 
+                    0, 0, rows);
+
+        if ( to > ring_cols-1 )
+            return BasicMatrixBufferView(ring + from*rows, ring_cols-from, ring, 
+                    to-ring_cols+1, rows);
+
+        return BasicMatrixBufferView(ring + from*rows, to-from+1, 0, 0, rows);
+    }
+
+    int rows () const { return mRows; }
+    int cols () const { return mFirstCols + mSecondCols; }
+
+    /** True if the window is a single block. */
+    bool isContiguous () const { return mSecondCols == 0; }
+
+    Segment first () const { return Segment(mpFirst, mRows, mFirstCols); }
+
+    /** The wrapped part of the window, it has no columns if there is none. */
+    Segment second () const { return Segment(mpSecond, mRows, mSecondCols); }
+
+    /** Column \p j of the window. */
+    Column col (int j) const {
+        return j < mFirstCols ? Column(mpFirst + j*mRows, mRows) 
+            : Column(mpSecond + (j-mFirstCols)*mRows, mRows);
+    }
+
+    Scalar operator() (int i, int j) const { return col(j)[i]; }
+
+    /** Copies the window into \p mat. */
+    template<typename Derived>
+    void copyTo (Eigen::DenseBase<Derived>& mat) const {
+        mat.derived().resize(mRows, cols());
+        mat.leftCols(mFirstCols) = first();
+        mat.rightCols(mSecondCols) = second();
+    }
+};
+
+typedef BasicMatrixBufferView<double> MatrixBufferView;
+typedef BasicMatrixBufferView<float> FloatMatrixBufferView;
+
 class MatrixBuffer : public AbstractMatrixBuffer {
 
 protected:
@@ -96,6 +179,146 @@ public:
         AbstractMatrixBuffer(vector_size, vector_count), mInIdx(vectorCount),
         mMatrix(Eigen::MatrixXd::Zero(vector_size, vector_count))  {}
 
+    /** Get a view of the matrix from \p from to \p to without copying it.
+     *
+     * The indices are the same as for getMatrix. */
+    MatrixBufferView getView (int from, int to) const;
+};
+
+/** A MatrixBuffer that keeps its vectors as floats, in half the memory.
+ *
+ * Vectors pushed as doubles are narrowed and getMatrix widens them again. 
+ * Float vectors, e.g. from AbstractConverter::applyInto(void*, float*, int),
+ * are pushed and read with pushFloat and getFloatMatrix without any conversion. */
+class FloatMatrixBuffer : public AbstractMatrixBuffer {
+
+protected:
+    Eigen::MatrixXf mMatrix;
+    Eigen::MatrixXf mOutFloatMatrix;
+    int mInIdx;
+
+    virtual bool pushVector (const Eigen::VectorXd& v);
+
+    virtual void resetBuffer ();
+
+    virtual void fillOutMatrix (int from, int to);
+
+    /** Writes \p v as the newest column, as float. */
+    template<typename Derived>
+    bool pushColumn (const Eigen::MatrixBase<Derived>& v);
+
+public:
+    FloatMatrixBuffer (int vector_size, int vector_count) :
+        AbstractMatrixBuffer(vector_size, vector_count), 
+        mMatrix(Eigen::MatrixXf::Zero(vector_size, vector_count)), mInIdx(vectorCount) {}
+
+    /** Push a float vector to the buffer. */
+    bool pushFloat (const Eigen::VectorXf& v);
+
+    /** Get the matrix from \p from to \p to as floats.
+     *
+     * The indices are the same as for getMatrix. */
+    const Eigen::MatrixXf& getFloatMatrix (int from, int to);
+
+    /** Get a view of the floats from \p from to \p to without copying them.
+     *
+     * \see MatrixBuffer::getView */
+    FloatMatrixBufferView getFloatView (int from, int to) const;
+};
+
+/** A buffer one thread pushes to while another thread reads from it.
+ *
+ * Pushing never waits. Reading takes no lock, but it may have to copy its
+ * window again. The vectors are written to a ring with slack more columns than
+ * vectorCount. The producer guards each push with a sequence number like a
+ * seqlock: odd while a column is written, even when it is done. A reader copies
+ * its window and checks with the sequence number whether the producer started
+ * to overwrite one of the copied columns meanwhile. If so, it copies again.
+ *
+ * A copy is only repeated if more than slack vectors are pushed while the
+ * window is copied. The default slack is vectorCount, so the producer has to
+ * push faster than the reader copies its columns to make a reader retry, and
+ * it has to keep doing that for a reader to starve.
+ *
+ * Only one thread may push and only one thread may call getMatrix. reset
+ * belongs to the pushing thread, getPushCount and isFilled are safe to call
+ * from the reader. */
+class ConcurrentMatrixBuffer : public AbstractMatrixBuffer {
+
+protected:
+    Eigen::MatrixXd mRing;
+    int mCapacity; //!< Columns of the ring.
+
+    /** Twice the number of completed pushes, plus one while a push writes. */
+    boost::atomic<unsigned long> mSequence;
+
+    virtual bool pushVector (const Eigen::VectorXd& v);
+
+    virtual void resetBuffer ();
+
+    virtual void fillOutMatrix (int from, int to);
+
+public:
+    /** \param slack is the number of columns the ring has beyond vector_count.
+     *   The more there are, the more vectors can be pushed during a read
+     *   without the need to read again. A negative slack is vector_count. */
+    ConcurrentMatrixBuffer (int vector_size, int vector_count, int slack=-1);
+
+    /** The number of vectors pushed so far, safe to call from the reader. */
+    unsigned long getWriteCount () const { 
+        return mSequence.load(boost::memory_order_acquire) / 2; 
+    }
+
+    /** The pushes completed so far, also from the reader, see getWriteCount. */
+    virtual int getPushCount () { return getWriteCount(); }
+};
+
+/** A buffer whose windows are always contiguous in memory.
+ *
+ * The ring of the buffer is mapped twice back-to-back into the address space,
+ * so the columns behind its end are again its first columns. Any window of up
+ * to vectorCount vectors is then a single block, that getWindow returns without
+ * a copy. The ring has at least vectorCount columns and is rounded up to whole
+ * memory pages.
+ *
+ * This needs memfd_create and is only available on Linux, elsewhere the
+ * constructor throws. */
+class MirroredMatrixBuffer : public AbstractMatrixBuffer {
+
+protected:
+    double* mpRing;
+    int mCapacity; //!< Columns of the ring.
+    size_t mRingBytes; //!< Size of one mapping of the ring.
+    int mInIdx;
+
+    virtual bool pushVector (const Eigen::VectorXd& v);
+
+    virtual void resetBuffer ();
+
+    virtual void fillOutMatrix (int from, int to);
+
+private:
+    MirroredMatrixBuffer (const MirroredMatrixBuffer&);
+    MirroredMatrixBuffer& operator= (const MirroredMatrixBuffer&);
+
+public:
+    typedef Eigen::Map<const Eigen::MatrixXd> Window;
+
+    /** \throws std::runtime_error if the ring cannot be mapped. */
+    MirroredMatrixBuffer (int vector_size, int vector_count);
+
+    ~MirroredMatrixBuffer ();
+
+    /** Get the matrix from \p from to \p to without copying it.
+     *
+     * The indices are the same as for getMatrix. The window is valid until the
+     * next push or reset. */
+    Window getWindow (int from, int to) const;
+
+    /** The same as getWindow as a MatrixBufferView, it is always contiguous. */
+    MatrixBufferView getView (int from, int to) const;
+
+    int getCapacity () const { return mCapacity; }
 };
 
 }
@@ -18,6 +18,52 @@
 
 namespace type_to_vector {
 
+/** The kinds of scalars a value in a type can have. 
+ *
+ * Used by compiled converters to group values and convert them without calling a 
+ * function per value. */
+enum ScalarKind {
+    NoScalar = 0,
+    NullScalar,
+    SInt8,
+    SInt16,
+    SInt32,
+    SInt64,
+    UInt8,
+    UInt16,
+    UInt32,
+    UInt64,
+    Float32,
+    Float64,
+    LongDouble,
+    ScalarKindCount
+};
+
+/** Maps a c++ type to its ScalarKind. */
+template <typename T> struct ScalarKindOf { static const ScalarKind kind = NoScalar; };
+template <> struct ScalarKindOf<int8_t> { static const ScalarKind kind = SInt8; };
+template <> struct ScalarKindOf<int16_t> { static const ScalarKind kind = SInt16; };
+template <> struct ScalarKindOf<int32_t> { static const ScalarKind kind = SInt32; };
+template <> struct ScalarKindOf<int64_t> { static const ScalarKind kind = SInt64; };
+template <> struct ScalarKindOf<uint8_t> { static const ScalarKind kind = UInt8; };
+template <> struct ScalarKindOf<uint16_t> { static const ScalarKind kind = UInt16; };
+template <> struct ScalarKindOf<uint32_t> { static const ScalarKind kind = UInt32; };
+template <> struct ScalarKindOf<uint64_t> { static const ScalarKind kind = UInt64; };
+template <> struct ScalarKindOf<float> { static const ScalarKind kind = Float32; };
+template <> struct ScalarKindOf<double> { static const ScalarKind kind = Float64; };
+template <> struct ScalarKindOf<long double> { static const ScalarKind kind = LongDouble; };
+
+/** How doubles are cast back into integer values.
+ *
+ * Used by the compiled back conversion, values of floating point types are 
+ * always cast directly. */
+enum BackCastPolicy {
+    BackCastTruncate, //!< T(value), undefined for values out of the range of T.
+    BackCastSaturate, //!< Clamped to the range of T and truncated, NaN gives the minimum.
+    BackCastRound, //!< Rounded to the nearest integer, then clamped.
+    BackCastChecked //!< Like BackCastRound, the values out of range are counted.
+};
+
 /* The function signature for cast functions. */
 typedef double (*CastFunction)(void*);
 /* The function signature for back cast functions. */
@@ -152,6 +198,62 @@ static BackCastFunction getBackCastFunction(Typelib::Type const& type) {
     }
 }
 
+/** The scalar kind of a numeric type. */
+static ScalarKind getNumericScalarKind(Typelib::Numeric const& type) {
+    switch(type.getNumericCategory()) {
+
+    case Typelib::Numeric::SInt:
+        switch(type.getSize()) {
+        case 1: return SInt8;
+        case 2: return SInt16;
+        case 4: return SInt32;
+        case 8: return SInt64;
+        default:
+            return NoScalar;
+        }
+
+    case Typelib::Numeric::UInt:
+        switch(type.getSize()) {
+        case 1: return UInt8;
+        case 2: return UInt16;
+        case 4: return UInt32;
+        case 8: return UInt64;
+        default:
+            return NoScalar;
+        }
+
+    case Typelib::Numeric::Float:
+        switch(type.getSize()) {
+        case sizeof(float): return Float32;
+        case sizeof(double): return Float64;
+        case sizeof(long double): return LongDouble;
+        default:
+            return NoScalar;
+        }
+    default:
+        return NoScalar;
+    }
+}
+
+/** Determines the scalar kind of a typelib type. */
+static ScalarKind getScalarKind(Typelib::Type const& type) {
+
+    switch(type.getCategory()) {
+
+    case Typelib::Type::Numeric:
+        return getNumericScalarKind(static_cast<Typelib::Numeric const&>(type));
+
+    case Typelib::Type::Enum:
+        return ScalarKindOf<Typelib::Enum::integral_type>::kind;
+
+    case Typelib::Type::NullType:
+        return NullScalar;
+
+    default:
+        return NoScalar;
+    }
+}
+
 } // namespace type_to_vector
 
 #endif // TYPETOVECTOR_NUMERIVCONVERTER_HPP
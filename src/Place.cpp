@@ -0,0 +1,121 @@
+// \file  Place.cpp
+
+#include <algorithm>
+#include <utilmm/stringtools.hh>
+
+#include "Place.hpp"
+
+using namespace type_to_vector;
+
+PlaceTable::PlaceTable () {
+
+    Path empty = { 0, 0, 0 };
+    mPaths.push_back(empty);
+}
+
+PlaceTable& PlaceTable::instance () {
+
+    static PlaceTable table;
+    return table;
+}
+
+unsigned int PlaceTable::getTokenId (const std::string& token) {
+
+    std::map<std::string, unsigned int>::const_iterator it = mTokenIds.find(token);
+
+    if ( it != mTokenIds.end() ) return it->second;
+
+    unsigned int id = mTokens.push_back(token);
+    mTokenIds[token] = id;
+
+    return id;
+}
+
+unsigned int PlaceTable::appendToken (unsigned int path, unsigned int token) {
+
+    std::pair<unsigned int, unsigned int> key(path, token);
+
+    std::map<std::pair<unsigned int, unsigned int>, unsigned int>::const_iterator it = 
+        mPathIds.find(key);
+
+    if ( it != mPathIds.end() ) return it->second;
+
+    Path p = { path, token, mPaths[path].depth + 1 };
+
+    unsigned int id = mPaths.push_back(p);
+    mPathIds[key] = id;
+
+    return id;
+}
+
+void PlaceTable::appendPath (std::vector<unsigned int>& tokens, unsigned int path) const {
+
+    unsigned int first = tokens.size();
+
+    for ( ; path != 0; path = mPaths[path].parent )
+        tokens.push_back(mPaths[path].token);
+
+    std::reverse(tokens.begin() + first, tokens.end());
+}
+
+unsigned int PlaceTable::intern (const std::string& place) {
+
+    if ( place.empty() ) return 0;
+
+    utilmm::stringlist tokens = utilmm::split(place, ".");
+
+    boost::mutex::scoped_lock lock(mMutex);
+
+    unsigned int path = 0;
+
+    utilmm::stringlist::const_iterator it = tokens.begin();
+
+    for ( ; it != tokens.end(); it++ )
+        path = appendToken(path, getTokenId(*it));
+
+    return path;
+}
+
+std::string PlaceTable::render (unsigned int path) const {
+
+    if ( path == 0 ) return "";
+
+    std::vector<unsigned int> tokens;
+    appendPath(tokens, path);
+
+    std::string result = mTokens[tokens[0]];
+
+    for ( unsigned int i=1; i<tokens.size(); i++ )
+        result += "." + mTokens[tokens[i]];
+
+    return result;
+}
+
+void PlaceTable::getTokens (unsigned int path, StringVector& tokens) const {
+
+    std::vector<unsigned int> ids;
+    appendPath(ids, path);
+
+    for ( unsigned int i=0; i<ids.size(); i++ )
+        tokens.push_back(mTokens[ids[i]]);
+}
+
+unsigned int PlaceTable::getDepth (unsigned int path) const {
+
+    return mPaths[path].depth;
+}
+
+unsigned int PlaceTable::getParent (unsigned int path) const {
+
+    return mPaths[path].parent;
+}
+
+unsigned int PlaceTable::getTokenCount () const {
+
+    return mTokens.size();
+}
+
+unsigned int PlaceTable::getPathCount () const {
+
+    return mPaths.size();
+}
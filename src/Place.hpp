@@ -0,0 +1,176 @@
+/**
+ * \file  Place.hpp
+ *
+ * \brief Place descriptions interned as integer ids.
+ *
+ * A place like "position.3" or "rotation.im" is a path of tokens. The tokens are
+ * interned into a dictionary and each path is stored once as its parent path and
+ * its last token. A Place is the id of such a path, so copies and comparisons are
+ * integer operations and the string is only rendered on demand.
+ */
+
+#ifndef TYPETOVECTOR_PLACE_HPP
+#define TYPETOVECTOR_PLACE_HPP
+
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "Definitions.hpp"
+
+namespace type_to_vector {
+
+/** An array that only grows, whose elements never move.
+ *
+ * The elements are stored in chunks that are never reallocated, so an element
+ * can be read without a lock while another thread appends. Appending needs
+ * an external lock. The pointers to the \p MaxChunks chunks are allocated
+ * with the array, so it holds at most MaxChunks * 4096 elements. */
+template <class T, unsigned int MaxChunks>
+class AppendOnlyArray {
+
+    enum { ChunkBits = 12, ChunkSize = 1 << ChunkBits };
+
+    boost::atomic<T*> mChunks[MaxChunks];
+    boost::atomic<unsigned int> mSize;
+
+    AppendOnlyArray (const AppendOnlyArray&);
+    AppendOnlyArray& operator= (const AppendOnlyArray&);
+
+public:
+    AppendOnlyArray () : mSize(0) {
+        for ( unsigned int i=0; i<MaxChunks; i++ ) mChunks[i].store(0);
+    }
+
+    ~AppendOnlyArray () {
+        for ( unsigned int i=0; i<MaxChunks; i++ ) delete[] mChunks[i].load();
+    }
+
+    /** Appends a value and returns its index. Not thread safe. */
+    unsigned int push_back (const T& value) {
+
+        unsigned int index = mSize.load(boost::memory_order_relaxed);
+        unsigned int chunk = index >> ChunkBits;
+
+        if ( chunk >= MaxChunks ) throw std::length_error("place table is full");
+
+        T* elements = mChunks[chunk].load(boost::memory_order_relaxed);
+
+        if ( !elements ) {
+            elements = new T[ChunkSize];
+            mChunks[chunk].store(elements, boost::memory_order_release);
+        }
+
+        elements[index & (ChunkSize-1)] = value;
+        mSize.store(index+1, boost::memory_order_release);
+
+        return index;
+    }
+
+    /** An element that was appended before, thread safe. */
+    const T& operator[] (unsigned int index) const {
+        return mChunks[index >> ChunkBits].load(boost::memory_order_acquire)
+            [index & (ChunkSize-1)];
+    }
+
+    unsigned int size () const { return mSize.load(boost::memory_order_acquire); }
+};
+
+/** The table of all interned tokens and paths.
+ *
+ * There is one table for the process, all methods are thread safe. Interning
+ * takes a lock, but the table only grows, so reading the tokens of a path does
+ * not. Path 0 is the empty place. */
+class PlaceTable {
+
+    struct Path {
+        unsigned int parent;
+        unsigned int token;
+        unsigned int depth; //!< Number of tokens.
+    };
+
+    /** The names of the fields and the indices up to the largest array, 
+     *  at most 1M. */
+    AppendOnlyArray<std::string, 256> mTokens;
+    std::map<std::string, unsigned int> mTokenIds;
+
+    /** One per place of all tocs made, at most 16M. */
+    AppendOnlyArray<Path, 4096> mPaths;
+    std::map<std::pair<unsigned int, unsigned int>, unsigned int> mPathIds;
+
+    mutable boost::mutex mMutex; //!< Guards the interning.
+
+    PlaceTable ();
+
+    unsigned int getTokenId (const std::string& token);
+    unsigned int appendToken (unsigned int path, unsigned int token);
+    void appendPath (std::vector<unsigned int>& tokens, unsigned int path) const;
+
+public:
+    static PlaceTable& instance ();
+
+    /** The id of a place with tokens separated by dots. */
+    unsigned int intern (const std::string& place);
+
+    /** Renders a path with its tokens separated by dots. */
+    std::string render (unsigned int path) const;
+
+    /** Appends the tokens of a path to \p tokens. */
+    void getTokens (unsigned int path, StringVector& tokens) const;
+
+    unsigned int getDepth (unsigned int path) const;
+
+    /** The path without its last token. */
+    unsigned int getParent (unsigned int path) const;
+
+    unsigned int getTokenCount () const;
+    unsigned int getPathCount () const;
+};
+
+/** A place description interned in the PlaceTable. */
+class Place {
+
+    unsigned int mId;
+
+public:
+    Place () : mId(0) {}
+    explicit Place (const std::string& place) : mId(PlaceTable::instance().intern(place)) {}
+
+    static Place fromId (unsigned int id) { Place p; p.mId = id; return p; }
+
+    unsigned int getId () const { return mId; }
+
+    bool empty () const { return mId == 0; }
+
+    /** The place without its last token. */
+    Place getParent () const { return fromId(PlaceTable::instance().getParent(mId)); }
+
+    /** The number of tokens. */
+    unsigned int getDepth () const { return PlaceTable::instance().getDepth(mId); }
+
+    /** The tokens of the place. */
+    StringVector getTokens () const {
+        StringVector tokens;
+        PlaceTable::instance().getTokens(mId, tokens);
+        return tokens;
+    }
+
+    std::string toString () const { return PlaceTable::instance().render(mId); }
+
+    bool operator== (const Place& other) const { return mId == other.mId; }
+    bool operator!= (const Place& other) const { return mId != other.mId; }
+    bool operator< (const Place& other) const { return mId < other.mId; }
+};
+
+inline std::ostream& operator<< (std::ostream& os, const Place& place) {
+    return os << place.toString();
+}
+
+} // namespace type_to_vector
+
+#endif // TYPETOVECTOR_PLACE_HPP
@@ -0,0 +1,213 @@
+// \file  SliceMask.cpp
+
+#include <boost/lexical_cast.hpp>
+
+#include "SliceMask.hpp"
+
+using namespace type_to_vector;
+
+namespace {
+
+/** A node of the slice tree reached by the place tokens so far. */
+struct PartialMatch {
+    const SliceNode* node;
+    IndexConditions conditions;
+};
+
+typedef std::vector<PartialMatch> PartialMatches;
+
+/** A match is complete if a slice ends at its node. */
+bool isComplete (const PartialMatch& match) {
+
+    return match.node->terminal;
+}
+
+/** Moves the matches one place token further down the slice tree.
+ *
+ * A "*" token is a container, then the index slice of the node becomes a condition
+ * for the level of the container. */
+PartialMatches advanceMatches (const PartialMatches& matches, const std::string& token) {
+
+    PartialMatches result;
+
+    bool is_index = false;
+    int index = -1;
+
+    try {
+        index = boost::lexical_cast<int>(token);
+        is_index = true;
+    } catch (boost::bad_lexical_cast&) {}
+
+    PartialMatches::const_iterator it = matches.begin();
+
+    for ( ; it != matches.end(); it++ ) {
+
+        if ( isComplete(*it) ) {
+            result.push_back(*it);
+            continue;
+        }
+
+        SliceNodeVector::const_iterator cit = it->node->childs.begin();
+
+        for ( ; cit != it->node->childs.end(); cit++ ) {
+
+            PartialMatch next = { &(*cit), it->conditions };
+
+            if ( token == "*" ) {
+
+                if ( !cit->isCountable() ) continue;
+
+                next.conditions.push_back( cit->place == "*" ?
+                        IndexSlices() : cit->indices );
+
+            } else if ( is_index ) {
+
+                if ( !cit->isIn(index) ) continue;
+
+            } else if ( token != cit->place ) continue;
+
+            result.push_back(next);
+        }
+    }
+
+    return result;
+}
+
+void resolve (const VectorToc& toc, const PartialMatches& matches, int level,
+        bool inverse, SliceMask& mask) {
+
+    VectorToc::const_iterator it = toc.begin();
+
+    for ( ; it != toc.end(); it++ ) {
+
+        PartialMatches current = matches;
+
+        StringVector tokens = it->placeDescription.getTokens();
+        StringVector::const_iterator tit = tokens.begin();
+
+        for ( ; tit != tokens.end(); tit++ )
+            current = advanceMatches(current, *tit);
+
+        SliceMaskEntry entry;
+        entry.inverse = inverse;
+
+        if ( it->content.get() ) {
+
+            if ( !inverse ) {
+
+                entry.allElements = false;
+
+                PartialMatches::const_iterator mit = current.begin();
+
+                for ( ; mit != current.end(); mit++ ) {
+
+                    if ( int(mit->conditions.size()) <= level ||
+                            mit->conditions[level].empty() ) {
+                        entry.allElements = true;
+                        entry.elementIndices.clear();
+                        break;
+                    }
+
+                    entry.elementIndices.insert(entry.elementIndices.end(),
+                            mit->conditions[level].begin(), mit->conditions[level].end());
+                }
+            }
+
+            entry.content.reset(new SliceMask());
+            resolve(*(it->content), current, level+1, inverse, *(entry.content));
+
+            entry.state = SliceMaskEntry::Skip;
+
+            SliceMask::const_iterator eit = entry.content->begin();
+
+            for ( ; eit != entry.content->end(); eit++ )
+                if ( eit->state != SliceMaskEntry::Skip )
+                    entry.state = SliceMaskEntry::Take;
+
+        } else {
+
+            bool always = false;
+
+            PartialMatches::const_iterator mit = current.begin();
+
+            for ( ; mit != current.end() && !always; mit++ ) {
+
+                if ( !isComplete(*mit) ) continue;
+
+                always = true;
+
+                for ( unsigned int l=0; l<mit->conditions.size(); l++ )
+                    if ( !mit->conditions[l].empty() ) always = false;
+
+                if ( !always ) entry.alternatives.push_back(mit->conditions);
+            }
+
+            if ( always ) {
+                entry.state = inverse ? SliceMaskEntry::Skip : SliceMaskEntry::Take;
+                entry.alternatives.clear();
+            } else if ( entry.alternatives.empty() )
+                entry.state = inverse ? SliceMaskEntry::Take : SliceMaskEntry::Skip;
+            else
+                entry.state = SliceMaskEntry::Check;
+        }
+
+        mask.push_back(entry);
+    }
+}
+
+} // namespace
+
+
+bool SliceMaskEntry::fits (const int* indices) const {
+
+    std::vector<IndexConditions>::const_iterator it = alternatives.begin();
+
+    for ( ; it != alternatives.end(); it++ ) {
+
+        bool met = true;
+
+        for ( unsigned int l=0; l<it->size() && met; l++ )
+            if ( !(*it)[l].empty() && !isIn((*it)[l], indices[l]) ) met = false;
+
+        if ( met ) return !inverse;
+    }
+
+    return inverse;
+}
+
+bool SliceMaskEntry::isIn (const IndexSlices& indices, int index) {
+
+    IndexSlices::const_iterator it = indices.begin();
+
+    for ( ; it != indices.end(); it++ )
+        if ( index >= it->from && index <= it->to && (index - it->from)%it->every == 0 )
+            return true;
+
+    return false;
+}
+
+
+SliceMaskPointer SliceMask::create (const VectorToc& toc, const std::string& slice) {
+
+    if ( slice == "" ) return SliceMaskPointer();
+
+    SliceTree tree(slice);
+
+    PartialMatch root = { &tree, IndexConditions() };
+    PartialMatches matches(1, root);
+
+    SliceMaskPointer mask(new SliceMask());
+    resolve(toc, matches, 0, tree.isInverse(), *mask);
+
+    return mask;
+}
+
+int SliceMask::getDepth () const {
+
+    int depth = 0;
+
+    for ( const_iterator it = begin(); it != end(); it++ )
+        if ( it->content.get() ) depth = std::max(depth, 1 + it->content->getDepth());
+
+    return depth;
+}
@@ -0,0 +1,81 @@
+/**
+ * \file  SliceMask.hpp
+ *
+ * \brief A slice resolved for the entries of a toc.
+ *
+ * Instead of matching the place of every converted value against the slice, the
+ * slice is resolved once for a toc. Values that are in or out of the slice
+ * independently of the container indices are marked as such. For the other
+ * values the conditions on the indices of the enclosing containers are stored.
+ */
+
+#ifndef TYPETOVECTOR_SLICEMASK_HPP
+#define TYPETOVECTOR_SLICEMASK_HPP
+
+#include <vector>
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+
+#include "SliceMatcher.hpp"
+#include "VectorToc.hpp"
+
+namespace type_to_vector {
+
+/** Conditions on the indices of the enclosing containers.
+ *
+ * Element \c l is the condition for the container on level \c l, where 0 is the
+ * outmost container. An empty IndexSlices means any index. Missing levels
+ * accept any index. */
+typedef std::vector<IndexSlices> IndexConditions;
+
+struct SliceMask;
+typedef boost::shared_ptr<SliceMask> SliceMaskPointer;
+
+/** The slice resolved for an entry of a toc. */
+struct SliceMaskEntry {
+
+    enum State {
+        Skip, //!< Not in the slice, or a container without any value in the slice.
+        Take, //!< In the slice, or a container that has to be visited.
+        Check //!< Depends on the container indices, see fits.
+    };
+
+    State state;
+    bool inverse; //!< The slice is inverse, a met condition means not to take it.
+    std::vector<IndexConditions> alternatives; //!< For Check, one has to be met.
+
+    bool allElements; //!< For containers, if false only elementIndices are needed.
+    IndexSlices elementIndices; //!< Indices of the container elements to visit.
+    SliceMaskPointer content; //!< The mask for the content of a container.
+
+    SliceMaskEntry () : state(Take), inverse(false), allElements(true) {}
+
+    /** Checks whether a value with the state Check is in the slice.
+     *
+     * \param indices are the current indices of the enclosing containers. */
+    bool fits (const int* indices) const;
+
+    /** Checks whether an element of a container has to be visited. */
+    bool needsElement (int index) const {
+        return allElements || isIn(elementIndices, index);
+    }
+
+    static bool isIn (const IndexSlices& indices, int index);
+};
+
+/** A slice resolved for each entry of a toc. */
+struct SliceMask : public std::vector<SliceMaskEntry> {
+
+    /** Resolves a slice for a toc.
+     *
+     * \returns a null pointer if the slice is empty. */
+    static SliceMaskPointer create (const VectorToc& toc, const std::string& slice);
+
+    /** The number of levels of containers in the toc. */
+    int getDepth () const;
+};
+
+} // namespace type_to_vector
+
+#endif // TYPETOVECTOR_SLICEMASK_HPP
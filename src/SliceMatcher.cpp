@@ -1,6 +1,7 @@
 // \file  SliceMatcher.cpp
 
 #include <set>
+#include <algorithm>
 
 #include <boost/lexical_cast.hpp>
 
@@ -189,27 +190,28 @@ utilmm::stringlist SliceStore::replaceIndicesSlices(const std::string& str, bool
     return str_list;
 }
 
-bool SliceMatcher::fitsASlice (const std::string& place) {
-
-    std::string place_dot = place + ".";
+SliceMatcher::SliceMatcher (const std::string& slice, bool general) : 
+    mSlices(slice,general) {
 
-    StringVector places = createGeneralPlaces(place_dot);
-    StringVector slices = mSlices.getPlaces();
+    if ( !general ) {
+        mpAutomaton.reset(new SliceAutomaton(slice, false));
+        return;
+    }
 
-    if ( slices.empty() ) return !mSlices.isInverse();
+    // in general mode the slices are the resolved places without indices
+    std::string general_slice = mSlices.isInverse() ? "!" : "";
 
-    StringVector::const_iterator it_places = places.begin();
+    StringVector::const_iterator it = mSlices.getPlaces().begin();
 
-    for ( ; it_places != places.end(); it_places++ ) {
-        
-        StringVector::const_iterator it_slices = slices.begin();
+    for ( ; it != mSlices.getPlaces().end(); it++ )
+        general_slice += " " + it->substr(0, it->size()-1);
 
-        for ( ; it_slices != slices.end(); it_slices++ )
+    mpAutomaton.reset(new SliceAutomaton(general_slice, false));
+}
 
-            if ( startswith(*it_places, *it_slices) ) return !mSlices.isInverse();
-    }
+bool SliceMatcher::fitsASlice (const std::string& place) {
 
-    return mSlices.isInverse();
+    return mpAutomaton->fitsASlice(place);
 }
 
 StringVector SliceMatcher::createGeneralPlaces (const std::string& place, size_t start) {
@@ -291,7 +293,7 @@ SliceNode& SliceNodeVector::insert (const SliceNode& node) {
 }
 
 
-SliceNode::SliceNode(const std::string& slice_token) {
+SliceNode::SliceNode(const std::string& slice_token) : terminal(false) {
     
     place = slice_token;
     indices = resolveToIndices(slice_token);
@@ -368,6 +370,9 @@ SliceTree::SliceTree(const std::string& slice_str) {
     utilmm::stringlist::const_iterator sit = places.begin();
 
     for ( ; sit != places.end(); sit++ ) addBranch(*this, *sit);
+
+    // no slices at all match everything
+    terminal = childs.empty();
 }
 
 void SliceTree::addBranch(SliceNode& node, const std::string& slice) {
@@ -377,6 +382,7 @@ void SliceTree::addBranch(SliceNode& node, const std::string& slice) {
     SliceNode& next = node.childs.insert( SliceNode(slice.substr(0,dot)) );
 
     if (dot != std::string::npos) addBranch(next, slice.substr(dot+1));
+    else next.terminal = true;
 }
 
 bool SliceTree::fitsASlice(const std::string& place_str) {
@@ -391,7 +397,7 @@ bool SliceTree::fitsASlice(const std::string& place_str) {
 
 bool SliceTree::placeIsBranch(const SliceNode& node) {
 
-    if (node.childs.empty()) return true;
+    if (node.terminal) return true;
     
     if ( mTokIt == mPlaceTokens.end() ) return false;
     
@@ -399,11 +405,11 @@ bool SliceTree::placeIsBranch(const SliceNode& node) {
 
         int index = boost::lexical_cast<int>(*mTokIt);
 
-        mTokIt++;
+        StringVector::const_iterator next_tok = ++mTokIt;
         
         SliceNodeVector::const_iterator it = node.childs.begin();
 
-        for ( ; it != node.childs.end(); it++ )
+        for ( ; it != node.childs.end(); it++, mTokIt = next_tok )
             if (it->isIn(index)) 
                 if (placeIsBranch(*it)) return true;
 
@@ -411,11 +417,11 @@ bool SliceTree::placeIsBranch(const SliceNode& node) {
 
         std::string tok = *mTokIt;
         
-        mTokIt++;
+        StringVector::const_iterator next_tok = ++mTokIt;
        
         SliceNodeVector::const_iterator it = node.childs.begin();
 
-        for ( ; it != node.childs.end(); it++ )
+        for ( ; it != node.childs.end(); it++, mTokIt = next_tok )
             if ( tok == it->place || ( tok == "*" && it->isCountable() ) )
                 if ( placeIsBranch(*it) ) return true;
     }
@@ -446,3 +452,224 @@ std::string SliceNode::toString() {
 
     return res;
 }
+
+
+SliceAutomaton::SliceAutomaton(const std::string& slice, bool wildcard_places) : 
+    mWildcardPlaces(wildcard_places), mGeneration(0) {
+
+    init(SliceTree(slice));
+}
+
+SliceAutomaton::SliceAutomaton(const SliceTree& tree, bool wildcard_places) : 
+    mWildcardPlaces(wildcard_places), mGeneration(0) {
+
+    init(tree);
+}
+
+void SliceAutomaton::init(const SliceTree& tree) {
+
+    mInverse = tree.isInverse();
+
+    addToken(tree);
+    std::sort(mTokens.begin(), mTokens.end());
+    mTokens.erase(std::unique(mTokens.begin(), mTokens.end()), mTokens.end());
+
+    addNode(tree);
+
+    mActive.resize(mNodes.size());
+    mNext.resize(mNodes.size());
+    mMarks.resize(mNodes.size(), 0);
+}
+
+void SliceAutomaton::addToken(const SliceNode& node) {
+
+    SliceNodeVector::const_iterator it = node.childs.begin();
+
+    for ( ; it != node.childs.end(); it++ ) {
+        if ( !it->isCountable() ) mTokens.push_back(it->place);
+        addToken(*it);
+    }
+}
+
+int SliceAutomaton::addNode(const SliceNode& node) {
+
+    int id = mNodes.size();
+    
+    Node n = { node.terminal, 0, 0, 0, 0 };
+    mNodes.push_back(n);
+
+    std::vector<NameTransition> names;
+    std::vector<IndexTransition> indices;
+
+    SliceNodeVector::const_iterator it = node.childs.begin();
+
+    for ( ; it != node.childs.end(); it++ ) {
+
+        int target = addNode(*it);
+
+        if ( it->isCountable() ) {
+
+            IndexTransition t = { it->place == "*", 
+                static_cast<int>(mIndexSlices.size()), 
+                static_cast<int>(it->indices.size()), target };
+
+            mIndexSlices.insert(mIndexSlices.end(), it->indices.begin(), 
+                    it->indices.end());
+            indices.push_back(t);
+
+        } else {
+
+            NameTransition t = { getTokenId(it->place.c_str(), it->place.size()), 
+                target };
+            names.push_back(t);
+        }
+    }
+
+    std::sort(names.begin(), names.end());
+
+    mNodes[id].firstName = mNameTransitions.size();
+    mNodes[id].nameCount = names.size();
+    mNameTransitions.insert(mNameTransitions.end(), names.begin(), names.end());
+
+    mNodes[id].firstIndex = mIndexTransitions.size();
+    mNodes[id].indexCount = indices.size();
+    mIndexTransitions.insert(mIndexTransitions.end(), indices.begin(), indices.end());
+
+    return id;
+}
+
+int SliceAutomaton::getTokenId(const char* token, size_t length) const {
+
+    int lower = 0;
+    int upper = mTokens.size();
+
+    while ( lower < upper ) {
+
+        int middle = (lower + upper) / 2;
+        int cmp = mTokens[middle].compare(0, std::string::npos, token, length);
+
+        if ( cmp == 0 ) return middle;
+
+        if ( cmp < 0 ) lower = middle+1;
+        else upper = middle;
+    }
+
+    return -1;
+}
+
+bool SliceAutomaton::isIn(const IndexTransition& transition, int index) const {
+
+    if ( transition.any ) return true;
+
+    IndexSlices::const_iterator it = mIndexSlices.begin() + transition.firstSlice;
+    IndexSlices::const_iterator end = it + transition.sliceCount;
+
+    for ( ; it != end; it++ )
+        if ( index >= it->from && index <= it->to && (index - it->from)%it->every == 0 )
+            return true;
+
+    return false;
+}
+
+bool SliceAutomaton::activate(int target, int& count) {
+
+    if ( mNodes[target].final ) return true;
+
+    if ( mMarks[target] != mGeneration ) {
+        mMarks[target] = mGeneration;
+        mNext[count++] = target;
+    }
+
+    return false;
+}
+
+bool SliceAutomaton::fitsASlice(const std::string& place) {
+
+    const char* begin = place.c_str();
+
+    return fitsASlice(begin, begin + place.size());
+}
+
+bool SliceAutomaton::fitsASlice(const char* begin, const char* end) {
+
+    if ( mNodes[0].final ) return !mInverse;
+
+    mActive[0] = 0;
+    int active_count = 1;
+
+    const char* token = begin;
+
+    while ( token < end ) {
+
+        const char* token_end = std::find(token, end, '.');
+
+        if ( token_end == token ) {
+            token++;
+            continue;
+        }
+
+        // classify the token: a name, an index or any index
+        bool any = token_end - token == 1 && *token == '*';
+        bool is_index = !any;
+        int index = 0;
+        
+        const char* c = token;
+        bool negative = *c == '-';
+        if ( negative ) c++;
+        if ( c == token_end ) is_index = false;
+
+        for ( ; c != token_end && is_index; c++ ) {
+            if ( *c < '0' || *c > '9' ) is_index = false;
+            else index = 10*index + (*c - '0');
+        }
+
+        if ( negative ) index = -index;
+
+        int name = any || is_index ? -1 : getTokenId(token, token_end - token);
+
+        if ( ++mGeneration == 0 ) {
+            std::fill(mMarks.begin(), mMarks.end(), 0);
+            mGeneration = 1;
+        }
+
+        int next_count = 0;
+
+        for ( int i=0; i<active_count; i++ ) {
+
+            const Node& node = mNodes[mActive[i]];
+
+            if ( name >= 0 ) {
+
+                NameTransition key = { name, 0 };
+                std::vector<NameTransition>::const_iterator first = 
+                    mNameTransitions.begin() + node.firstName;
+                std::vector<NameTransition>::const_iterator last = first + node.nameCount;
+                std::vector<NameTransition>::const_iterator t = 
+                    std::lower_bound(first, last, key);
+
+                if ( t != last && t->token == name && activate(t->target, next_count) )
+                    return !mInverse;
+
+            } else if ( any || is_index ) {
+
+                std::vector<IndexTransition>::const_iterator t = 
+                    mIndexTransitions.begin() + node.firstIndex;
+                std::vector<IndexTransition>::const_iterator last = t + node.indexCount;
+
+                for ( ; t != last; t++ )
+                    if ( ( any ? mWildcardPlaces || t->any : isIn(*t, index) ) && 
+                            activate(t->target, next_count) )
+                        return !mInverse;
+            }
+        }
+
+        if ( next_count == 0 ) return mInverse;
+
+        mActive.swap(mNext);
+        active_count = next_count;
+
+        token = token_end;
+    }
+
+    return mInverse;
+}
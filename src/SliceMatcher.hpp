@@ -3,8 +3,9 @@
  *
  * \brief Matches a position in a type to a slice description.
  *
- * \todo benchmark SliceMatcher vs. SliceTree
- * \todo replace SliceMatcher by SliceTree, if latter is faster
+ * SliceMatcher and SliceTree describe the slices, the matching itself is done
+ * by a SliceAutomaton compiled from the slices. test/SliceTiming.cpp compares
+ * the three.
  *
  */
 
@@ -13,6 +14,7 @@
 
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
 #include <utilmm/stringtools.hh>
 
 #include "Definitions.hpp"
@@ -107,16 +109,25 @@ public:
     static utilmm::stringlist replaceIndicesSlices (const std::string& str, bool general);
 };
     
-/** The slice matcher checks whether a place description fits one of its slices. */
+class SliceAutomaton;
+
+/** The slice matcher checks whether a place description fits one of its slices.
+ *
+ * A "*" in the place only fits a "*" of the slice, not an index slice like 
+ * "a.3" or "a.[1-3]". So "a.*" fits "a.*" but not "a.3", while "a.3" fits
+ * both. SliceTree and the default SliceAutomaton let "a.*" fit "a.3" as well. */
 class SliceMatcher {
 
     SliceStore mSlices;
+    boost::shared_ptr<SliceAutomaton> mpAutomaton;
 
 public:
 
-    SliceMatcher(const std::string& slice, bool general=false) : mSlices(slice,general) {}
+    SliceMatcher(const std::string& slice, bool general=false);
     
-    /** Checks whether a place fits at least one slice or not. */
+    /** Checks whether a place fits at least one slice or not. 
+     *
+     * The check is done by a SliceAutomaton without wildcard places. */
     bool fitsASlice(const std::string& place);
     
     const SliceStore& getSlices() const { return mSlices; }
@@ -148,7 +159,11 @@ struct SliceNode {
     IndexSlices indices;
     SliceNodeVector childs;
 
-    SliceNode() {}
+    /** A slice ends here. It can still have childs if another slice goes on, 
+     *  like "a" in "a a.b". */
+    bool terminal;
+
+    SliceNode() : terminal(false) {}
     SliceNode(const std::string& slice_token);
 
     bool isCountable() const;
@@ -174,6 +189,9 @@ struct SliceTree : public SliceNode {
 
     bool fitsASlice(const std::string& place_str);
 
+    /** Returns true if the places in the tree should not be in a vector. */
+    bool isInverse() const { return mInverse; }
+
 
 protected:
     bool placeIsBranch(const SliceNode& node);
@@ -184,6 +202,84 @@ private:
     bool mInverse;
 };
 
+/** A SliceTree compiled into an automaton over place tokens.
+ *
+ * The nodes of the tree are flattened into an array. The names in the slice are
+ * interned and each node holds its name transitions sorted by the token id,
+ * countable nodes are reached by index transitions that carry their IndexSlices.
+ * A place is matched token by token on the set of active nodes. The buffers
+ * for this set are allocated during construction, so fitsASlice takes time
+ * linear in the number of place tokens and does not allocate.
+ *
+ * The matching is the one of SliceTree: a place fits if its first tokens match
+ * a slice, a "*" in the place matches any countable node. Without 
+ * \p wildcard_places it only matches a "*" of the slice, as in SliceMatcher. */
+class SliceAutomaton {
+
+public:
+    SliceAutomaton(const std::string& slice, bool wildcard_places=true);
+    SliceAutomaton(const SliceTree& tree, bool wildcard_places=true);
+
+    /** Checks whether a place fits at least one slice or not. */
+    bool fitsASlice(const std::string& place);
+
+    /** Checks the place given by the characters from \p begin to \p end. */
+    bool fitsASlice(const char* begin, const char* end);
+
+    bool isInverse() const { return mInverse; }
+
+    /** The number of nodes, the root is node 0. */
+    int getNodeCount() const { return mNodes.size(); }
+
+    /** The id of a name token of the slice.
+     *
+     * \returns -1 if the slice does not contain the token. */
+    int getTokenId(const char* token, size_t length) const;
+
+private:
+    struct Node {
+        bool final; //!< A slice ends at this node.
+        int firstName, nameCount; //!< Range in mNameTransitions.
+        int firstIndex, indexCount; //!< Range in mIndexTransitions.
+    };
+
+    struct NameTransition {
+        int token;
+        int target;
+        bool operator< (const NameTransition& other) const { return token < other.token; }
+    };
+
+    struct IndexTransition {
+        bool any; //!< The node is a "*", all indices are valid.
+        int firstSlice, sliceCount; //!< Range in mIndexSlices.
+        int target;
+    };
+
+    void init(const SliceTree& tree);
+
+    int addNode(const SliceNode& node);
+
+    void addToken(const SliceNode& node);
+
+    bool isIn(const IndexTransition& transition, int index) const;
+
+    /** Sets the transition target as active, true if a slice ends there. */
+    bool activate(int target, int& count);
+
+    std::vector<Node> mNodes;
+    std::vector<NameTransition> mNameTransitions;
+    std::vector<IndexTransition> mIndexTransitions;
+    IndexSlices mIndexSlices;
+    StringVector mTokens; //!< The interned names, sorted.
+    bool mInverse;
+    bool mWildcardPlaces; //!< A "*" in the place matches all index slices.
+
+    std::vector<int> mActive; //!< The active nodes.
+    std::vector<int> mNext; //!< The active nodes after the current token.
+    std::vector<unsigned int> mMarks; //!< Generation a node was activated last.
+    unsigned int mGeneration;
+};
+
 } // namespace type_to_vector
 
 #endif //  TYPETOVECTOR_SLICEMATCHER_HPP
@@ -33,7 +33,8 @@ void PlainTocVisitor::push_place () {
 
 void PlainTocVisitor::visit ( VectorValueInfo const& info ) {
 
-    if (!info.placeDescription.empty()) mPlaceStack.push_back(info.placeDescription); 
+    if (!info.placeDescription.empty()) 
+        mPlaceStack.push_back(info.placeDescription.toString());
 
     if (!info.content.get()) push_place();
     else VectorTocVisitor::visit(info);
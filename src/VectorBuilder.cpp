@@ -1,11 +1,83 @@
 // \file  VectorBuilder.cpp
 
+#include <algorithm>
 #include <stdexcept>
 
+#include <boost/bind.hpp>
+
 #include "VectorBuilder.hpp"
 
 using namespace type_to_vector;
 
+namespace {
+
+void updateConversion (VectorConversion* conversion, void* data, bool create_places) {
+
+    conversion->update(data, create_places);
+}
+
+} // namespace
+
+VectorConversion::VectorConversion (const VectorConversion& other) : 
+    mIdentifier(other.mIdentifier), mConverters(other.mConverters), mData(other.mData),
+    mUpdateCounts(other.mUpdateCounts), mFused(other.mFused), 
+    mpFusedProgram(other.mpFusedProgram), mFusedConverters(other.mFusedConverters),
+    mFusedPrograms(other.mFusedPrograms), mFusedFactors(other.mFusedFactors),
+    mFusedOutputs(other.mFusedOutputs), mFusedFloatOutputs(other.mFusedFloatOutputs),
+    mpOwner(0) {
+
+    detachOutputs(other);
+}
+
+VectorConversion& VectorConversion::operator= (const VectorConversion& other) {
+
+    if ( this == &other ) return *this;
+
+    mIdentifier = other.mIdentifier;
+    mConverters = other.mConverters;
+    mData = other.mData;
+    mUpdateCounts = other.mUpdateCounts;
+    mFused = other.mFused;
+    mpFusedProgram = other.mpFusedProgram;
+    mFusedConverters = other.mFusedConverters;
+    mFusedPrograms = other.mFusedPrograms;
+    mFusedFactors = other.mFusedFactors;
+    mFusedOutputs = other.mFusedOutputs;
+    mFusedFloatOutputs = other.mFusedFloatOutputs;
+
+    detachOutputs(other);
+
+    if ( mpOwner ) {
+        mpOwner->renamed();
+        mpOwner->outputChanged(-1);
+    }
+
+    return *this;
+}
+
+void VectorConversion::setName (const std::string& name) {
+
+    mIdentifier = name;
+
+    if ( mpOwner ) mpOwner->renamed();
+}
+
+void VectorConversion::detachOutputs (const VectorConversion& other) {
+
+    mOutputs.assign(other.mOutputs.size(), 0);
+    mFloatOutputs.assign(other.mFloatOutputs.size(), 0);
+    mOutputSizes.assign(other.mOutputSizes.size(), 0);
+
+    for ( unsigned int i=0; i<mOutputs.size(); i++ ) {
+
+        const double* out = other.mOutputs[i];
+        const float* float_out = other.mFloatOutputs[i];
+
+        if ( out ) mData[i].assign(out, out + other.mOutputSizes[i]);
+        if ( float_out ) mData[i].assign(float_out, float_out + other.mOutputSizes[i]);
+    }
+}
+
 int VectorConversion::addConverter (AbstractConverter::Pointer converter_ptr) {
 
     if ( !mConverters.empty() && 
@@ -14,6 +86,10 @@ int VectorConversion::addConverter (AbstractConverter::Pointer converter_ptr) {
 
     mConverters.push_back(converter_ptr);
     mData.push_back(VectorOfDoubles());
+    mOutputs.push_back(0);
+    mFloatOutputs.push_back(0);
+    mOutputSizes.push_back(0);
+    mUpdateCounts.push_back(0);
     return size();
 }
 
@@ -25,26 +101,218 @@ void VectorConversion::update (const Typelib::Value& value, bool create_places)
     update(value.getData(), create_places);
 }
 
+void VectorConversion::checkOutput (int converter_idx, int size) const {
+
+    if ( !hasOutput(converter_idx) || size == mOutputSizes[converter_idx] ) return;
+
+    if ( mpOwner ) mpOwner->outputChanged(converter_idx);
+
+    throw std::runtime_error("converter of " + mIdentifier + 
+            " changed its output size since its output was set");
+}
+
+void VectorConversion::convert (int converter_idx, void* data, bool create_places) {
+
+    AbstractConverter& converter = *mConverters[converter_idx];
+    double* out = mOutputs[converter_idx];
+    float* float_out = mFloatOutputs[converter_idx];
+
+    if ( !out && !float_out ) {
+        mUpdateCounts[converter_idx]++;
+        mData[converter_idx] = converter.apply(data, create_places);
+        return;
+    }
+
+    int n = converter.getOutputSize();
+
+    checkOutput(converter_idx, n);
+
+    mUpdateCounts[converter_idx]++;
+
+    if ( create_places ) {
+        const VectorOfDoubles& vec = converter.apply(data, true);
+        if ( int(vec.size()) != n )
+            throw std::runtime_error("conversion does not fit its output");
+        if ( out ) std::copy(vec.begin(), vec.end(), out);
+        else std::copy(vec.begin(), vec.end(), float_out);
+    } else if ( (out ? converter.applyInto(data, out, n) : 
+                converter.applyInto(data, float_out, n)) != n )
+        throw std::runtime_error("conversion does not fit its output");
+}
+
+void VectorConversion::updateFusion () {
+
+    // runs for every sample, so the programs are compared without allocations
+    unsigned int fused = 0;
+    bool same = true;
+
+    for ( unsigned int i=0; i<mConverters.size() && same; i++ ) {
+
+        double factor;
+        ConversionProgramPointer program = mConverters[i]->getFlatProgram(factor);
+
+        if ( !program ) continue;
+
+        same = fused < mFusedConverters.size() && mFusedConverters[fused] == int(i) && 
+            mFusedPrograms[fused] == program && mFusedFactors[fused] == factor;
+        fused++;
+    }
+
+    if ( same && fused == mFusedConverters.size() ) return;
+
+    mFusedConverters.clear();
+    mFusedPrograms.clear();
+    mFusedFactors.clear();
+
+    for ( unsigned int i=0; i<mConverters.size(); i++ ) {
+
+        double factor;
+        ConversionProgramPointer program = mConverters[i]->getFlatProgram(factor);
+
+        if ( !program ) continue;
+
+        mFusedConverters.push_back(i);
+        mFusedPrograms.push_back(program);
+        mFusedFactors.push_back(factor);
+    }
+
+    mFusedOutputs.resize(mFusedConverters.size());
+    mFusedFloatOutputs.resize(mFusedConverters.size());
+
+    // a single converter is not worth the scattering
+    if ( mFusedConverters.size() < 2 ) mpFusedProgram.reset();
+    else mpFusedProgram = FusedProgram::fuse(mFusedPrograms, mFusedFactors);
+}
+
+bool VectorConversion::isFusable (bool& to_float) const {
+
+    to_float = mFloatOutputs[mFusedConverters[0]] != 0;
+
+    for ( unsigned int f=1; f<mFusedConverters.size(); f++ )
+        if ( (mFloatOutputs[mFusedConverters[f]] != 0) != to_float ) return false;
+
+    return true;
+}
+
 void VectorConversion::update (void* data, bool create_places) {
-    
-    Converters::iterator cit = mConverters.begin();
-    DataVectors::iterator dit = mData.begin();
 
-    for ( ; cit != mConverters.end(); cit++, dit++)
-        *dit = (*cit)->apply(data, create_places);
+    // nothing is written if a converter no longer fits its output
+    for ( unsigned int i=0; i<mConverters.size(); i++ )
+        if ( hasOutput(i) ) checkOutput(i, mConverters[i]->getOutputSize());
+
+    if ( mFused && !create_places ) updateFusion();
+
+    bool to_float = false;
+
+    if ( !mFused || create_places || !mpFusedProgram || !isFusable(to_float) ) {
+        for ( unsigned int i=0; i<mConverters.size(); i++ )
+            convert(i, data, create_places);
+        return;
+    }
+
+    for ( unsigned int f=0; f<mFusedConverters.size(); f++ )
+        checkOutput(mFusedConverters[f], mpFusedProgram->outputSizes[f]);
+
+    std::vector<int>::const_iterator fit = mFusedConverters.begin();
+
+    for ( unsigned int i=0; i<mConverters.size(); i++ ) {
+
+        if ( fit == mFusedConverters.end() || *fit != int(i) ) {
+            convert(i, data, create_places);
+            continue;
+        }
+
+        unsigned int f = fit - mFusedConverters.begin();
+        double* out = mOutputs[i];
+
+        if ( to_float ) mFusedFloatOutputs[f] = mFloatOutputs[i];
+        else if ( !out ) {
+            mData[i].resize(mpFusedProgram->outputSizes[f]);
+            out = mData[i].empty() ? 0 : &mData[i][0];
+        }
+
+        mFusedOutputs[f] = out;
+        mUpdateCounts[i]++;
+        fit++;
+    }
+
+    if ( to_float ) mpFusedProgram->run(data, &mFusedFloatOutputs[0]);
+    else mpFusedProgram->run(data, &mFusedOutputs[0]);
 }
 
 void VectorConversion::update (int converter_idx, void* data, bool create_places) {
     
-    mData.at(converter_idx) = mConverters.at(converter_idx)->apply(data, create_places);
+    if ( converter_idx < 0 || converter_idx >= size() )
+        throw std::out_of_range("no converter with this index");
+
+    convert(converter_idx, data, create_places);
 }
 
-const VectorOfDoubles& VectorConversion::getData(int idx) const {
+const VectorOfDoubles& VectorConversion::getData(int idx) {
+
+    const double* out = mOutputs.at(idx);
+    const float* float_out = mFloatOutputs[idx];
+
+    if ( out ) mData[idx].assign(out, out + mOutputSizes[idx]);
+    if ( float_out ) mData[idx].assign(float_out, float_out + mOutputSizes[idx]);
 
     return mData.at(idx);
 }
 
-StringVector VectorConversion::getPlaces(int idx) const {
+int VectorConversion::getDataSize (int idx) const {
+
+    return hasOutput(idx) ? mOutputSizes[idx] : int(mData.at(idx).size());
+}
+
+template<typename Scalar>
+void VectorConversion::copyConverted (int idx, Scalar* out) const {
+
+    const double* double_out = mOutputs.at(idx);
+    const float* float_out = mFloatOutputs[idx];
+
+    if ( double_out ) std::copy(double_out, double_out + mOutputSizes[idx], out);
+    else if ( float_out ) std::copy(float_out, float_out + mOutputSizes[idx], out);
+    else std::copy(mData[idx].begin(), mData[idx].end(), out);
+}
+
+void VectorConversion::copyData (int idx, double* out) const {
+
+    copyConverted(idx, out);
+}
+
+void VectorConversion::copyData (int idx, float* out) const {
+
+    copyConverted(idx, out);
+}
+
+void VectorConversion::setOutput (int idx, double* out) {
+
+    setOutputs(idx, out, 0);
+}
+
+void VectorConversion::setFloatOutput (int idx, float* out) {
+
+    setOutputs(idx, 0, out);
+}
+
+void VectorConversion::setOutputs (int idx, double* out, float* float_out) {
+
+    bool set = out || float_out;
+
+    if ( set && mConverters.at(idx)->getOutputSize() < 0 )
+        throw std::runtime_error("converter of " + mIdentifier + 
+                " has no fixed output size");
+
+    if ( !set && hasOutput(idx) ) getData(idx);
+
+    mOutputs.at(idx) = out;
+    mFloatOutputs.at(idx) = float_out;
+    mOutputSizes.at(idx) = set ? mConverters[idx]->getOutputSize() : 0;
+
+    if ( mpOwner ) mpOwner->outputChanged(idx);
+}
+
+const StringVector& VectorConversion::getPlaces(int idx) const {
 
     return mConverters.at(idx)->getPlaceVector();
 }
@@ -60,18 +328,324 @@ void DataVectorBuilder::update (int converter_idx, int vector_idx, void* data,
     at(vector_idx).update(converter_idx, data,create_places);
 }
 
+void DataVectorBuilder::update (const ConversionUpdates& updates, WorkerPool& pool,
+        bool create_places) {
 
-const VectorOfDoubles& DataVectorBuilder::getVector (int converter_idx) {
+    std::vector<bool> updated(size(), false);
+    WorkerPool::Tasks tasks;
+
+    ConversionUpdates::const_iterator it = updates.begin();
+
+    for ( ; it != updates.end(); it++ ) {
+
+        VectorConversion& conversion = at(it->first);
+
+        if ( updated[it->first] )
+            throw std::runtime_error("conversion " + conversion.name() + 
+                    " is updated twice");
+
+        updated[it->first] = true;
+        tasks.push_back(boost::bind(&updateConversion, &conversion, it->second, 
+                    create_places));
+    }
+
+    pool.run(tasks);
+}
+
+
+DataVectorBuilder::DataVectorBuilder (const DataVectorBuilder& other) : 
+    Base(other), mNameIndex(other.mNameIndex), mHandles(other.mHandles),
+    mHandleIndex(other.mHandleIndex), mNextHandle(other.mNextHandle), 
+    mChanging(false) {
+
+    adopt();
+
+    // the copied conversions write to their data, the layouts get own stores
+    for ( unsigned int i=0; i<other.mLayouts.size(); i++ ) 
+        if ( other.hasFixedLayout(i) ) fixLayout(i, other.mLayouts[i]->isFloat);
+}
+
+DataVectorBuilder& DataVectorBuilder::operator= (const DataVectorBuilder& other) {
+
+    if ( this == &other ) return *this;
+
+    mChanging = true;
+    Base::operator=(other);
+    mChanging = false;
+
+    adopt();
+
+    mNameIndex = other.mNameIndex;
+    mHandles = other.mHandles;
+    mHandleIndex = other.mHandleIndex;
+    mNextHandle = other.mNextHandle;
+
+    mAssemblies.clear();
+    mFloatAssemblies.clear();
+    mLayouts.clear();
+    mPlaceCaches.clear();
+
+    for ( unsigned int i=0; i<other.mLayouts.size(); i++ ) 
+        if ( other.hasFixedLayout(i) ) fixLayout(i, other.mLayouts[i]->isFloat);
+
+    return *this;
+}
+
+const DataVectorBuilder::FixedLayout* DataVectorBuilder::getFixedLayout (
+        int converter_idx) const {
+
+    if ( converter_idx < 0 || int(mLayouts.size()) <= converter_idx ||
+            !mLayouts[converter_idx] ) 
+        return 0;
+
+    const FixedLayout& layout = *mLayouts[converter_idx];
+
+    return layout.valid.load(boost::memory_order_relaxed) ? &layout : 0;
+}
+
+void DataVectorBuilder::invalidateLayouts () {
+
+    for ( unsigned int i=0; i<mLayouts.size(); i++ )
+        if ( mLayouts[i] ) mLayouts[i]->valid.store(false, boost::memory_order_relaxed);
+}
+
+void DataVectorBuilder::outputChanged (int converter_idx) {
+
+    if ( mChanging ) return;
+
+    if ( converter_idx < 0 ) invalidateLayouts();
+    else if ( converter_idx < int(mLayouts.size()) && mLayouts[converter_idx] )
+        mLayouts[converter_idx]->valid.store(false, boost::memory_order_relaxed);
+}
+
+void DataVectorBuilder::fixLayout (int converter_idx, bool float_store) {
+
+    std::vector<VectorPosition> positions;
+    int n = 0;
+
+    for ( iterator it = begin(); it != end(); it++ ) {
+
+        int size = it->getConverter(converter_idx)->getOutputSize();
+
+        if ( size < 0 ) 
+            throw std::runtime_error("converter of " + it->name() + 
+                    " has no fixed output size");
+
+        positions.push_back(VectorPosition(n, n + size - 1));
+        n += size;
+    }
+
+    releaseLayout(converter_idx);
+
+    if ( int(mLayouts.size()) <= converter_idx ) mLayouts.resize(converter_idx+1);
+
+    if ( !mLayouts[converter_idx] ) mLayouts[converter_idx].reset(new FixedLayout());
+
+    FixedLayout& layout = *mLayouts[converter_idx];
+
+    layout.positions = positions;
+    layout.isFloat = float_store;
 
-    mStore.clear();
-    mStore.reserve(getVectorSize(converter_idx));
+    if ( float_store ) layout.floatStore.assign(n, 0.0f);
+    else layout.store.assign(n, 0.0);
 
-    for ( const_iterator it = begin(); it != end(); it++) {
-        const VectorOfDoubles& vec = it->getData(converter_idx);
-        mStore.insert(mStore.end(), vec.begin(), vec.end());
+    mChanging = true;
+
+    for ( unsigned int i=0; i<size(); i++ ) {
+
+        const VectorOfDoubles& data = at(i).getData(converter_idx);
+        bool fits = int(data.size()) == positions[i].end - positions[i].start + 1;
+
+        if ( float_store ) {
+            float* out = n ? &layout.floatStore[0] + positions[i].start : 0;
+            if ( fits ) std::copy(data.begin(), data.end(), out);
+            at(i).setFloatOutput(converter_idx, out);
+        } else {
+            double* out = n ? &layout.store[0] + positions[i].start : 0;
+            if ( fits ) std::copy(data.begin(), data.end(), out);
+            at(i).setOutput(converter_idx, out);
+        }
+    }
+
+    mChanging = false;
+
+    layout.generation++;
+    layout.valid.store(true, boost::memory_order_relaxed);
+}
+
+void DataVectorBuilder::releaseLayout (int converter_idx) {
+
+    if ( int(mLayouts.size()) <= converter_idx || !mLayouts[converter_idx] ) return;
+
+    FixedLayout& layout = *mLayouts[converter_idx];
+
+    if ( !layout.isFixed() ) return;
+
+    layout.valid.store(false, boost::memory_order_relaxed);
+
+    mChanging = true;
+
+    for ( iterator it = begin(); it != end(); it++ )
+        if ( it->size() > converter_idx ) it->setOutput(converter_idx, 0);
+
+    mChanging = false;
+
+    layout.positions.clear();
+    layout.store.clear();
+    layout.floatStore.clear();
+}
+
+template<typename Scalar>
+bool DataVectorBuilder::Assembly<Scalar>::isSameLayout (
+        const DataVectorBuilder& builder, int converter_idx) const {
+
+    if ( converters.size() != builder.size() ) return false;
+
+    for ( unsigned int i=0; i<builder.size(); i++ ) {
+
+        const VectorPosition& pos = positions[i];
+
+        if ( converters[i] != builder[i].getConverter(converter_idx) ||
+                builder[i].getDataSize(converter_idx) != pos.end - pos.start + 1 )
+            return false;
+    }
+
+    return true;
+}
+
+template<typename Scalar>
+void DataVectorBuilder::Assembly<Scalar>::addChanged (const VectorPosition& pos) {
+
+    if ( pos.end < pos.start ) return;
+
+    if ( !changed.empty() && changed.back().end + 1 == pos.start )
+        changed.back().end = pos.end;
+    else
+        changed.push_back(pos);
+}
+
+template<typename Scalar>
+void DataVectorBuilder::Assembly<Scalar>::copy (const VectorConversion& conversion, 
+        int converter_idx, int i) {
+
+    const VectorPosition& pos = positions[i];
+
+    if ( pos.end >= pos.start ) conversion.copyData(converter_idx, &store[pos.start]);
+}
+
+template<typename Scalar>
+DataVectorBuilder::Assembly<Scalar>& DataVectorBuilder::getAssembly (int converter_idx,
+        std::vector<boost::shared_ptr<Assembly<Scalar> > >& assemblies) {
+
+    if ( converter_idx < 0 ) throw std::out_of_range("negative converter index");
+
+    if ( int(assemblies.size()) <= converter_idx ) 
+        assemblies.resize(converter_idx+1);
+
+    if ( !assemblies[converter_idx] ) 
+        assemblies[converter_idx].reset(new Assembly<Scalar>());
+
+    return *assemblies[converter_idx];
+}
+
+template<typename Scalar>
+const std::vector<Scalar>& DataVectorBuilder::assemble (int converter_idx,
+        std::vector<boost::shared_ptr<Assembly<Scalar> > >& assemblies) {
+
+    Assembly<Scalar>& assembly = getAssembly(converter_idx, assemblies);
+    assembly.changed.clear();
+
+    const FixedLayout* layout = getFixedLayout(converter_idx);
+
+    // a layout of the other scalar type only gives the positions
+    const std::vector<Scalar>* layout_store = 
+        layout ? layout->getStore(static_cast<const Scalar*>(0)) : 0;
+
+    // a valid layout keeps its conversions and converters
+    bool same_layout = assembly.layout != layout ? false :
+        layout ? assembly.layoutGeneration == layout->generation :
+        assembly.isSameLayout(*this, converter_idx);
+
+    if ( !same_layout ) {
+
+        assembly.converters.clear();
+        assembly.counts.clear();
+        assembly.positions.clear();
+        assembly.store.clear();
+        assembly.layout = layout;
+        assembly.layoutGeneration = layout ? layout->generation : 0;
+
+        for ( const_iterator it = begin(); it != end(); it++) {
+            assembly.converters.push_back(it->getConverter(converter_idx));
+            assembly.counts.push_back(it->getUpdateCount(converter_idx));
+        }
+
+        if ( layout ) {
+            assembly.positions = layout->positions;
+            assembly.addChanged(VectorPosition(0, layout->size() - 1));
+
+            if ( layout_store ) return *layout_store;
+
+            assembly.store.resize(layout->size());
+
+            for ( unsigned int i=0; i<size(); i++ ) assembly.copy(at(i), converter_idx, i);
+
+            return assembly.store;
+        }
+
+        int n = 0;
+
+        for ( const_iterator it = begin(); it != end(); it++) {
+            int size = it->getDataSize(converter_idx);
+            assembly.positions.push_back(VectorPosition(n, n + size - 1));
+            n += size;
+        }
+
+        assembly.store.resize(n);
+
+        for ( unsigned int i=0; i<size(); i++ ) assembly.copy(at(i), converter_idx, i);
+
+        assembly.addChanged(VectorPosition(0, n-1));
+        return assembly.store;
     }
 
-    return mStore; 
+    for ( unsigned int i=0; i<size(); i++ ) {
+
+        unsigned int count = at(i).getUpdateCount(converter_idx);
+
+        if ( count == assembly.counts[i] ) continue;
+
+        assembly.counts[i] = count;
+        assembly.addChanged(assembly.positions[i]);
+
+        if ( layout_store ) continue;
+
+        assembly.copy(at(i), converter_idx, i);
+    }
+
+    return layout_store ? *layout_store : assembly.store; 
+}
+
+const VectorOfDoubles& DataVectorBuilder::getVector (int converter_idx) {
+
+    return assemble(converter_idx, mAssemblies);
+}
+
+const std::vector<VectorPosition>& DataVectorBuilder::getChangedRanges (
+        int converter_idx) {
+
+    return getAssembly(converter_idx, mAssemblies).changed;
+}
+
+const std::vector<float>& DataVectorBuilder::getFloatVector (int converter_idx) {
+
+    return assemble(converter_idx, mFloatAssemblies);
+}
+
+const std::vector<VectorPosition>& DataVectorBuilder::getFloatChangedRanges (
+        int converter_idx) {
+
+    return getAssembly(converter_idx, mFloatAssemblies).changed;
 }
 
 Eigen::VectorXd DataVectorBuilder::getEigenVector (int converter_idx) {
@@ -83,62 +657,219 @@ Eigen::VectorXd DataVectorBuilder::getEigenVector (int converter_idx) {
     return result;
 }
 
-StringVector DataVectorBuilder::getPlaces(int converter_idx) const {
-    
-    int size = getVectorSize(converter_idx);
-    
-    const_iterator it = begin();
+bool DataVectorBuilder::PlaceCache::isValid(const DataVectorBuilder& builder, 
+        int converter_idx) const {
+
+    if ( converters.size() != builder.size() ) return false;
+
+    for ( unsigned int i=0; i<builder.size(); i++ ) {
+
+        const VectorConversion& conversion = builder[i];
+
+        if ( converters[i] != conversion.getConverter(converter_idx) ||
+                versions[i] != conversion.getPlacesVersion(converter_idx) ||
+                names[i] != conversion.name() )
+            return false;
+    }
+
+    return true;
+}
+
+void DataVectorBuilder::PlaceCache::update(const DataVectorBuilder& builder, 
+        int converter_idx) {
 
-    StringVector result;
-    result.resize(size, std::string(20,' '));
+    converters.clear();
+    versions.clear();
+    names.clear();
+    places.clear();
 
-    int i = 0;
-    for ( ; it != end(); it++) {
+    const_iterator it = builder.begin();
 
-        StringVector vec = it->getPlaces(converter_idx);
+    for ( ; it != builder.end(); it++) {
+
+        converters.push_back(it->getConverter(converter_idx));
+        versions.push_back(it->getPlacesVersion(converter_idx));
+        names.push_back(it->name());
+
+        const StringVector& vec = it->getPlaces(converter_idx);
         StringVector::const_iterator sit = vec.begin();
         for (; sit != vec.end(); sit++)
             if ( *sit == "" )
-                result[i++] = it->name();
+                places.push_back(it->name());
             else
-                result[i++] = it->name() + "." + *sit;
+                places.push_back(it->name() + "." + *sit);
     }
+}
+
+const StringVector& DataVectorBuilder::getPlaces(int converter_idx) const {
+
+    if ( int(mPlaceCaches.size()) <= converter_idx ) 
+        mPlaceCaches.resize(converter_idx+1);
 
-    return result; 
+    if ( !mPlaceCaches[converter_idx] ) 
+        mPlaceCaches[converter_idx].reset(new PlaceCache());
+
+    PlaceCache& cache = *mPlaceCaches[converter_idx];
+
+    if ( !cache.isValid(*this, converter_idx) ) cache.update(*this, converter_idx);
+
+    return cache.places; 
 }
 
 VectorPosition DataVectorBuilder::getVectorPosition(int converter_idx, 
         int vector_idx) const {
 
+    const FixedLayout* layout = getFixedLayout(converter_idx);
+
+    if ( layout ) return layout->positions.at(vector_idx);
+
     VectorPosition pos;
 
     pos.start = 0;
     
     int i;
     for (i=0; i<vector_idx; i++ )
-        pos.start += at(i).getData(converter_idx).size();
+        pos.start += at(i).getDataSize(converter_idx);
 
-    pos.end = pos.start + at(i).getData(converter_idx).size() - 1;
+    pos.end = pos.start + at(i).getDataSize(converter_idx) - 1;
 
     return pos;
 }
 
-int DataVectorBuilder::getVectorIdx (std::string vector_id) const {
+void DataVectorBuilder::adopt () {
 
-    const_iterator it = begin();
+    for ( iterator it = begin(); it != end(); it++ ) it->mpOwner = this;
+}
+
+void DataVectorBuilder::reindex () {
+
+    mHandleIndex.clear();
+
+    for ( unsigned int i=0; i<mHandles.size(); i++ )
+        mHandleIndex[mHandles[i]] = i;
 
-    for ( int i=0; it != end(); it++, i++)
-        if ( it->name() == vector_id ) return i;
+    rebuildNameIndex();
+}
+
+void DataVectorBuilder::rebuildNameIndex () {
+
+    mNameIndex.clear();
 
-    return -1;
+    for ( int i = size()-1; i >= 0; i-- )
+        mNameIndex[at(i).name()] = i;
+}
+
+void DataVectorBuilder::renamed () {
+
+    // an earlier conversion can have the old or the new name, so all are indexed
+    if ( !mChanging ) rebuildNameIndex();
+}
+
+ConversionHandle DataVectorBuilder::addConversion (const VectorConversion& conversion) {
+
+    const VectorConversion* first = empty() ? 0 : &front();
+
+    Base::push_back(conversion);
+
+    // the conversions were copied if the storage grew
+    if ( &front() != first ) adopt();
+    else back().mpOwner = this;
+
+    int idx = size() - 1;
+    int handle = mNextHandle++;
+
+    mHandles.push_back(handle);
+    mHandleIndex[handle] = idx;
+
+    // keeps an earlier conversion with the same name
+    mNameIndex.insert(std::make_pair(conversion.name(), idx));
+
+    invalidateLayouts();
+
+    return ConversionHandle(handle);
+}
+
+DataVectorBuilder::iterator DataVectorBuilder::insert (iterator pos, 
+        const VectorConversion& conversion) {
+
+    int idx = pos - begin();
+
+    mChanging = true;
+    Base::insert(pos, conversion);
+    mChanging = false;
+
+    adopt();
+
+    mHandles.insert(mHandles.begin() + idx, mNextHandle++);
+    reindex();
+
+    invalidateLayouts();
+
+    return begin() + idx;
+}
+
+DataVectorBuilder::iterator DataVectorBuilder::erase (iterator first, iterator last) {
+
+    int from = first - begin();
+    int to = last - begin();
+
+    mChanging = true;
+    Base::erase(first, last);
+    mChanging = false;
+
+    mHandles.erase(mHandles.begin() + from, mHandles.begin() + to);
+    reindex();
+
+    invalidateLayouts();
+
+    return begin() + from;
+}
+
+int DataVectorBuilder::getVectorIdx (const std::string& vector_id) const {
+
+    boost::unordered_map<std::string, int>::const_iterator it = 
+        mNameIndex.find(vector_id);
+
+    return it == mNameIndex.end() ? -1 : it->second;
+}
+
+int DataVectorBuilder::getVectorIdx (ConversionHandle handle) const {
+
+    boost::unordered_map<int, int>::const_iterator it = mHandleIndex.find(handle.id);
+
+    return it == mHandleIndex.end() ? -1 : it->second;
+}
+
+void DataVectorBuilder::update (ConversionHandle handle, void* data, bool create_places) {
+
+    int idx = getVectorIdx(handle);
+
+    if ( idx < 0 ) throw std::out_of_range("no conversion for this handle");
+
+    at(idx).update(data, create_places);
+}
+
+const VectorOfDoubles& DataVectorBuilder::getData (ConversionHandle handle, 
+        int converter_idx) {
+
+    int idx = getVectorIdx(handle);
+
+    if ( idx < 0 ) throw std::out_of_range("no conversion for this handle");
+
+    return at(idx).getData(converter_idx);
 }
 
 int DataVectorBuilder::getVectorSize(int converter_idx) const {
+
+    const FixedLayout* layout = getFixedLayout(converter_idx);
+
+    if ( layout ) return layout->size();
+
     const_iterator it = begin();
     int size = 0;
 
     for ( ; it != end(); it++)
-        size += it->getData(converter_idx).size();
+        size += it->getDataSize(converter_idx);
 
     return size;
 }
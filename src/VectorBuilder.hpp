@@ -17,14 +17,23 @@
 #include <vector>
 #include <string>
 
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
 #include "Definitions.hpp"
 #include "Converter.hpp"
+#include "CompiledConverter.hpp"
+#include "WorkerPool.hpp"
 
 namespace type_to_vector {
 
 typedef std::vector<AbstractConverter::Pointer> Converters;
 typedef std::vector<VectorOfDoubles> DataVectors;
 
+/** Pairs of a conversion index and the data to update it with. */
+typedef std::vector<std::pair<int, void*> > ConversionUpdates;
+
 struct VectorPosition {
     int start;
     int end;
@@ -35,16 +44,70 @@ struct VectorPosition {
     bool empty() { return end == start-1; }
 };
 
+class DataVectorBuilder;
+
 /** Holder of all information and data of a conversion. */
 class VectorConversion {
+    friend class DataVectorBuilder;
+
     std::string mIdentifier;
 
     Converters mConverters;
-    DataVectors mData;
+    DataVectors mData; //!< For an output, a copy made by getData.
+    std::vector<double*> mOutputs; //!< Where a converter writes to, 0 for mData.
+    std::vector<float*> mFloatOutputs; //!< Where a converter writes floats to.
+    std::vector<int> mOutputSizes; //!< Number of values reserved at an output.
+    std::vector<unsigned int> mUpdateCounts; //!< Number of updates per converter.
+
+    bool mFused; //!< Converters with flat programs are run in one pass.
+    FusedProgramPointer mpFusedProgram;
+    std::vector<int> mFusedConverters; //!< Indices of the fused converters.
+    std::vector<ConversionProgramPointer> mFusedPrograms;
+    std::vector<double> mFusedFactors;
+    std::vector<double*> mFusedOutputs;
+    std::vector<float*> mFusedFloatOutputs;
+
+    /** The builder holding the conversion, it is told about renames and 
+     *  changed outputs.
+     *
+     * It is not copied, a copy belongs to no builder until one adds it. */
+    DataVectorBuilder* mpOwner;
+
+    void convert (int converter_idx, void* data, bool create_places);
+
+    /** Takes the values \p other wrote to its outputs as own data.
+     *
+     * A copy must not write to the outputs of the original, they belong to
+     * the layout of another builder. */
+    void detachOutputs (const VectorConversion& other);
+
+    /** \throws std::runtime_error if a converter no longer fits its output, 
+     *  then the builder drops the fixed layout of the output. */
+    void checkOutput (int converter_idx, int size) const;
+
+    /** Fuses the flat programs of the converters again if they changed. */
+    void updateFusion ();
+
+    /** The fused pass writes one scalar type, so it needs all fused converters
+     *  to write floats or none of them. */
+    bool isFusable (bool& to_float) const;
+
+    bool hasOutput (int idx) const { return mOutputs[idx] || mFloatOutputs[idx]; }
+
+    void setOutputs (int idx, double* out, float* float_out);
+
+    template<typename Scalar>
+    void copyConverted (int idx, Scalar* out) const;
 
 public:
-    VectorConversion (std::string name) : mIdentifier(name) {}
-    VectorConversion () : mIdentifier("") {}
+    VectorConversion (std::string name) : mIdentifier(name), mFused(false), mpOwner(0) {}
+    VectorConversion () : mIdentifier(""), mFused(false), mpOwner(0) {}
+
+    /** Copies a conversion, the copy writes to its own data, see setOutput.
+     *
+     * An assigned conversion stays in the builder it was in. */
+    VectorConversion (const VectorConversion& other);
+    VectorConversion& operator= (const VectorConversion& other);
 
     int addConverter(AbstractConverter::Pointer converter_ptr);
 
@@ -54,51 +117,382 @@ public:
     
     void update ( int converter_idx, void* data, bool create_places=false);
 
-    const VectorOfDoubles& getData(int idx) const;
+    /** The values of converter \p idx.
+     *
+     * If the converter writes to an output, they are copied from there into
+     * the data of the conversion first. Use getDataSize and copyData to read
+     * them without that copy. */
+    const VectorOfDoubles& getData(int idx);
+
+    /** The number of values converter \p idx gave, without copying them. */
+    int getDataSize(int idx) const;
+
+    /** Copies the values of converter \p idx from its output or its data to
+     *  \p out, which needs room for getDataSize(idx) values. */
+    void copyData(int idx, double* out) const;
+    void copyData(int idx, float* out) const;
+
+    /** Lets a converter write its values directly to \p out instead of its data.
+     *
+     * The converter needs a fixed output size and \p out room for that many
+     * values. An output of 0 restores writing to the data of the conversion.
+     * Outputs are not copied with the conversion, a copy writes to its data.
+     * The output keeps the size the converter had here. If the converter's
+     * size changes later, e.g. by a new slice, its updates throw until the 
+     * output is set again. */
+    void setOutput(int idx, double* out);
+
+    /** Like setOutput, but the converter narrows its values to floats at \p out.
+     *
+     * Setting either output replaces the other one. getData widens the values
+     * again. */
+    void setFloatOutput(int idx, float* out);
+
+    double* getOutput(int idx) const { return mOutputs.at(idx); }
+
+    float* getFloatOutput(int idx) const { return mFloatOutputs.at(idx); }
+
+    /** The number of values reserved at the output of converter \p idx. */
+    int getOutputReserve(int idx) const { return mOutputSizes.at(idx); }
+
+    /** Lets update(data) convert all converters with a flat program in one pass.
+     *
+     * Each value of the data is read once and written to the outputs of all
+     * of these converters. Other converters and updates that create places
+     * are converted one by one as before. The fused converters do not
+     * update their own results, only the data of this conversion. */
+    void setFused (bool fused) { mFused = fused; }
+
+    bool isFused () const { return mFused; }
+
+    /** The number of converters fused by the last update. */
+    int getFusedCount () const { return mpFusedProgram ? mFusedConverters.size() : 0; }
+
+    /** Changes whenever the converter \p idx is updated. */
+    unsigned int getUpdateCount(int idx) const { return mUpdateCounts.at(idx); }
 
     const VectorToc& getToc(int idx) const { return mConverters.at(idx)->getToc(); }
 
-    StringVector getPlaces(int idx) const;
+    const StringVector& getPlaces(int idx) const;
+
+    /** Changes whenever getPlaces(idx) changes. */
+    unsigned int getPlacesVersion(int idx) const { 
+        return mConverters.at(idx)->getPlaceVectorVersion(); 
+    }
+
+    const AbstractConverter* getConverter(int idx) const { 
+        return mConverters.at(idx).get(); 
+    }
 
     int size() const { return mConverters.size(); }
 
-    void setName(const std::string& name) { mIdentifier = name; }
+    /** Renames the conversion and updates the name index of its builder. */
+    void setName(const std::string& name);
     std::string name() const { return mIdentifier; }
+
     std::string getTypeName() const { return mConverters.back()->getTypeName(); }
 };
 
-/** Builds vector from several types. */
-class DataVectorBuilder : public std::vector<VectorConversion> {
+/** A handle of a conversion in a DataVectorBuilder.
+ *
+ * Unlike the index of the conversion, it stays the same if conversions before
+ * it are inserted or erased. */
+struct ConversionHandle {
+    int id;
+
+    ConversionHandle () : id(-1) {}
+    explicit ConversionHandle (int i) : id(i) {}
+};
+
+/** Builds vector from several types. 
+ *
+ * The builder is a std::vector of its conversions that only offers the 
+ * functions that keep its indices of names and handles and its layouts. */
+class DataVectorBuilder : private std::vector<VectorConversion> {
 
-    VectorOfDoubles mStore;
+    friend class VectorConversion;
+
+    typedef std::vector<VectorConversion> Base;
+
+public:
+    using Base::value_type;
+    using Base::reference;
+    using Base::const_reference;
+    using Base::iterator;
+    using Base::const_iterator;
+    using Base::size_type;
+
+    using Base::begin;
+    using Base::end;
+    using Base::size;
+    using Base::empty;
+    using Base::operator[];
+    using Base::at;
+    using Base::front;
+    using Base::back;
+
+private:
+
+    /** The vector last assembled for a converter index. 
+     *
+     * Only parts of conversions that were updated since are copied again. */
+    template<typename Scalar>
+    struct Assembly {
+        std::vector<Scalar> store;
+        std::vector<const AbstractConverter*> converters;
+        std::vector<unsigned int> counts; //!< Update counts of the conversions.
+        std::vector<VectorPosition> positions;
+        std::vector<VectorPosition> changed;
+        const void* layout; //!< The fixed layout it was assembled for, else 0.
+        unsigned int layoutGeneration; //!< The generation of that layout.
+
+        Assembly() : layout(0), layoutGeneration(0) {}
+
+        bool isSameLayout(const DataVectorBuilder& builder, int converter_idx) const;
+        void addChanged(const VectorPosition& pos);
+
+        /** Copies the values of conversion \p i to its position in the store. */
+        void copy(const VectorConversion& conversion, int converter_idx, int i);
+    };
+
+    std::vector<boost::shared_ptr<Assembly<double> > > mAssemblies;
+    std::vector<boost::shared_ptr<Assembly<float> > > mFloatAssemblies;
+
+    /** Index of the first conversion with a name. */
+    boost::unordered_map<std::string, int> mNameIndex;
+
+    std::vector<int> mHandles; //!< The handle of each conversion.
+    boost::unordered_map<int, int> mHandleIndex; //!< Index of each handle.
+    int mNextHandle;
+
+    /** The builder changes its conversions itself, they do not notify it. */
+    bool mChanging;
+
+    /** Lets the conversions tell the builder about renames. */
+    void adopt();
+
+    /** Rebuilds the indices of names and handles. */
+    void reindex();
+
+    void rebuildNameIndex();
+
+    /** Called by a conversion of the builder that got another name. */
+    void renamed();
+
+    template<typename Scalar>
+    static Assembly<Scalar>& getAssembly(int converter_idx, 
+            std::vector<boost::shared_ptr<Assembly<Scalar> > >& assemblies);
+
+    /** A store the conversions of a converter index write to directly. */
+    struct FixedLayout {
+        VectorOfDoubles store;
+        std::vector<float> floatStore; //!< Used instead of store for floats.
+        bool isFloat;
+        std::vector<VectorPosition> positions;
+        unsigned int generation; //!< Changes whenever the layout is fixed.
+
+        /** Cleared when the conversions change, also from the update threads. */
+        boost::atomic<bool> valid;
+
+        FixedLayout() : isFloat(false), generation(0), valid(false) {}
+
+        bool isFixed() const { return !positions.empty(); }
+
+        int size() const { return isFloat ? floatStore.size() : store.size(); }
+
+        /** The store if it holds values of the scalar type pointed to, else 0. */
+        const VectorOfDoubles* getStore(const double*) const { 
+            return isFloat ? 0 : &store; 
+        }
+        const std::vector<float>* getStore(const float*) const { 
+            return isFloat ? &floatStore : 0; 
+        }
+    };
+
+    std::vector<boost::shared_ptr<FixedLayout> > mLayouts; //!< Stable stores to write to.
+
+    /** The fixed layout of a converter index that is still valid, else 0. */
+    const FixedLayout* getFixedLayout(int converter_idx) const;
+
+    /** Assembles the vector of a converter index in the scalar type of 
+     *  \p assemblies. */
+    template<typename Scalar>
+    const std::vector<Scalar>& assemble(int converter_idx,
+            std::vector<boost::shared_ptr<Assembly<Scalar> > >& assemblies);
+
+    const VectorOfDoubles& getScalarVector(int converter_idx, const double*) {
+        return getVector(converter_idx);
+    }
+    const std::vector<float>& getScalarVector(int converter_idx, const float*) {
+        return getFloatVector(converter_idx);
+    }
+
+    /** Drops the fixed layouts, e.g. if conversions were added or removed. */
+    void invalidateLayouts();
+
+    /** Called by a conversion whose output for \p converter_idx changed, or 
+     *  all its outputs for -1. */
+    void outputChanged(int converter_idx);
+
+    /** The places of all conversions for a converter index.
+     *
+     * They are only rebuilt if a converter, its places or a conversion name 
+     * changed. */
+    struct PlaceCache {
+        std::vector<const AbstractConverter*> converters;
+        std::vector<unsigned int> versions;
+        StringVector names;
+        StringVector places;
+
+        bool isValid(const DataVectorBuilder& builder, int converter_idx) const;
+        void update(const DataVectorBuilder& builder, int converter_idx);
+    };
+
+    /** Held by pointer so that growing the list keeps returned places valid. */
+    mutable std::vector<boost::shared_ptr<PlaceCache> > mPlaceCaches;
 
 public:
+    DataVectorBuilder() : mNextHandle(0), mChanging(false) {}
+
+    /** Copies the builder with its own stores for the fixed layouts. */
+    DataVectorBuilder(const DataVectorBuilder& other);
+    DataVectorBuilder& operator=(const DataVectorBuilder& other);
+
     /** Updates all vectors. */
     void update(int vector_idx, void* data, bool create_places=false);
 
     /** Only update vectors for a certain converter. */
     void update(int converter_idx, int vector_idx, void* data, bool create_places=false);
 
+    /** Updates several conversions concurrently on the threads of \p pool.
+     *
+     * Each conversion only writes its own data, or its own part of the vector
+     * if the layout is fixed. So the conversions must not share converters.
+     * The updates are checked before any conversion runs.
+     * \throws std::runtime_error if a conversion is given twice, then none is
+     *  updated.
+     * \throws std::out_of_range if there is no conversion for an index, then
+     *  none is updated.
+     * \throws the exception of the first conversion that failed, as update
+     *  for a single conversion would, then the others are updated anyway. */
+    void update(const ConversionUpdates& updates, WorkerPool& pool, 
+            bool create_places=false);
+
+    /** Fixes the layout of the vector for a converter index.
+     *
+     * Every conversion writes its values directly into its part of one 
+     * preallocated vector, so getVector returns it without copying, and 
+     * positions and size are computed once. The layout becomes invalid if
+     * conversions are added or removed, if the output of a conversion is set,
+     * or if an update finds that a converter changed its size, e.g. by a new
+     * slice. Then the vector is concatenated again.
+     *
+     * With \p float_store the conversions narrow their values to floats, and 
+     * getFloatVector returns the store without copying. getVector then
+     * widens the values again.
+     * \throws std::runtime_error if a converter has no fixed output size. */
+    void fixLayout(int converter_idx, bool float_store=false);
+
+    /** Lets the conversions of a converter index write to their own data again. */
+    void releaseLayout(int converter_idx);
+
+    bool hasFixedLayout(int converter_idx) const { return getFixedLayout(converter_idx); }
+
+    /** The vector of all conversions for a converter index.
+     *
+     * Only the parts of conversions updated since the last call are copied,
+     * see getChangedRanges. */
     const VectorOfDoubles& getVector(int converter_idx);
+
+    /** The ranges of the vector that changed with the last call of getVector.
+     *
+     * A range is changed if its conversion was updated, even if the values
+     * stayed the same. If the layout of the vector changed, the whole vector
+     * is one range. The ranges are ordered and do not touch each other. */
+    const std::vector<VectorPosition>& getChangedRanges(int converter_idx);
+
+    /** The vector of all conversions for a converter index as floats.
+     *
+     * It is assembled apart from getVector, the values are narrowed once.
+     * If the layout was fixed with a float store, the store is returned. */
+    const std::vector<float>& getFloatVector(int converter_idx);
+
+    /** The ranges that changed with the last call of getFloatVector. */
+    const std::vector<VectorPosition>& getFloatChangedRanges(int converter_idx);
+
     Eigen::VectorXd getEigenVector(int converter_idx);
     
+    /** The vector for a converter, \p vector can be a float vector as well.
+     *
+     * A float vector is taken from getFloatVector. */
     template<typename Derived>
     bool getEigenVector(int converter_idx, Eigen::DenseBase<Derived>& vector){
-    
-        const VectorOfDoubles& vec = getVector(converter_idx);
+
+        typedef typename Derived::Scalar Scalar;
+        typedef typename Eigen::internal::conditional<
+            Eigen::internal::is_same<Scalar, float>::value, float, double>::type Stored;
+
+        const std::vector<Stored>& vec = 
+            getScalarVector(converter_idx, static_cast<const Stored*>(0));
 
         if (!vec.empty()) {
-            vector = Eigen::Map<const Eigen::VectorXd>((&vec[0]), vec.size());
+            typedef Eigen::Matrix<Stored, Eigen::Dynamic, 1> StoredVector;
+            vector = Eigen::Map<const StoredVector>((&vec[0]), vec.size())
+                .template cast<Scalar>();
             return true;
         }
         else return false; 
     }
 
-    StringVector getPlaces(int converter_idx) const;
+    /** The places of the vector for a converter, prefixed by the conversion names.
+     *
+     * The places stay valid until they are rebuilt by the next call after a
+     * change. The cache is filled lazily, so concurrent calls on the same
+     * builder need to be serialized by the caller. */
+    const StringVector& getPlaces(int converter_idx) const;
 
     VectorPosition getVectorPosition(int converter_idx, int vector_idx) const;
 
-    int getVectorIdx(std::string vector_id) const;
+    /** Adds a conversion at the end.
+     *
+     * \returns the handle of the conversion, see getVectorIdx(ConversionHandle). */
+    ConversionHandle addConversion(const VectorConversion& conversion);
+
+    void push_back(const VectorConversion& conversion) { addConversion(conversion); }
+
+    /** Inserts a conversion before \p pos, the later indices are shifted. */
+    iterator insert(iterator pos, const VectorConversion& conversion);
+
+    /** Erases conversions, their handles become invalid. */
+    iterator erase(iterator pos) { return erase(pos, pos+1); }
+    iterator erase(iterator first, iterator last);
+
+    void pop_back() { erase(end()-1); }
+    void clear() { erase(begin(), end()); }
+
+    /** The index of the first conversion with the name \p vector_id.
+     *
+     * \returns -1 if there is none. */
+    int getVectorIdx(const std::string& vector_id) const;
+
+    /** The index of the conversion with a handle.
+     *
+     * \returns -1 if the conversion was erased. */
+    int getVectorIdx(ConversionHandle handle) const;
+
+    ConversionHandle getHandle(int vector_idx) const { 
+        return ConversionHandle(mHandles.at(vector_idx)); 
+    }
+
+    /** Updates the conversion with a handle.
+     *
+     * \throws std::out_of_range if the conversion was erased. */
+    void update(ConversionHandle handle, void* data, bool create_places=false);
+
+    /** The data of a converter of the conversion with a handle.
+     *
+     * \throws std::out_of_range if the conversion was erased. */
+    const VectorOfDoubles& getData(ConversionHandle handle, int converter_idx);
 
     int getVectorSize(int conveter_idx) const;
 };
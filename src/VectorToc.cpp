@@ -2,14 +2,31 @@
 
 #include <stdexcept>
 
+#include <typelib/registry.hh>
+
 #include "SliceMatcher.hpp"
 
 #include "VectorToc.hpp"
 
 using namespace type_to_vector;
 
+ContainerHandle::ContainerHandle (const Typelib::Container& container) :
+    type(&container), elementSize(container.getIndirection().getSize()),
+    elementShift(-1), kind(Generic) {
+
+    for ( int shift = 0; shift < 32; shift++ )
+        if ( elementSize == (1u << shift) ) elementShift = shift;
+
+    std::string kind_name = container.kind();
+
+    if ( kind_name == "/std/vector" && elementSize > 0 ) kind = StdVector;
+    else if ( kind_name == "/std/string" && elementSize == 1 ) kind = StdString;
+}
+
+
 VectorValueInfo::VectorValueInfo() : 
-    placeDescription(""), position(0), castFun(0) {}
+    placeDescription(), position(0), castFun(0), backCastFun(0), 
+    scalarKind(NoScalar) {}
 
 bool VectorValueInfo::operator==(const VectorValueInfo& other ) const {
     return placeDescription == other.placeDescription &&
@@ -26,13 +43,58 @@ void VectorToc::clear() {
     std::vector<VectorValueInfo>::clear();
 }
 
-bool VectorToc::isFlat() {
+bool VectorToc::isFlat() const {
     VectorToc::const_iterator it = begin();
     for ( ; it != end(); it++)
         if ( it->content.get() ) return false;
     return true;
 }
 
+bool VectorToc::hasResolvedContainers() const {
+    VectorToc::const_iterator it = begin();
+    for ( ; it != end(); it++)
+        if ( it->content.get() && ( !it->container.isResolved() || 
+                    !it->content->hasResolvedContainers() ) ) 
+            return false;
+    return true;
+}
+
+void VectorToc::resolveContainers(const Typelib::Registry& registry) {
+
+    VectorToc::iterator it = begin();
+
+    for ( ; it != end(); it++) {
+
+        if ( !it->content.get() ) continue;
+
+        if ( !it->container.isResolved() ) {
+
+            const Typelib::Type* type = registry.get(it->containerType);
+
+            if ( !type || type->getCategory() != Typelib::Type::Container )
+                throw std::runtime_error("cannot resolve container " + it->containerType);
+
+            it->container = ContainerHandle(static_cast<const Typelib::Container&>(*type));
+        }
+
+        if ( !it->content->hasResolvedContainers() ) {
+            VectorTocPointer content(new VectorToc(*(it->content)));
+            content->resolveContainers(registry);
+            it->content = content;
+        }
+    }
+}
+
+VectorToc VectorToc::withResolvedContainers(const VectorToc& toc, 
+        const Typelib::Registry& registry) {
+
+    if ( toc.hasResolvedContainers() ) return toc;
+
+    VectorToc resolved(toc);
+    resolved.resolveContainers(registry);
+    return resolved;
+}
+
 
 void VectorTocVisitor::visit(VectorValueInfo const& info) {
     if (info.content.get()) {
@@ -55,14 +117,15 @@ void VectorTocSlicer::push_element(const VectorValueInfo& info) {
 
     if (mpMatcher) {
 
-        if (info.placeDescription != "" ) mPlaceStack.push_back(info.placeDescription);
+        if (!info.placeDescription.empty()) 
+            mPlaceStack.push_back(info.placeDescription.toString());
 
 
         std::string this_place = utilmm::join(mPlaceStack,".");
 
         if (mpMatcher->fitsASlice(this_place)) mResultStack.back().push_back(info);
 
-        if (info.placeDescription != "" ) mPlaceStack.pop_back();
+        if (!info.placeDescription.empty()) mPlaceStack.pop_back();
 
     } else
         mResultStack.back().push_back(info);
@@ -76,7 +139,7 @@ void VectorTocSlicer::visit(const VectorValueInfo& info) {
         
         if (mpMatcher ) {
             
-            mPlaceStack.push_back(info.placeDescription);
+            mPlaceStack.push_back(info.placeDescription.toString());
 
             mResultStack.push_back(VectorToc());
 
@@ -113,7 +176,7 @@ VectorToc VectorTocSlicer::apply(const std::string& slice) {
         delete mpMatcher;
         mpMatcher = 0;
     }
-    if (slice != "") mpMatcher = new SliceTree(slice); 
+    if (slice != "") mpMatcher = new SliceAutomaton(slice); 
 
     mResultStack.clear();
     mResultStack.push_back(VectorToc());
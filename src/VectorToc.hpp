@@ -3,8 +3,7 @@
  *
  * \brief To describe the content with conversion specific informations of a type.
  *
- *
- * \todo use hashes instead of strings to describe the place in a type.
+ * The places in a type are interned, see Place.hpp.
  */
 
 #ifndef TYPETOVECTOR_VECTORTOC_HPP
@@ -18,24 +17,88 @@
 #include <utilmm/stringtools.hh>
 
 #include "NumericConverter.hpp"
+#include "Place.hpp"
 
 namespace type_to_vector {
 
 struct VectorToc;
 typedef boost::shared_ptr<VectorToc> VectorTocPointer;
 
+/** A container type resolved once, so its elements are found without the registry.
+ *
+ * The kinds std::vector and std::string are read directly from their memory,
+ * without a virtual call to the container type. Other kinds ask their type for
+ * the element count and are expected to keep their elements like a std::vector. */
+struct ContainerHandle {
+
+    enum Kind {
+        Generic, //!< Counted by Typelib::Container::getElementCount.
+        StdVector,
+        StdString
+    };
+
+    const Typelib::Container* type; //!< The container type, 0 if not resolved.
+    unsigned int elementSize; //!< Size of an element in bytes.
+    int elementShift; //!< log2 of elementSize if it is a power of two, else -1.
+    Kind kind;
+
+    ContainerHandle () : type(0), elementSize(0), elementShift(-1), kind(Generic) {}
+    explicit ContainerHandle (const Typelib::Container& container);
+
+    bool isResolved () const { return type != 0; }
+
+    /** The number of elements of the container at \p ptr. */
+    unsigned int getElementCount (const void* ptr) const {
+        switch ( kind ) {
+        case StdVector: {
+            const std::vector<uint8_t>* v = 
+                reinterpret_cast<const std::vector<uint8_t>*>(ptr);
+            size_t bytes = v->end() - v->begin();
+            return elementShift >= 0 ? bytes >> elementShift : bytes / elementSize;
+        }
+        case StdString:
+            return reinterpret_cast<const std::string*>(ptr)->size();
+        default:
+            return type->getElementCount(ptr);
+        }
+    }
+
+    /** The first element of the container at \p ptr. */
+    const uint8_t* getElements (const void* ptr) const {
+        if ( kind == StdString )
+            return reinterpret_cast<const uint8_t*>(
+                    reinterpret_cast<const std::string*>(ptr)->data());
+        const std::vector<uint8_t>* v = 
+            reinterpret_cast<const std::vector<uint8_t>*>(ptr);
+        return v->empty() ? 0 : &(*v)[0];
+    }
+
+    /** Resizes the container at \p ptr to \p count elements.
+     *
+     * The elements that remain and the capacity are kept, so a container that
+     * does not grow beyond its capacity is not reallocated. */
+    void resize (void* ptr, unsigned int count) const {
+        if ( kind == StdString ) 
+            reinterpret_cast<std::string*>(ptr)->resize(count);
+        else if ( getElementCount(ptr) != count ) 
+            type->resize(ptr, count);
+    }
+};
+
 /** Information to which place in a type a vector value belongs. 
  *
  * Only types that should be stored is numerics and containers.
  * Containers will not increase the position. They have to be
  * determined during conversion time. */
 struct VectorValueInfo {
-    std::string placeDescription; //!< Something like position.3, rotation.im.1 or ...
+    Place placeDescription; //!< Something like position.3, rotation.im.1 or ...
     unsigned int position; //!< The position in bytes in the memory of this value.
     CastFunction castFun; //!< To cast the value, 0 for container or other type.
     BackCastFunction backCastFun; //!< Cast it back to the original type.
+    ScalarKind scalarKind; //!< Kind of the value, NoScalar for container or other type.
     VectorTocPointer content; //!< Subcontent (is needed for containers).
     std::string containerType; //!< Type name of the content aka container.
+    ContainerHandle container; //!< The resolved container, see VectorToc::resolveContainers.
 
 public:
     VectorValueInfo();
@@ -60,7 +123,21 @@ struct VectorToc : public std::vector<VectorValueInfo> {
     void clear();
 
     /** Checks if the toc has any containers. */
-    bool isFlat();
+    bool isFlat() const;
+
+    /** Checks if all containers, also the nested ones, are resolved. */
+    bool hasResolvedContainers() const;
+
+    /** Resolves the containers that are not resolved yet with a registry.
+     *
+     * Nested tocs are copied before they are changed, since they might be
+     * shared with other tocs.
+     * \throws std::runtime_error if a container type is not in the registry. */
+    void resolveContainers(const Typelib::Registry& registry);
+
+    /** A copy of \p toc with resolved containers. */
+    static VectorToc withResolvedContainers(const VectorToc& toc,
+            const Typelib::Registry& registry);
 
 private:
     class EqualityVisitor;
@@ -77,7 +154,7 @@ public:
     VectorTocVisitor(int max_depth=-1) : mMaxDepth(max_depth), mDepth(0) {}
 };
 
-class SliceTree;
+class SliceAutomaton;
 
 /** Generates a VectorToc by slicing another VectorToc.
  *
@@ -89,7 +166,7 @@ class VectorTocSlicer : public VectorTocVisitor {
     std::vector<VectorToc> mResultStack;
     utilmm::stringlist mPlaceStack;
 
-    SliceTree* mpMatcher;
+    SliceAutomaton* mpMatcher;
 
     void push_element (const VectorValueInfo& info);
 
@@ -12,25 +12,28 @@ void VectorTocMaker::push_valueinfo(Typelib::Type const& type) {
 
     VectorValueInfo info;
 
-    info.placeDescription = utilmm::join(mPlaceStack,".");
+    info.placeDescription = Place(utilmm::join(mPlaceStack,"."));
     info.position = mPositionStack.back(); //position();
     info.castFun = getCastFunction(type);
     info.backCastFun = getBackCastFunction(type);
+    info.scalarKind = getScalarKind(type);
     info.containerType = "";
         
     mToc.push_back(info);
 }
 
-void VectorTocMaker::push_container(Typelib::Type const& type ,VectorTocPointer toc_ptr ) {
+void VectorTocMaker::push_container(Typelib::Container const& type ,VectorTocPointer toc_ptr ) {
     
     VectorValueInfo info;
 
-    info.placeDescription = utilmm::join(mPlaceStack,".");
+    info.placeDescription = Place(utilmm::join(mPlaceStack,"."));
     info.position = mPositionStack.back(); //position();
     info.castFun = 0;
     info.backCastFun = 0;
+    info.scalarKind = NoScalar;
     info.content = toc_ptr;
     info.containerType = type.getName();
+    info.container = ContainerHandle(type);
 
     mToc.push_back(info);
 }
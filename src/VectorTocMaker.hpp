@@ -34,7 +34,7 @@ class VectorTocMaker: public Typelib::TypeVisitor {
     UIntVector mPositionStack; //!< Position in the data.
     
     void push_valueinfo(Typelib::Type const& type);
-    void push_container(Typelib::Type const& type, VectorTocPointer toc_ptr);
+    void push_container(Typelib::Container const& type, VectorTocPointer toc_ptr);
 
 protected:    
     virtual bool visit_ (Typelib::NullType const& type);
@@ -0,0 +1,156 @@
+// \file  WorkerPool.cpp
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+#include "WorkerPool.hpp"
+
+using namespace type_to_vector;
+
+WorkerPool::WorkerPool (int threads) : mGeneration(0), mStop(false), mpTasks(0),
+    mRemaining(0), mFailed(false) {
+
+    if ( threads < 0 )
+        threads = std::max(int(boost::thread::hardware_concurrency()) - 1, 0);
+
+    for ( int i=0; i<=threads; i++ )
+        mQueues.push_back(boost::shared_ptr<Queue>(new Queue()));
+
+    for ( int i=1; i<=threads; i++ )
+        mThreads.push_back(boost::shared_ptr<boost::thread>(
+                    new boost::thread(boost::bind(&WorkerPool::work, this, i))));
+}
+
+WorkerPool::~WorkerPool () {
+
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mStop = true;
+    }
+
+    mWake.notify_all();
+
+    for ( unsigned int i=0; i<mThreads.size(); i++ ) mThreads[i]->join();
+}
+
+void WorkerPool::work (int id) {
+
+    unsigned int generation = 0;
+
+    while ( true ) {
+
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+
+            while ( !mStop && mGeneration == generation ) mWake.wait(lock);
+
+            if ( mStop ) return;
+
+            generation = mGeneration;
+        }
+
+        process(id);
+    }
+}
+
+void WorkerPool::process (int id) {
+
+    int task;
+
+    while ( takeTask(id, task) ) execute(task);
+}
+
+bool WorkerPool::takeTask (int id, int& task) {
+
+    {
+        Queue& own = *mQueues[id];
+        boost::mutex::scoped_lock lock(own.mutex);
+
+        if ( !own.tasks.empty() ) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    for ( unsigned int i=1; i<mQueues.size(); i++ ) {
+
+        Queue& other = *mQueues[(id + i) % mQueues.size()];
+        boost::mutex::scoped_lock lock(other.mutex);
+
+        if ( !other.tasks.empty() ) {
+            task = other.tasks.front();
+            other.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkerPool::execute (int task) {
+
+    boost::exception_ptr error;
+    bool failed = false;
+
+    try {
+        (*mpTasks)[task]();
+    } catch ( ... ) {
+        error = boost::current_exception();
+        failed = true;
+    }
+
+    boost::mutex::scoped_lock lock(mMutex);
+
+    if ( failed && !mFailed ) {
+        mFailed = true;
+        mError = error;
+    }
+
+    if ( --mRemaining == 0 ) mDone.notify_all();
+}
+
+void WorkerPool::run (const Tasks& tasks) {
+
+    if ( tasks.empty() ) return;
+
+    boost::mutex::scoped_lock run_lock(mRunMutex);
+
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mpTasks = &tasks;
+        mRemaining = tasks.size();
+        mFailed = false;
+        mError = boost::exception_ptr();
+    }
+
+    for ( unsigned int i=0; i<tasks.size(); i++ ) {
+        Queue& queue = *mQueues[i % mQueues.size()];
+        boost::mutex::scoped_lock lock(queue.mutex);
+        queue.tasks.push_back(i);
+    }
+
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mGeneration++;
+    }
+
+    mWake.notify_all();
+
+    process(0);
+
+    boost::mutex::scoped_lock lock(mMutex);
+
+    while ( mRemaining > 0 ) mDone.wait(lock);
+
+    mpTasks = 0;
+
+    if ( !mFailed ) return;
+
+    boost::exception_ptr error = mError;
+    mError = boost::exception_ptr();
+    lock.unlock();
+
+    boost::rethrow_exception(error);
+}
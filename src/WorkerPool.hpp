@@ -0,0 +1,89 @@
+/**
+ * \file  WorkerPool.hpp
+ *
+ * \brief A fixed pool of threads that runs batches of tasks with work stealing.
+ *
+ * Each thread has its own queue of tasks. A thread takes tasks from the back of
+ * its own queue and, if that is empty, steals from the front of the others, so
+ * threads with cheap tasks help those with expensive ones.
+ */
+
+#ifndef TYPETOVECTOR_WORKERPOOL_HPP
+#define TYPETOVECTOR_WORKERPOOL_HPP
+
+#include <deque>
+#include <vector>
+
+#include <boost/exception_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace type_to_vector {
+
+/** Runs batches of tasks on a fixed set of threads.
+ *
+ * The thread calling run works on the batch as well. */
+class WorkerPool {
+
+public:
+    typedef boost::function<void ()> Task;
+    typedef std::vector<Task> Tasks;
+
+private:
+    /** The tasks of a thread, given by their index in the batch. */
+    struct Queue {
+        boost::mutex mutex;
+        std::deque<int> tasks;
+    };
+
+    std::vector<boost::shared_ptr<Queue> > mQueues; //!< Queue 0 is the caller's.
+    std::vector<boost::shared_ptr<boost::thread> > mThreads;
+
+    boost::mutex mMutex;
+    boost::condition_variable mWake; //!< Signals a new batch or the stop.
+    boost::condition_variable mDone; //!< Signals the end of a batch.
+    unsigned int mGeneration; //!< Counts the batches.
+    bool mStop;
+
+    const Tasks* mpTasks;
+    int mRemaining; //!< Tasks of the batch not finished yet.
+    boost::exception_ptr mError; //!< Exception of the first failed task of the batch.
+    bool mFailed;
+
+    boost::mutex mRunMutex; //!< Only one batch at a time.
+
+    void work (int id);
+    void process (int id);
+    bool takeTask (int id, int& task);
+    void execute (int task);
+
+    WorkerPool (const WorkerPool&);
+    WorkerPool& operator= (const WorkerPool&);
+
+public:
+    /** Starts the threads.
+     *
+     * \param threads is the number of threads besides the caller of run, a
+     *  negative number means one less than the number of cores. */
+    explicit WorkerPool (int threads = -1);
+
+    /** Stops the threads, a running batch is finished first. */
+    ~WorkerPool ();
+
+    /** The number of threads besides the caller of run. */
+    int getThreadCount () const { return mThreads.size(); }
+
+    /** Runs all tasks and returns when they are done.
+     *
+     * \throws the exception of the first task that threw, the other tasks are
+     *  still run. Standard exceptions keep their type, others can come back as
+     *  a base class or as boost::unknown_exception. */
+    void run (const Tasks& tasks);
+};
+
+} // namespace type_to_vector
+
+#endif // TYPETOVECTOR_WORKERPOOL_HPP
@@ -15,7 +15,7 @@ struct Test {
     StringVector places;
     int n; // amount of runs
     int m; // amount of slicing run
-    double result[2];
+    double result[3];
 
     template <typename S>
     double test() {
@@ -164,13 +164,14 @@ int main() {
         printf("%d/%d\n",i+1,tests.size());
         tit->result[0] = tit->test<SliceMatcher>();
         tit->result[1] = tit->test<SliceTree>();
+        tit->result[2] = tit->test<SliceAutomaton>();
     }
   
     printf("Timing results in seconds.\n"); 
-    printf("%15s | %8s | %8s | %10s\n","Name","Matcher","Tree","Runs"); 
-    printf("-----------------+----------+----------+-----------\n");
+    printf("%15s | %8s | %8s | %9s | %10s\n","Name","Matcher","Tree","Automaton","Runs"); 
+    printf("-----------------+----------+----------+-----------+-----------\n");
     for (tit = tests.begin(); tit != tests.end(); tit++ ) {
-        printf ("%15s | %8.3f | %8.3f | %7d/%7d\n", tit->name.c_str(), tit->result[0], tit->result[1], 
-                tit->n, tit->m);
+        printf ("%15s | %8.3f | %8.3f | %9.3f | %7d/%7d\n", tit->name.c_str(), 
+                tit->result[0], tit->result[1], tit->result[2], tit->n, tit->m);
     }
 }
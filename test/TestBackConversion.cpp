@@ -2,6 +2,9 @@
  *
  * Tests for converting vectorized data back into a type.
  */
+#include <algorithm>
+#include <limits>
+
 #include <boost/test/auto_unit_test.hpp>
 
 #include <typelib/typemodel.hh>
@@ -10,6 +13,7 @@
 #include "TestSuite.hpp"
 
 #include "BackConverter.hpp"
+#include "CompiledConverter.hpp"
 #include "VectorTocMaker.hpp"
 
 #include "TestTypes.h"
@@ -595,3 +599,292 @@ BOOST_AUTO_TEST_CASE( test_backconvert_container_container_with_slice )
     BOOST_CHECK( cc2.dbl_vv[2].a == cc.dbl_vv[2].a );
     BOOST_CHECK( cc2.dbl_vv[2].dbl_vector[1] == cc.dbl_vv[2].dbl_vector[1] );
 }
+
+BOOST_AUTO_TEST_CASE( test_compiled_backconvert )
+{
+    Registry registry;
+    import_types(registry);
+
+    {
+        VectorToc toc = VectorTocMaker().apply(*registry.get("/TwoArrays"));
+
+        TwoArrays a = {{1,2,3},{4,5,6,7,8}};
+        std::vector<double> dbl_vec;
+        for (int i=1; i<=8; i++) dbl_vec.push_back(i);
+
+        TwoArrays b = {{0,0,0},{0,0,0,0,0}};
+        CompiledBackConverter cbctv(toc, registry);
+        cbctv.apply(dbl_vec, &b);
+        BOOST_TEST_CHECKPOINT("CompiledBackConverter for two arrays");
+        BOOST_CHECK( a.equals(b) );
+
+        TwoArrays c = {{0,0,0},{0,0,0,0,0}};
+        BOOST_CHECK( cbctv.apply(&dbl_vec[0], 4, &c) == 4 );
+        BOOST_CHECK( c.a[2] == 3 && c.b[0] == 4 && c.b[1] == 0 );
+    }
+    {
+        VectorToc toc = VectorTocMaker().apply(*registry.get("/B"));
+
+        struct B b = { '0', { 100, -23, 'c', 12 } };
+        std::vector<double> dbl_vec;
+        dbl_vec.push_back(double(b.a));
+        dbl_vec.push_back(double(b.b.a));
+        dbl_vec.push_back(double(b.b.c));
+
+        struct B b2 = { '1', { -33, -23, '-', 12 }};
+        CompiledBackConverter cbctv(toc, registry);
+        cbctv.setSlice("a b.a b.c");
+        cbctv.apply(dbl_vec, &b2);
+        BOOST_TEST_CHECKPOINT("CompiledBackConverter for struct with slice");
+        BOOST_CHECK(b.equals(b2));
+    }
+    {
+        VectorToc toc = VectorTocMaker().apply(*registry.get("/ContainerContainer"));
+
+        ContainerContainer cc;
+        DoubleVector dv;
+        dv.a = 10;
+        dv.dbl_vector.push_back(12.2);
+        cc.dbl_vv.push_back(dv);
+        dv.a = -23;
+        dv.dbl_vector.push_back(23.0);
+        dv.dbl_vector.push_back(-142.2);
+        cc.dbl_vv.push_back(dv);
+
+        std::vector<double> dbl_vec;
+        for (int i=0; i<cc.dbl_vv.size(); i++) {
+            dbl_vec.push_back(cc.dbl_vv[i].a);
+            for (int j=0; j<cc.dbl_vv[i].dbl_vector.size(); j++ )
+                dbl_vec.push_back(cc.dbl_vv[i].dbl_vector[j]);
+        }
+
+        ContainerContainer cc_back, cc_compiled;
+        cc_back.dbl_vv.resize(2);
+        cc_back.dbl_vv[0].dbl_vector.resize(1);
+        cc_back.dbl_vv[1].dbl_vector.resize(4, -1.0);
+        cc_compiled = cc_back;
+
+        BackConverter bctv(toc, registry);
+        CompiledBackConverter cbctv(toc, registry);
+        bctv.apply(dbl_vec, &cc_back);
+        cbctv.apply(dbl_vec, &cc_compiled);
+        BOOST_TEST_CHECKPOINT("CompiledBackConverter for container of containers");
+        BOOST_CHECK( cc_back.equals(cc_compiled) );
+        BOOST_CHECK( cc_compiled.dbl_vv[1].dbl_vector[2] == -142.2 );
+        BOOST_CHECK( cc_compiled.dbl_vv[1].dbl_vector[3] == -1.0 );
+
+        bctv.setSlice("dbl_vv.*.a dbl_vv.1.dbl_vector.[0,2]");
+        cbctv.setSlice("dbl_vv.*.a dbl_vv.1.dbl_vector.[0,2]");
+        std::reverse(dbl_vec.begin(), dbl_vec.end());
+        bctv.apply(dbl_vec, &cc_back);
+        cbctv.apply(dbl_vec, &cc_compiled);
+        BOOST_TEST_CHECKPOINT("CompiledBackConverter for container of containers with slice");
+        BOOST_CHECK( cc_back.equals(cc_compiled) );
+        BOOST_CHECK( cc_compiled.dbl_vv[1].a == dbl_vec[1] );
+    }
+    {
+        VectorToc toc = VectorTocMaker().apply(*registry.get("/std/string"));
+
+        std::string str = "Hello world!";
+        std::vector<double> dbl_vec(str.begin(), str.end());
+        std::string str2 = "____________";
+
+        CompiledBackConverter cbctv(toc, registry);
+        cbctv.setSlice("[0,6-10]");
+        cbctv.apply(dbl_vec, &str2);
+        BOOST_TEST_CHECKPOINT("CompiledBackConverter for string with slice");
+        BOOST_CHECK( str2 == "H_____ello _" );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_compiled_backconvert_with_shape )
+{
+    Registry registry;
+    import_types(registry);
+    VectorToc toc = VectorTocMaker().apply(*registry.get("/ContainerContainer"));
+
+    ContainerContainer cc;
+    DoubleVector dv;
+    dv.a = 10;
+    cc.dbl_vv.push_back(dv);
+    dv.a = -23;
+    dv.dbl_vector.push_back(23.0);
+    dv.dbl_vector.push_back(-142.2);
+    cc.dbl_vv.push_back(dv);
+    dv.a = 7;
+    dv.dbl_vector.pop_back();
+    cc.dbl_vv.push_back(dv);
+
+    CompiledConverter ctv(toc, registry);
+    std::vector<double> dbl_vec = ctv.apply(&cc);
+    std::vector<unsigned int> shape;
+    ctv.getProgram().getShape(&cc, shape);
+
+    CompiledBackConverter cbctv(toc, registry);
+
+    {
+        ContainerContainer cc_test;
+        cbctv.apply(dbl_vec, shape, &cc_test);
+        BOOST_TEST_CHECKPOINT("CompiledBackConverter resizes empty containers");
+        BOOST_REQUIRE( cc_test.dbl_vv.size() == 3 );
+        BOOST_CHECK( cc_test.equals(cc) );
+        for (int i = 0; i < 3; i++) BOOST_CHECK( cc_test.dbl_vv[i].a == cc.dbl_vv[i].a );
+    }
+    {
+        ContainerContainer cc_test;
+        cc_test.dbl_vv.resize(3);
+        cc_test.dbl_vv[0].dbl_vector.resize(5, 1.0);
+        cc_test.dbl_vv[1].dbl_vector.reserve(10);
+        BOOST_CHECK( cbctv.apply(&dbl_vec[0], dbl_vec.size(), shape, &cc_test) == 
+                int(dbl_vec.size()) );
+        BOOST_TEST_CHECKPOINT("CompiledBackConverter resizes filled containers");
+        BOOST_CHECK( cc_test.equals(cc) );
+        BOOST_CHECK( cc_test.dbl_vv[0].dbl_vector.empty() );
+        BOOST_CHECK( cc_test.dbl_vv[1].dbl_vector.capacity() == 10 );
+    }
+    {
+        ContainerContainer cc_test;
+        std::vector<unsigned int> short_shape(1, 3);
+        BOOST_CHECK_THROW( cbctv.apply(dbl_vec, short_shape, &cc_test), 
+                std::runtime_error );
+    }
+    {
+        VectorToc toc = VectorTocMaker().apply(*registry.get("/std/string"));
+        std::string str = "Hello world!";
+        std::vector<double> dbl_vec(str.begin(), str.end());
+
+        std::string str2 = "abc";
+        CompiledBackConverter cbctv(toc, registry);
+        cbctv.apply(dbl_vec, std::vector<unsigned int>(1, str.size()), &str2);
+        BOOST_TEST_CHECKPOINT("CompiledBackConverter resizes a string");
+        BOOST_CHECK( str2 == str );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_backconvert_batch )
+{
+    Registry registry;
+    import_types(registry);
+    VectorToc toc = VectorTocMaker().apply(*registry.get("/TwoArrays"));
+
+    Eigen::MatrixXd vectors(8, 5);
+    for (int j = 0; j < 5; j++)
+        for (int i = 0; i < 8; i++) vectors(i,j) = 10*j + i;
+
+    TwoArrays compiled[5], visited[5];
+    std::vector<void*> targets;
+    for (int j = 0; j < 5; j++) targets.push_back(&compiled[j]);
+
+    CompiledBackConverter cbctv(toc, registry);
+    cbctv.applyBatch(vectors, &targets[0]);
+
+    BackConverter bctv(toc, registry);
+    bctv.applyBatch(vectors, visited, sizeof(TwoArrays));
+
+    BOOST_TEST_CHECKPOINT("batch back conversion into an array");
+    for (int j = 0; j < 5; j++) {
+        BOOST_CHECK( compiled[j].a[0] == 10*j && compiled[j].b[4] == 10*j + 7 );
+        BOOST_CHECK( compiled[j].equals(visited[j]) );
+    }
+
+    TwoArrays partial[5] = {};
+    cbctv.applyBatch(vectors.data(), 4, 2, &targets[0]);
+    cbctv.applyBatch(vectors.topRows(4), partial, sizeof(TwoArrays));
+    BOOST_CHECK( partial[3].b[0] == 33 && partial[3].b[1] == 0 );
+
+    TwoArrays middle[2] = {};
+    cbctv.applyBatch(vectors.block(2, 3, 6, 2), middle, sizeof(TwoArrays));
+    BOOST_CHECK( middle[0].a[0] == 32 && middle[1].b[2] == 47 );
+
+    Eigen::Matrix<double, 8, 5, Eigen::RowMajor> row_major = vectors;
+    BOOST_CHECK_THROW( cbctv.applyBatch(row_major, middle, sizeof(TwoArrays)), 
+            std::runtime_error );
+
+    BOOST_TEST_CHECKPOINT("batch back conversion from row vectors");
+    VectorToc dtoc = VectorTocMaker().apply(*registry.get("/double"));
+    CompiledBackConverter cdbctv(dtoc, registry);
+    double values[5] = {};
+
+    Eigen::RowVectorXd row = vectors.row(3);
+    cdbctv.applyBatch(row, values, sizeof(double));
+    BOOST_CHECK( values[0] == 3 && values[4] == 43 );
+
+    cdbctv.applyBatch(vectors.row(5), values, sizeof(double));
+    BOOST_CHECK( values[1] == 15 && values[4] == 45 );
+
+    cdbctv.applyBatch(row_major.row(6).tail(2), values, sizeof(double));
+    BOOST_CHECK( values[0] == 36 && values[1] == 46 && values[2] == 25 );
+
+    BOOST_TEST_CHECKPOINT("fromEigen of floats and blocks");
+    TwoArrays from_eigen;
+    Eigen::VectorXf floats = vectors.col(2).cast<float>();
+    cbctv.fromEigen(floats, &from_eigen);
+    BOOST_CHECK( from_eigen.a[0] == 20 && from_eigen.b[4] == 27 );
+    Eigen::VectorXd doubles = vectors.col(4);
+    cbctv.fromEigen(doubles, &from_eigen);
+    BOOST_CHECK( from_eigen.a[0] == 40 && from_eigen.b[4] == 47 );
+
+    TwoArrays from_row_major;
+    Eigen::Matrix<double, 2, 4, Eigen::RowMajor> doubles_2x4 = 
+        Eigen::Map<Eigen::MatrixXd>(vectors.col(1).data(), 2, 4);
+    cbctv.fromEigen(doubles_2x4, &from_row_major);
+    cbctv.fromEigen(Eigen::MatrixXd(doubles_2x4), &from_eigen);
+    BOOST_CHECK( from_row_major.a[1] == 11 && from_row_major.b[4] == 17 );
+    BOOST_CHECK( from_row_major.equals(from_eigen) );
+
+    VectorToc vtoc = VectorTocMaker().apply(*registry.get("/DoubleVector"));
+    DoubleVector dvs[2];
+    dvs[0].dbl_vector.resize(1);
+    dvs[1].dbl_vector.resize(2);
+
+    CompiledBackConverter cvbctv(vtoc, registry);
+    cvbctv.applyBatch(vectors.topLeftCorner(3,2), dvs, sizeof(DoubleVector));
+    BOOST_TEST_CHECKPOINT("batch back conversion with containers");
+    BOOST_CHECK( dvs[0].a == 0 && dvs[0].dbl_vector[0] == 1 );
+    BOOST_CHECK( dvs[1].a == 10 && dvs[1].dbl_vector[1] == 12 );
+}
+
+BOOST_AUTO_TEST_CASE( test_compiled_backconvert_policies )
+{
+    Registry registry;
+    import_types(registry);
+    VectorToc toc = VectorTocMaker().apply(*registry.get("/A"));
+
+    std::vector<double> dbl_vec;
+    dbl_vec.push_back(1e30);
+    dbl_vec.push_back(-3e9);
+    dbl_vec.push_back(126.6);
+    dbl_vec.push_back(-7.5);
+
+    CompiledBackConverter cbctv(toc, registry);
+    BOOST_CHECK( cbctv.getBackCastPolicy() == BackCastTruncate );
+
+    struct A a;
+    cbctv.setBackCastPolicy(BackCastSaturate);
+    cbctv.apply(dbl_vec, &a);
+    BOOST_TEST_CHECKPOINT("saturating back cast");
+    BOOST_CHECK( a.a == std::numeric_limits<long long>::max() - 1023 );
+    BOOST_CHECK( a.b == std::numeric_limits<int>::min() );
+    BOOST_CHECK( a.c == 126 && a.d == -7 );
+
+    cbctv.setBackCastPolicy(BackCastRound);
+    cbctv.apply(dbl_vec, &a);
+    BOOST_TEST_CHECKPOINT("rounding back cast");
+    BOOST_CHECK( a.c == 127 && a.d == -8 );
+    BOOST_CHECK( cbctv.getErrorCount() == 0 );
+
+    dbl_vec[2] = 127.4;
+    dbl_vec[3] = std::numeric_limits<double>::quiet_NaN();
+    cbctv.setBackCastPolicy(BackCastChecked);
+    cbctv.apply(dbl_vec, &a);
+    BOOST_TEST_CHECKPOINT("checked back cast");
+    BOOST_CHECK( a.c == 127 && a.d == std::numeric_limits<short>::min() );
+    BOOST_CHECK( cbctv.getErrorCount() == 3 );
+
+    Eigen::MatrixXd vectors = Eigen::MatrixXd::Constant(4, 3, 1e6);
+    struct A as[3];
+    cbctv.resetErrorCount();
+    cbctv.applyBatch(vectors, as, sizeof(A));
+    BOOST_CHECK( cbctv.getErrorCount() == 6 );
+    BOOST_CHECK( as[2].a == 1000000 && as[2].c == 127 && as[2].d == 32767 );
+}
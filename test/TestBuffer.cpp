@@ -1,6 +1,10 @@
 // \file  TestBuffer.cpp
 
+#include <algorithm>
+
 #include <boost/test/auto_unit_test.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "MatrixBuffer.hpp"
 
@@ -70,3 +74,197 @@ BOOST_AUTO_TEST_CASE( test_matrix_buffer ) {
     BOOST_CHECK_THROW ( bm.getMatrix(6,13,m1), std::runtime_error);
     
 }
+
+BOOST_AUTO_TEST_CASE( test_matrix_buffer_view ) {
+
+    MatrixBuffer bm(3,8);
+    MatrixXd m1, m2;
+
+    for ( int i=0; i<20; i++ ) {
+
+        bm.push(VectorXd::Random(3));
+
+        for ( int from=0; from<8; from++ ) 
+            for ( int to=from; to<8; to++ ) {
+
+                MatrixBufferView view = bm.getView(from,to);
+                bm.getMatrix(from,to,m1);
+                view.copyTo(m2);
+
+                BOOST_CHECK ( m1 == m2 );
+                BOOST_CHECK ( view.cols() == to-from+1 && view.rows() == 3 );
+                BOOST_CHECK ( view.col(view.cols()-1) == m1.col(m1.cols()-1) );
+                BOOST_CHECK ( view(2,0) == m1(2,0) );
+            }
+    }
+
+    bm.reset();
+    BOOST_CHECK ( bm.getView(0,-1).isContiguous() );
+    bm.push(VectorXd::Ones(3));
+    BOOST_CHECK ( !bm.getView(0,-1).isContiguous() );
+    BOOST_CHECK_THROW ( bm.getView(6,3), std::runtime_error );
+}
+
+BOOST_AUTO_TEST_CASE( test_mirrored_matrix_buffer ) {
+
+    MirroredMatrixBuffer mb(3,10);
+    MatrixBuffer bm(3,10);
+    MatrixXd m1, m2;
+
+    BOOST_CHECK ( mb.getCapacity() >= 10 );
+    BOOST_CHECK ( mb.getWindow(0,-1) == MatrixXd::Zero(3,10) );
+
+    for ( int i=0; i<2*mb.getCapacity()+5; i++ ) {
+
+        VectorXd v = VectorXd::Random(3);
+        mb.push(v);
+        bm.push(v);
+
+        for ( int from=0; from<10; from+=3 ) {
+            BOOST_CHECK ( mb.getWindow(from,-1) == bm.getMatrix(from,-1) );
+            BOOST_CHECK ( mb.getView(0,from).isContiguous() );
+        }
+    }
+
+    mb.getMatrix(2,7,m1);
+    bm.getMatrix(2,7,m2);
+    BOOST_CHECK ( m1 == m2 );
+
+    BOOST_CHECK_THROW ( mb.push(VectorXd::Ones(4)), std::runtime_error );
+    BOOST_CHECK_THROW ( mb.getWindow(6,3), std::runtime_error );
+
+    mb.reset();
+    BOOST_CHECK ( mb.getWindow(0,-1) == MatrixXd::Zero(3,10) );
+}
+
+namespace {
+
+void pushCounted (ConcurrentMatrixBuffer* buffer, int count) {
+    for ( int i=1; i<=count; i++ )
+        buffer->push(VectorXd::Constant(buffer->getVectorSize(), i));
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( test_concurrent_matrix_buffer ) {
+
+    ConcurrentMatrixBuffer cb(4,10,2);
+    MatrixBuffer bm(4,10);
+
+    MatrixXd m1, m2;
+
+    cb.getMatrix(0,-1,m1);
+    BOOST_CHECK ( m1 == MatrixXd::Zero(4,10) );
+
+    for ( int i=0; i<25; i++ ) {
+        VectorXd v = VectorXd::Random(4);
+        cb.push(v);
+        bm.push(v);
+        cb.getMatrix(0,-1,m1);
+        bm.getMatrix(0,-1,m2);
+        BOOST_CHECK ( m1 == m2 );
+        cb.getMatrix(3,-2,m1);
+        bm.getMatrix(3,-2,m2);
+        BOOST_CHECK ( m1 == m2 );
+    }
+
+    BOOST_CHECK ( cb.getPushCount() == 25 && cb.getWriteCount() == 25 );
+    BOOST_CHECK_THROW ( cb.push(VectorXd::Ones(5)), std::runtime_error );
+    BOOST_CHECK_THROW ( cb.getMatrix(6,3,m1), std::runtime_error );
+
+    cb.reset();
+    cb.getMatrix(0,-1,m1);
+    BOOST_CHECK ( m1 == MatrixXd::Zero(4,10) && cb.getWriteCount() == 0 );
+
+    // a reader has to see consecutive and complete vectors while pushing goes on
+    const int count = 200000;
+    boost::thread producer(boost::bind(&pushCounted, &cb, count));
+
+    bool consistent = true;
+    double last = 0;
+
+    while ( last < count ) {
+
+        cb.getMatrix(0,-1,m1);
+
+        // the reader sees at least the pushes it copied
+        if ( cb.getPushCount() < m1(0,0) ) consistent = false;
+        if ( m1(0,9) > 0 && !cb.isFilled() ) consistent = false;
+
+        for ( int j=0; j<m1.cols(); j++ ) {
+            double expected = std::max(m1(0,0) - j, 0.0);
+            if ( (m1.col(j).array() != expected).any() ) consistent = false;
+        }
+
+        if ( m1(0,0) < last ) consistent = false;
+        last = m1(0,0);
+    }
+
+    producer.join();
+
+    BOOST_CHECK ( consistent );
+    BOOST_CHECK ( cb.getWriteCount() == (unsigned long)count );
+    BOOST_CHECK ( cb.getPushCount() == count );
+}
+
+BOOST_AUTO_TEST_CASE( test_concurrent_matrix_buffer_short ) {
+
+    // windows reach beyond the first pushes, and without slack the pushes
+    // during a read overwrite the copied columns soon
+    ConcurrentMatrixBuffer cb(64,20,0);
+    MatrixXd m;
+    bool consistent = true;
+
+    for ( int round=0; round<200; round++ ) {
+
+        cb.reset();
+        boost::thread producer(boost::bind(&pushCounted, &cb, 100));
+
+        while ( cb.getWriteCount() < 100 ) {
+
+            cb.getMatrix(0,-1,m);
+
+            for ( int j=0; j<m.cols(); j++ ) {
+                double expected = std::max(m(0,0) - j, 0.0);
+                if ( (m.col(j).array() != expected).any() ) consistent = false;
+            }
+        }
+
+        producer.join();
+    }
+
+    BOOST_CHECK ( consistent );
+}
+
+BOOST_AUTO_TEST_CASE( test_float_matrix_buffer ) {
+
+    FloatMatrixBuffer fb(4,10);
+    MatrixBuffer bm(4,10);
+    MatrixXd m1, m2;
+
+    for ( int i=0; i<25; i++ ) {
+        VectorXd v = VectorXd::Random(4).cast<float>().cast<double>();
+        if ( i % 2 ) fb.push(v);
+        else {
+            VectorXf vf = v.cast<float>();
+            fb.pushFloat(vf);
+        }
+        bm.push(v);
+        fb.getMatrix(2,-1,m1);
+        bm.getMatrix(2,-1,m2);
+        BOOST_CHECK ( m1 == m2 );
+        BOOST_CHECK ( fb.getFloatMatrix(0,-3) == bm.getMatrix(0,-3).cast<float>() );
+
+        FloatMatrixBufferView view = fb.getFloatView(1,8);
+        MatrixXf copied;
+        view.copyTo(copied);
+        BOOST_CHECK ( copied == bm.getMatrix(1,8).cast<float>() );
+        BOOST_CHECK ( view(3,7) == float(bm.getMatrix(1,8)(3,7)) );
+    }
+
+    BOOST_CHECK ( fb.getPushCount() == 25 && fb.isFilled() );
+    BOOST_CHECK_THROW ( fb.push(VectorXd::Ones(5)), std::runtime_error );
+
+    fb.reset();
+    BOOST_CHECK ( fb.getFloatMatrix(0,-1) == MatrixXf::Zero(4,10) );
+}
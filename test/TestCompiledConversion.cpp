@@ -0,0 +1,793 @@
+// \file  TestCompiledConversion.cpp
+
+#include <cstdlib>
+#include <new>
+
+#include <boost/atomic.hpp>
+#include <boost/test/auto_unit_test.hpp>
+
+#include <typelib/typemodel.hh>
+#include <typelib/registry.hh>
+
+#include "TestSuite.hpp"
+
+#include "Converter.hpp"
+#include "CompiledConverter.hpp"
+#include "ConversionKernels.hpp"
+#include "SliceMatcher.hpp"
+#include "VectorTocMaker.hpp"
+
+#include "TestTypes.h"
+
+using namespace Typelib;
+using namespace type_to_vector;
+
+namespace {
+    /** The number of heap allocations of the test program so far. */
+    boost::atomic<long> allocations(0);
+}
+
+void* operator new (std::size_t size) {
+
+    allocations++;
+
+    void* ptr = std::malloc(size ? size : 1);
+    if ( !ptr ) throw std::bad_alloc();
+
+    return ptr;
+}
+
+void operator delete (void* ptr) throw() { std::free(ptr); }
+
+/** Checks that the compiled converter gives the same results as ConvertToVector. */
+void checkSameAsConvertToVector(const Registry& registry, const Type& t, void* data,
+        const std::string& slice="") {
+
+    VectorToc toc = VectorTocMaker().apply(t);
+    if ( slice != "" ) toc = VectorTocSlicer::slice(toc, slice);
+
+    ConvertToVector ctv(toc, registry);
+    CompiledConverter cc(toc, registry);
+
+    VectorOfDoubles expected = ctv.apply(data, true);
+    VectorOfDoubles res = cc.apply(data, true);
+
+    BOOST_REQUIRE( res.size() == expected.size() );
+    BOOST_CHECK( res == expected );
+    BOOST_CHECK( cc.getPlaceVector() == ctv.getPlaceVector() );
+
+    cc.apply(data, false);
+    BOOST_CHECK( cc.getPlaceVector().empty() );
+}
+
+/** Checks that converters with a slice give the values whose places fit the slice. */
+void checkSliceMask(const Registry& registry, const Type& t, void* data,
+        const std::string& slice) {
+
+    VectorToc toc = VectorTocMaker().apply(t);
+
+    ConvertToVector all(toc, registry);
+    VectorOfDoubles all_values = all.apply(data, true);
+    StringVector all_places = all.getPlaceVector();
+
+    SliceMatcher matcher(slice);
+    VectorOfDoubles expected;
+    StringVector expected_places;
+
+    for ( unsigned int i=0; i<all_values.size(); i++ )
+        if ( matcher.fitsASlice(all_places[i]) ) {
+            expected.push_back(all_values[i]);
+            expected_places.push_back(all_places[i]);
+        }
+
+    ConvertToVector ctv(toc, registry);
+    ctv.setSlice(slice);
+    CompiledConverter cc(toc, registry);
+    cc.setSlice(slice);
+
+    BOOST_CHECK( ctv.apply(data, true) == expected );
+    BOOST_CHECK( ctv.getPlaceVector() == expected_places );
+    BOOST_CHECK( cc.apply(data, true) == expected );
+    BOOST_CHECK( cc.getPlaceVector() == expected_places );
+    BOOST_CHECK( cc.getOutputSize(data) == int(expected.size()) );
+}
+
+BOOST_AUTO_TEST_CASE( test_compiled_scalar )
+{
+    Registry registry;
+    import_types(registry);
+
+    double f = 1.4;
+    checkSameAsConvertToVector(registry, *registry.get("/double"), &f);
+
+    int i = -3;
+    checkSameAsConvertToVector(registry, *registry.get("/int"), &i);
+
+    char c = 3;
+    checkSameAsConvertToVector(registry, *registry.get("/char"), &c);
+}
+
+BOOST_AUTO_TEST_CASE( test_compiled_struct )
+{
+    Registry registry;
+    import_types(registry);
+
+    B b = { 'x', { -1234567, 12, 'c', -4 } };
+    checkSameAsConvertToVector(registry, *registry.get("/B"), &b);
+    checkSameAsConvertToVector(registry, *registry.get("/B"), &b, "b.b b.d");
+
+    TwoArrays ta = { { 1, 2, 3 }, { 4, 5, 6, 7, 8 } };
+    checkSameAsConvertToVector(registry, *registry.get("/TwoArrays"), &ta);
+
+    VectorToc toc = VectorTocMaker().apply(*registry.get("/B"));
+    CompiledConverter cc(toc, registry);
+
+    BOOST_CHECK( cc.getProgram().isFlat() );
+    BOOST_REQUIRE( cc.getProgram().size() == 1 );
+    BOOST_CHECK( cc.getProgram().front().size == 5 );
+    BOOST_CHECK( cc.getProgram().front().runs.size() == 4 );
+}
+
+BOOST_AUTO_TEST_CASE( test_compiled_container )
+{
+    Registry registry;
+    import_types(registry);
+
+    std::vector<int> int_vec;
+    checkSameAsConvertToVector(registry, *registry.get("/std/vector</int>"), &int_vec);
+
+    int_vec.push_back(-10);
+    int_vec.push_back(22);
+    checkSameAsConvertToVector(registry, *registry.get("/std/vector</int>"), &int_vec);
+
+    std::string str = "Hello world!";
+    checkSameAsConvertToVector(registry, *registry.get("/std/string"), &str);
+
+    ForFlatSliceTest ffst;
+    ffst.a = 2.5;
+    ffst.vec.push_back(3.5);
+    ffst.str = "abc";
+    ffst.b = 12;
+    checkSameAsConvertToVector(registry, *registry.get("/ForFlatSliceTest"), &ffst);
+    checkSameAsConvertToVector(registry, *registry.get("/ForFlatSliceTest"), &ffst,
+            "b vec");
+
+    VectorToc toc = VectorTocMaker().apply(*registry.get("/ForFlatSliceTest"));
+    CompiledConverter cc(toc, registry);
+
+    BOOST_CHECK( !cc.getProgram().isFlat() );
+    BOOST_CHECK( cc.getProgram().size() == 3 );
+    BOOST_CHECK( cc.getProgram().getOutputSize(&ffst) == 6 );
+}
+
+BOOST_AUTO_TEST_CASE( test_compiled_advanced )
+{
+    Registry registry;
+    import_types(registry);
+
+    {
+        VectorArray va;
+        va.dbl_vector_array[0].push_back(12.0);
+        va.dbl_vector_array[2].push_back(-123456.789);
+        va.dbl_vector_array[2].push_back(1.4);
+        checkSameAsConvertToVector(registry, *registry.get("/VectorArray"), &va);
+    }
+
+    {
+        StructArray sa;
+        struct A a = { 10, -23, 51, 112 };
+        struct A b = { -12452134, 12, 33, -1 };
+        sa.A_vector.push_back(a);
+        sa.A_vector.push_back(b);
+        checkSameAsConvertToVector(registry, *registry.get("/StructArray"), &sa);
+        checkSameAsConvertToVector(registry, *registry.get("/StructArray"), &sa,
+                "A_vector.*.b");
+    }
+
+    {
+        ContainerContainer cc;
+        DoubleVector dv;
+        dv.a = 10;
+        dv.dbl_vector.push_back(12.2);
+        cc.dbl_vv.push_back(dv);
+        dv.a = -23;
+        dv.dbl_vector.push_back(23.0);
+        dv.dbl_vector.push_back(-142.2);
+        cc.dbl_vv.push_back(dv);
+        dv.a = 0;
+        dv.dbl_vector.clear();
+        cc.dbl_vv.push_back(dv);
+        checkSameAsConvertToVector(registry, *registry.get("/ContainerContainer"), &cc);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_slice_mask )
+{
+    Registry registry;
+    import_types(registry);
+
+    ContainerContainer cc;
+    DoubleVector dv;
+    dv.a = 10;
+    dv.dbl_vector.push_back(12.2);
+    cc.dbl_vv.push_back(dv);
+    dv.a = -23;
+    dv.dbl_vector.push_back(23.0);
+    dv.dbl_vector.push_back(-142.2);
+    cc.dbl_vv.push_back(dv);
+    dv.a = 0;
+    dv.dbl_vector.push_back(7.5);
+    cc.dbl_vv.push_back(dv);
+
+    const Type& t = *registry.get("/ContainerContainer");
+
+    checkSliceMask(registry, t, &cc, "dbl_vv.*.a dbl_vv.[0,2].dbl_vector.1");
+    checkSliceMask(registry, t, &cc, "dbl_vv.[1-2].dbl_vector.[0,2]");
+    checkSliceMask(registry, t, &cc, "dbl_vv.1");
+    checkSliceMask(registry, t, &cc, "! dbl_vv.1.a dbl_vv.*.dbl_vector.0");
+    checkSliceMask(registry, t, &cc, "!");
+    checkSliceMask(registry, t, &cc, "nothing");
+
+    DocB doc;
+    doc.idx = 3;
+    for ( int i=0; i<5; i++ ) {
+        doc.data[i].a[0] = i; doc.data[i].a[1] = 2*i; doc.data[i].a[2] = 3*i;
+        doc.data[i].b = -i;
+        doc.data[i].c = 'a'+i;
+    }
+
+    checkSliceMask(registry, *registry.get("/DocB"), &doc, "idx data.[0,2].b data.*.c");
+    checkSliceMask(registry, *registry.get("/DocB"), &doc, "! data.[1-4:2]");
+
+    BOOST_TEST_CHECKPOINT("slices that start other slices");
+    checkSliceMask(registry, t, &cc, "dbl_vv.1 dbl_vv.1.a");
+    checkSliceMask(registry, t, &cc, "dbl_vv.*.dbl_vector dbl_vv.*.dbl_vector.0");
+    checkSliceMask(registry, t, &cc, "! dbl_vv.2 dbl_vv.2.a");
+    checkSliceMask(registry, *registry.get("/DocB"), &doc, "data.[0,2] data.*.b");
+
+    VectorToc doc_toc = VectorTocMaker().apply(*registry.get("/DocB"));
+    SliceMaskPointer overlap = SliceMask::create(doc_toc, "idx data data.[0,2].b");
+
+    BOOST_REQUIRE( overlap.get() && !overlap->empty() );
+    for ( SliceMask::const_iterator it = overlap->begin(); it != overlap->end(); it++ )
+        BOOST_CHECK( it->state == SliceMaskEntry::Take );
+
+    VectorToc toc = VectorTocMaker().apply(t);
+    SliceMaskPointer mask = SliceMask::create(toc, "dbl_vv.*.a dbl_vv.[0,2].dbl_vector.1");
+
+    BOOST_REQUIRE( mask.get() && mask->size() == 1 );
+    BOOST_CHECK( mask->getDepth() == 2 );
+
+    const SliceMaskEntry& vv = mask->front();
+    BOOST_CHECK( vv.state == SliceMaskEntry::Take );
+    BOOST_CHECK( vv.allElements );
+    BOOST_REQUIRE( vv.content.get() && vv.content->size() == 2 );
+    BOOST_CHECK( (*vv.content)[0].state == SliceMaskEntry::Take );
+
+    const SliceMaskEntry& dbl_vector = (*vv.content)[1];
+    BOOST_CHECK( !dbl_vector.allElements );
+    BOOST_CHECK( !dbl_vector.needsElement(0) && dbl_vector.needsElement(1) );
+    BOOST_REQUIRE( dbl_vector.content.get() && dbl_vector.content->size() == 1 );
+    BOOST_CHECK( dbl_vector.content->front().state == SliceMaskEntry::Check );
+
+    int indices[] = { 1, 1 };
+    BOOST_CHECK( !dbl_vector.content->front().fits(indices) );
+    indices[0] = 2;
+    BOOST_CHECK( dbl_vector.content->front().fits(indices) );
+
+    BOOST_CHECK( !SliceMask::create(toc, "") );
+}
+
+BOOST_AUTO_TEST_CASE( test_apply_into )
+{
+    Registry registry;
+    import_types(registry);
+
+    B b = { 'x', { -1234567, 12, 'c', -4 } };
+    double ref[] = { 'x', -1234567, 12, 'c', -4 };
+
+    VectorToc toc = VectorTocMaker().apply(*registry.get("/B"));
+
+    AbstractConverter::Pointer converters[] = {
+        AbstractConverter::Pointer(new FlatConverter(toc)),
+        AbstractConverter::Pointer(new ConvertToVector(toc, registry)),
+        AbstractConverter::Pointer(new CompiledConverter(toc, registry)) };
+
+    for ( int i=0; i<3; i++ ) {
+
+        BOOST_CHECK( converters[i]->getOutputSize() == 5 );
+        BOOST_CHECK( converters[i]->getOutputSize(&b) == 5 );
+
+        double out[5];
+        BOOST_CHECK( converters[i]->applyInto(&b, out, 5) == 5 );
+        BOOST_CHECK( VectorOfDoubles(out, out+5) == VectorOfDoubles(ref, ref+5) );
+
+        Eigen::VectorXd x = Eigen::VectorXd::Zero(5);
+        converters[i]->applyInto(&b, Eigen::Map<Eigen::VectorXd>(x.data(), x.size()));
+        BOOST_CHECK( x == Eigen::Map<Eigen::VectorXd>(ref, 5) );
+
+        BOOST_CHECK_THROW( converters[i]->applyInto(&b, out, 4), std::runtime_error );
+    }
+
+    MultiplyConverter mc(converters[2], 2.0);
+    double out[5];
+    BOOST_CHECK( mc.applyInto(&b, out, 5) == 5 );
+    BOOST_CHECK( out[1] == 2.0 * ref[1] );
+
+    VectorToc toc_b = toc;
+    toc_b.resize(1);
+    SingleConverter sc(toc_b);
+    BOOST_CHECK( sc.getOutputSize() == 1 );
+    BOOST_CHECK( sc.applyInto(&b, out, 1) == 1 );
+    BOOST_CHECK( out[0] == ref[0] );
+}
+
+BOOST_AUTO_TEST_CASE( test_apply_into_container )
+{
+    Registry registry;
+    import_types(registry);
+
+    DoubleVector dv;
+    dv.a = 23;
+    dv.dbl_vector.push_back(-1.5);
+    dv.dbl_vector.push_back(1.4);
+
+    VectorToc toc = VectorTocMaker().apply(*registry.get("/DoubleVector"));
+
+    ConvertToVector ctv(toc, registry);
+    CompiledConverter cc(toc, registry);
+
+    BOOST_CHECK( ctv.getOutputSize() == -1 );
+    BOOST_CHECK( cc.getOutputSize() == -1 );
+    BOOST_REQUIRE( cc.getOutputSize(&dv) == 3 );
+    BOOST_CHECK( ctv.getOutputSize(&dv) == 3 );
+
+    double out[3];
+    BOOST_CHECK( cc.applyInto(&dv, out, 3) == 3 );
+    BOOST_CHECK( VectorOfDoubles(out, out+3) == ctv.apply(&dv) );
+    BOOST_CHECK_THROW( cc.applyInto(&dv, out, 2), std::runtime_error );
+
+    BOOST_TEST_CHECKPOINT("default applyInto keeps the result of apply");
+    ctv.apply(&dv, true);
+    Eigen::VectorXd result = ctv.getEigenVector();
+    StringVector places = ctv.getPlaceVector();
+    unsigned int version = ctv.getPlaceVectorVersion();
+
+    DoubleVector longer = dv;
+    longer.dbl_vector.push_back(8);
+    BOOST_CHECK( ctv.getOutputSize(&longer) == 4 );
+    BOOST_CHECK_THROW( ctv.applyInto(&longer, out, 3), std::runtime_error );
+    double out4[4];
+    BOOST_CHECK( ctv.applyInto(&longer, out4, 4) == 4 && out4[3] == 8 );
+
+    BOOST_CHECK( ctv.getEigenVector() == result );
+    BOOST_CHECK( ctv.getPlaceVector() == places );
+    BOOST_CHECK( ctv.getPlaceVectorVersion() == version );
+}
+
+BOOST_AUTO_TEST_CASE( test_apply_into_allocations )
+{
+    Registry registry;
+    import_types(registry);
+
+    B b = { 'x', { -1234567, 12, 'c', -4 } };
+
+    DoubleVector dv;
+    dv.a = 23;
+    dv.dbl_vector.push_back(-1.5);
+    dv.dbl_vector.push_back(1.4);
+
+    VectorToc toc_b = VectorTocMaker().apply(*registry.get("/B"));
+    VectorToc toc_dv = VectorTocMaker().apply(*registry.get("/DoubleVector"));
+
+    FlatConverter fc(toc_b);
+    ConvertToVector ctv_b(toc_b, registry);
+    ConvertToVector ctv_dv(toc_dv, registry);
+    ctv_dv.apply(&dv, true);
+
+    double out[5];
+    float out_f[5];
+
+    AbstractConverter* converters[] = { &fc, &ctv_b, &ctv_dv };
+    void* data[] = { &b, &b, &dv };
+    int sizes[] = { 5, 5, 3 };
+
+    // the first conversions give the stacks of the visitors their capacity
+    for ( int i=0; i<3; i++ ) {
+        converters[i]->applyInto(data[i], out, 5);
+        converters[i]->applyInto(data[i], out_f, 5);
+        converters[i]->getOutputSize(data[i]);
+    }
+
+    long before = allocations;
+
+    for ( int i=0; i<3; i++ ) {
+        BOOST_CHECK( converters[i]->applyInto(data[i], out, 5) == sizes[i] );
+        BOOST_CHECK( converters[i]->applyInto(data[i], out_f, 5) == sizes[i] );
+        converters[i]->getOutputSize(data[i]);
+    }
+
+    long after = allocations;
+
+    BOOST_CHECK( after == before );
+
+    // the result and places of apply are kept
+    BOOST_CHECK( Eigen::Map<Eigen::VectorXd>(out, 3) == ctv_dv.getEigenVector() );
+    BOOST_CHECK( ctv_dv.getPlaceVector().size() == 3 );
+}
+
+BOOST_AUTO_TEST_CASE( test_apply_batch )
+{
+    Registry registry;
+    import_types(registry);
+
+    A samples[3] = { { 10, -23, 51, 112 }, { -12452134, 12, 33, -1 }, { 1, 2, 3, 4 } };
+    void* sample_ptrs[3] = { &samples[0], &samples[1], &samples[2] };
+
+    VectorToc toc = VectorTocMaker().apply(*registry.get("/A"));
+
+    ConvertToVector ctv(toc, registry);
+    CompiledConverter cc(toc, registry);
+
+    Eigen::MatrixXd expected(4,3);
+    for ( int i=0; i<3; i++ ) {
+        ctv.apply(&samples[i]);
+        expected.col(i) = ctv.getEigenVector();
+    }
+
+    Eigen::MatrixXd res;
+
+    ctv.applyBatch(sample_ptrs, 3, res);
+    BOOST_CHECK( res == expected );
+
+    cc.applyBatch(sample_ptrs, 3, res);
+    BOOST_CHECK( res == expected );
+
+    res.setZero();
+    cc.applyBatch(&samples[0], sizeof(A), 3, res);
+    BOOST_CHECK( res == expected );
+
+    cc.applyBatch(sample_ptrs, 0, res);
+    BOOST_CHECK( res.rows() == 4 && res.cols() == 0 );
+
+    BOOST_TEST_CHECKPOINT("Batch with containers");
+
+    std::vector<int> vecs[2];
+    vecs[0].push_back(1);
+    vecs[0].push_back(2);
+    vecs[1].push_back(3);
+    vecs[1].push_back(4);
+
+    VectorToc vtoc = VectorTocMaker().apply(*registry.get("/std/vector</int>"));
+    CompiledConverter vcc(vtoc, registry);
+
+    vcc.applyBatch(&vecs[0], sizeof(std::vector<int>), 2, res);
+    BOOST_REQUIRE( res.rows() == 2 && res.cols() == 2 );
+    BOOST_CHECK( res(0,0) == 1 && res(1,0) == 2 && res(0,1) == 3 && res(1,1) == 4 );
+
+    vecs[1].push_back(5);
+    BOOST_CHECK_THROW( vcc.applyBatch(&vecs[0], sizeof(std::vector<int>), 2, res),
+            std::runtime_error );
+}
+
+BOOST_AUTO_TEST_CASE( test_compiled_strided_runs )
+{
+    Registry registry;
+    import_types(registry);
+
+    {
+        TwoArrays ta = { { 1, 2, 3 }, { 4, 5, 6, 7, 8 } };
+        checkSameAsConvertToVector(registry, *registry.get("/TwoArrays"), &ta);
+
+        VectorToc toc = VectorTocMaker().apply(*registry.get("/TwoArrays"));
+        CompiledConverter cc(toc, registry);
+
+        BOOST_REQUIRE( cc.getProgram().size() == 1 );
+        BOOST_CHECK( cc.getProgram().front().runs.empty() );
+        BOOST_REQUIRE( cc.getProgram().front().stridedRuns.size() == 1 );
+        BOOST_CHECK( cc.getProgram().front().stridedRuns.front().count == 8 );
+        BOOST_CHECK( cc.getProgram().front().stridedRuns.front().stride == sizeof(int) );
+    }
+
+    {
+        registry.build("/float[7]");
+        float f[7] = { 1.5, -2.5, 3.25, 4, 5, 6e10, -7 };
+        checkSameAsConvertToVector(registry, *registry.get("/float[7]"), f);
+
+        registry.build("/double[20]");
+        double d[20];
+        for ( int i=0; i<20; i++ ) d[i] = i*0.5 - 3;
+        checkSameAsConvertToVector(registry, *registry.get("/double[20]"), d);
+    }
+
+    {
+        DocB db;
+        db.idx = 3;
+        for ( int i=0; i<5; i++ ) {
+            db.data[i].a[0] = i;
+            db.data[i].a[1] = -i*1.5;
+            db.data[i].a[2] = i*i;
+            db.data[i].b = 10*i;
+            db.data[i].c = 'a'+i;
+        }
+
+        const Type& t = *registry.get("/DocB");
+        checkSameAsConvertToVector(registry, t, &db);
+        checkSameAsConvertToVector(registry, t, &db, "data.*.b");
+        checkSameAsConvertToVector(registry, t, &db, "data.*.a.1");
+        checkSameAsConvertToVector(registry, t, &db, "idx data.*.c");
+
+        VectorToc toc = VectorTocSlicer::slice(VectorTocMaker().apply(t), "data.*.b");
+        CompiledConverter cc(toc, registry);
+
+        BOOST_REQUIRE( cc.getProgram().front().stridedRuns.size() == 1 );
+        BOOST_CHECK( cc.getProgram().front().stridedRuns.front().stride == sizeof(DocA) );
+
+        DocB dbs[2] = { db, db };
+        dbs[1].data[2].b = -1;
+        Eigen::MatrixXd res;
+        cc.applyBatch(dbs, sizeof(DocB), 2, res);
+        BOOST_REQUIRE( res.rows() == 5 && res.cols() == 2 );
+        BOOST_CHECK( res(2,0) == 20 && res(2,1) == -1 );
+    }
+}
+
+namespace {
+
+/** Compares convertStrided with a plain loop for several strides and counts,
+ *  so the vector kernels are checked when the library is built with AVX2. */
+template <typename T>
+bool checkStridedKernel () {
+
+    const unsigned int MaxCount = 11, MaxElements = 4;
+    T values[MaxCount * MaxElements];
+
+    for ( unsigned int i=0; i<MaxCount*MaxElements; i++ ) 
+        values[i] = T(int(i*7) - 100) / T(2);
+
+    for ( unsigned int e=1; e<=MaxElements; e++ ) {
+
+        unsigned int stride = e * sizeof(T);
+
+        for ( unsigned int count=0; count<=MaxCount; count++ ) {
+
+            double out[MaxCount+1];
+            out[count] = 42;
+
+            convertStrided<T>(reinterpret_cast<const uint8_t*>(values), stride, count, out);
+
+            for ( unsigned int i=0; i<count; i++ )
+                if ( out[i] != double(values[i*e]) ) return false;
+
+            if ( out[count] != 42 ) return false;
+        }
+    }
+
+    return true;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE( test_strided_kernels )
+{
+    BOOST_CHECK( checkStridedKernel<float>() );
+    BOOST_CHECK( checkStridedKernel<double>() );
+    BOOST_CHECK( checkStridedKernel<int32_t>() );
+    BOOST_CHECK( checkStridedKernel<int16_t>() );
+}
+
+BOOST_AUTO_TEST_CASE( test_compiled_affine )
+{
+    Registry registry;
+    import_types(registry);
+
+    BOOST_TEST_CHECKPOINT("Scale and offset of all values");
+
+    {
+        DocB db;
+        db.idx = 3;
+        for ( int i=0; i<5; i++ ) {
+            db.data[i].a[0] = i;
+            db.data[i].a[1] = -i*1.5;
+            db.data[i].a[2] = i*i;
+            db.data[i].b = 10*i;
+            db.data[i].c = 'a'+i;
+        }
+
+        VectorToc toc = VectorTocMaker().apply(*registry.get("/DocB"));
+        CompiledConverter cc(toc, registry);
+
+        VectorOfDoubles plain = cc.apply(&db);
+        
+        cc.setAffine(0.5, -1.0);
+        VectorOfDoubles res = cc.apply(&db);
+        
+        BOOST_REQUIRE( res.size() == plain.size() );
+        bool ok = true;
+        for ( unsigned int i=0; i<res.size(); i++ ) 
+            if ( res[i] != plain[i]*0.5 - 1.0 ) ok = false;
+        BOOST_CHECK( ok );
+
+        cc.setSlice("data.*.b");
+        res = cc.apply(&db);
+        BOOST_REQUIRE( res.size() == 5 );
+        BOOST_CHECK( res[4] == 40*0.5 - 1.0 );
+
+        MultiplyConverter mc(AbstractConverter::Pointer(new CompiledConverter(toc, registry)), 
+                -2.0);
+        res = mc.apply(&db);
+        BOOST_REQUIRE( res.size() == plain.size() );
+        ok = true;
+        for ( unsigned int i=0; i<res.size(); i++ ) 
+            if ( res[i] != plain[i]*-2.0 ) ok = false;
+        BOOST_CHECK( ok );
+        BOOST_CHECK( mc.getPlaceVector().empty() );
+
+        res = mc.apply(&db, true);
+        BOOST_CHECK( res[1] == plain[1]*-2.0 );
+        BOOST_CHECK( mc.getPlaceVector().size() == plain.size() );
+    }
+
+    BOOST_TEST_CHECKPOINT("Containers");
+
+    {
+        std::vector<int> vec(3, 4);
+        VectorToc toc = VectorTocMaker().apply(*registry.get("/std/vector</int>"));
+        CompiledConverter cc(toc, registry);
+
+        cc.setAffine(2.0, 1.0);
+        VectorOfDoubles res = cc.apply(&vec);
+        BOOST_CHECK( res == VectorOfDoubles(3, 9.0) );
+
+        BOOST_CHECK_THROW( cc.setAffine(VectorOfDoubles(3, 1.0), VectorOfDoubles(3, 0.0)),
+                std::runtime_error );
+    }
+
+    BOOST_TEST_CHECKPOINT("Each value on its own");
+
+    {
+        TwoArrays ta[2] = { { { 1, 2, 3 }, { 4, 5, 6, 7, 8 } }, 
+            { { -1, -2, -3 }, { -4, -5, -6, -7, -8 } } };
+
+        VectorToc toc = VectorTocMaker().apply(*registry.get("/TwoArrays"));
+        CompiledConverter cc(toc, registry);
+
+        VectorOfDoubles scales, offsets;
+        for ( int i=0; i<8; i++ ) {
+            scales.push_back(i);
+            offsets.push_back(-i);
+        }
+
+        BOOST_CHECK_THROW( cc.setAffine(VectorOfDoubles(3, 1.0), VectorOfDoubles(3, 0.0)),
+                std::runtime_error );
+
+        cc.setAffine(scales, offsets);
+        VectorOfDoubles res = cc.apply(&ta[0]);
+
+        BOOST_REQUIRE( res.size() == 8 );
+        BOOST_CHECK( res[0] == 0 && res[1] == 1 && res[7] == 8*7-7 );
+
+        Eigen::MatrixXd batch;
+        cc.applyBatch(&ta[0], sizeof(TwoArrays), 2, batch);
+        BOOST_CHECK( batch(7,0) == 8*7-7 && batch(7,1) == -8*7-7 );
+
+        double factor;
+        ConversionProgramPointer program = cc.getFlatProgram(factor);
+        std::vector<ConversionProgramPointer> programs(2, program);
+        std::vector<double> factors(1, 1.0);
+        factors.push_back(3.0);
+
+        FusedProgramPointer fused = FusedProgram::fuse(programs, factors);
+        double out[2][8];
+        double* outs[2] = { out[0], out[1] };
+        fused->run(&ta[0], outs);
+
+        BOOST_CHECK( out[0][7] == res[7] );
+        BOOST_CHECK( out[1][7] == 3*res[7] );
+        BOOST_CHECK( out[1][2] == 3*res[2] );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_float_output )
+{
+    Registry registry;
+    import_types(registry);
+
+    DocB db;
+    db.idx = 3;
+    for ( int i=0; i<5; i++ ) {
+        db.data[i].a[0] = i;
+        db.data[i].a[1] = -i*1.5;
+        db.data[i].a[2] = i*i;
+        db.data[i].b = 10*i;
+        db.data[i].c = 'a'+i;
+    }
+
+    VectorToc toc = VectorTocMaker().apply(*registry.get("/DocB"));
+    CompiledConverter cc(toc, registry);
+    ConvertToVector ctv(toc, registry);
+
+    VectorOfDoubles plain = cc.apply(&db);
+    Eigen::VectorXd expected = Eigen::Map<Eigen::VectorXd>(&plain[0], plain.size());
+    Eigen::VectorXf res(expected.size());
+
+    BOOST_CHECK( cc.applyInto(&db, res.data(), res.size()) == res.size() );
+    BOOST_CHECK( res == expected.cast<float>() );
+
+    res.setZero();
+    BOOST_CHECK( ctv.applyInto(&db, Eigen::Map<Eigen::VectorXf>(res.data(), res.size())) 
+            == res.size() );
+    BOOST_CHECK( res == expected.cast<float>() );
+
+    Eigen::VectorXf last;
+    ctv.apply(&db);
+    BOOST_CHECK( ctv.getEigenVector(last) && last == expected.cast<float>() );
+
+    cc.setAffine(0.5, 1.0);
+    cc.applyInto(&db, res.data(), res.size());
+    Eigen::VectorXf scaled = ((expected*0.5).array() + 1.0).matrix().cast<float>();
+    BOOST_CHECK( res == scaled );
+    cc.setAffine(1.0);
+
+    BOOST_TEST_CHECKPOINT("Float output of a transformed strided run");
+    {
+        // above 2^24 an int has no exact float, it is narrowed after the transform
+        TwoArrays ta = { { 16777217, 16777219, -16777215 }, { 3, 33554431, 5, 6, 7 } };
+        VectorToc ta_toc = VectorTocMaker().apply(*registry.get("/TwoArrays"));
+        CompiledConverter tcc(ta_toc, registry);
+        BOOST_REQUIRE( tcc.getProgram().front().stridedRuns.size() == 1 );
+
+        tcc.setAffine(2.0, -33554432.0);
+
+        Eigen::VectorXd doubles(8);
+        Eigen::VectorXf floats(8);
+        tcc.applyInto(&ta, doubles.data(), 8);
+        tcc.applyInto(&ta, floats.data(), 8);
+
+        BOOST_CHECK( doubles[0] == 2 && doubles[1] == 6 );
+        BOOST_CHECK( floats == doubles.cast<float>() );
+    }
+
+    BOOST_TEST_CHECKPOINT("Float output of multiplied and normalized converters");
+
+    AbstractConverter::Pointer compiled(new CompiledConverter(toc, registry));
+    AbstractConverter::Pointer visiting(new ConvertToVector(toc, registry));
+    VectorOfDoubles offsets(expected.size(), 1.0), scales(expected.size(), 0.5);
+
+    for ( int k=0; k<2; k++ ) {
+
+        AbstractConverter::Pointer inner = k ? visiting : compiled;
+        MultiplyConverter mc(inner, 0.5);
+        NormalizeConverter nc(inner, offsets, scales);
+
+        BOOST_CHECK( mc.applyInto(&db, res.data(), res.size()) == res.size() );
+        BOOST_CHECK( res == (expected*0.5).cast<float>() );
+
+        BOOST_CHECK( nc.applyInto(&db, res.data(), res.size()) == res.size() );
+        BOOST_CHECK( res == ((expected.array() - 1.0) * 0.5).matrix().cast<float>() );
+    }
+
+    BOOST_TEST_CHECKPOINT("Float batches");
+
+    DocB dbs[2] = { db, db };
+    dbs[1].data[2].b = -1;
+    Eigen::MatrixXf batch;
+    cc.applyBatch(dbs, sizeof(DocB), 2, batch);
+    BOOST_REQUIRE( batch.rows() == expected.size() && batch.cols() == 2 );
+    BOOST_CHECK( batch.col(0) == expected.cast<float>() );
+
+    Eigen::MatrixXf visited;
+    ctv.applyBatch(dbs, sizeof(DocB), 2, visited);
+    BOOST_CHECK( visited == batch );
+
+    BOOST_TEST_CHECKPOINT("Float output with containers");
+
+    std::vector<double> doubles(5, 2.5);
+    doubles[3] = -1e-3;
+    VectorToc vtoc = VectorTocMaker().apply(*registry.get("/std/vector</double>"));
+    CompiledConverter vcc(vtoc, registry);
+    float out[5];
+    BOOST_CHECK( vcc.applyInto(&doubles, out, 5) == 5 );
+    BOOST_CHECK( out[0] == 2.5f && out[3] == float(-1e-3) );
+    BOOST_CHECK_THROW( vcc.applyInto(&doubles, out, 4), std::runtime_error );
+}
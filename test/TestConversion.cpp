@@ -10,6 +10,8 @@
 #include "TestSuite.hpp"
 
 #include "Converter.hpp"
+#include "CompiledConverter.hpp"
+#include "MatrixBuffer.hpp"
 #include "VectorTocMaker.hpp"
 #include "Utilities.hpp"
 
@@ -724,3 +726,114 @@ BOOST_AUTO_TEST_CASE( test_multiply_converter )
     BOOST_CHECK ( mc.getEigenVector(vec) );
     BOOST_CHECK ( (x-vec).norm() < 0.0001 );
 }
+
+BOOST_AUTO_TEST_CASE( test_place_vector_cache )
+{
+    Registry registry;
+    import_types(registry);
+    const Type& t = *registry.get("/ContainerContainer");
+    
+    ContainerContainer cc;
+    DoubleVector dv;
+    dv.a = 10;
+    dv.dbl_vector.push_back(12.2);
+    cc.dbl_vv.push_back(dv);
+    dv.dbl_vector.push_back(1.5);
+    cc.dbl_vv.push_back(dv);
+
+    VectorToc toc = VectorTocMaker().apply(t);
+
+    ConvertToVector ctv(toc,registry);
+
+    ctv.apply(&cc, true);
+    unsigned int version = ctv.getPlaceVectorVersion();
+    const StringVector* places = &ctv.getPlaceVector();
+
+    BOOST_REQUIRE( places->size() == 5 );
+    BOOST_CHECK( places->back() == "dbl_vv.1.dbl_vector.1" );
+
+    BOOST_TEST_CHECKPOINT("same shape");
+    cc.dbl_vv[1].dbl_vector[1] = -3;
+    ctv.apply(&cc, true);
+    BOOST_CHECK( ctv.getPlaceVectorVersion() == version );
+    BOOST_CHECK( &ctv.getPlaceVector() == places );
+
+    BOOST_TEST_CHECKPOINT("no places");
+    ctv.apply(&cc, false);
+    BOOST_CHECK( ctv.getPlaceVector().empty() );
+    BOOST_CHECK( ctv.getPlaceVectorVersion() != version );
+
+    BOOST_TEST_CHECKPOINT("changed shape");
+    cc.dbl_vv[0].dbl_vector.push_back(7);
+    unsigned int paths = PlaceTable::instance().getPathCount();
+    ctv.apply(&cc, true);
+    BOOST_CHECK( PlaceTable::instance().getPathCount() == paths );
+    
+    std::string ref[] = { "dbl_vv.0.a", "dbl_vv.0.dbl_vector.0", "dbl_vv.0.dbl_vector.1",
+        "dbl_vv.1.a", "dbl_vv.1.dbl_vector.0", "dbl_vv.1.dbl_vector.1" };
+    BOOST_CHECK( ctv.getPlaceVector() == StringVector(ref, ref+6) );
+
+    BOOST_TEST_CHECKPOINT("changed slice");
+    version = ctv.getPlaceVectorVersion();
+    ctv.setSlice("dbl_vv.1");
+    ctv.apply(&cc, true);
+    BOOST_CHECK( ctv.getPlaceVectorVersion() != version );
+    BOOST_CHECK( ctv.getPlaceVector() == StringVector(ref+3, ref+6) );
+}
+
+BOOST_AUTO_TEST_CASE( test_normalize_converter )
+{
+    Registry registry;
+    import_types(registry);
+
+    VectorToc toc = VectorTocMaker().apply(*registry.get("/TwoArrays"));
+
+    TwoArrays samples[4] = { 
+        { { 1, 2, 3 }, { 4, 5, 6, 7, 8 } },
+        { { 3, 2, 5 }, { 4, 7, 6, 9, 8 } },
+        { { 1, 2, 3 }, { 4, 5, 6, 7, 8 } },
+        { { 3, 2, 5 }, { 4, 7, 6, 9, 8 } } };
+
+    AbstractConverter::Pointer converters[2] = { 
+        AbstractConverter::Pointer(new ConvertToVector(toc, registry)),
+        AbstractConverter::Pointer(new CompiledConverter(toc, registry)) };
+
+    for ( int c=0; c<2; c++ ) {
+
+        NormalizeConverter nc(converters[c]);
+
+        BOOST_CHECK( nc.apply(&samples[0]) == converters[c]->apply(&samples[0]) );
+
+        MatrixBuffer buffer(8, 10);
+        for ( int i=0; i<4; i++ ) 
+            buffer.push(Eigen::Map<const Eigen::VectorXd>(
+                        &(converters[c]->apply(&samples[i])[0]), 8));
+
+        nc.learn(buffer);
+
+        VectorOfDoubles offsets = nc.getOffsets();
+        VectorOfDoubles scales = nc.getScales();
+        BOOST_REQUIRE( offsets.size() == 8 && scales.size() == 8 );
+        BOOST_CHECK( offsets[0] == 2 && scales[0] == 1.0 );
+        BOOST_CHECK( offsets[1] == 2 && scales[1] == 1.0 );
+        BOOST_CHECK( offsets[4] == 6 && scales[4] == 1.0 );
+
+        VectorOfDoubles res = nc.apply(&samples[0]);
+        double ref[] = { -1, 0, -1, 0, -1, 0, -1, 0 };
+        BOOST_CHECK( res == VectorOfDoubles(ref, ref+8) );
+
+        double out[8];
+        BOOST_CHECK( nc.applyInto(&samples[1], out, 8) == 8 );
+        BOOST_CHECK( out[0] == 1 && out[7] == 0 && out[6] == 1 );
+
+        res = nc.apply(&samples[1], true);
+        BOOST_CHECK( res[0] == 1 );
+        BOOST_CHECK( nc.getPlaceVector().size() == 8 );
+
+        double factor;
+        BOOST_CHECK( bool(nc.getFlatProgram(factor)) == (c == 1) );
+
+        BOOST_CHECK_THROW( nc.setNormalization(VectorOfDoubles(3, 0.0), 
+                    VectorOfDoubles(3, 1.0)), std::runtime_error );
+    }
+}
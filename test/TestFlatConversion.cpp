@@ -585,6 +585,11 @@ BOOST_AUTO_TEST_CASE( test_single_convert_multi_struct )
     BOOST_REQUIRE ( res.size() == dbl_vec.size() );
 
     BOOST_CHECK( dbl_vec == res );
+
+    float flt = 0;
+    BOOST_CHECK( sc.applyInto(&b, &flt, 1) == 1 );
+    BOOST_CHECK( flt == float(b.a) );
+    BOOST_CHECK_THROW( sc.applyInto(&b, &flt, 0), std::runtime_error );
     
     BOOST_TEST_CHECKPOINT("Testing struct B places");
 
@@ -617,6 +622,9 @@ BOOST_AUTO_TEST_CASE( test_single_convert_container )
     std::vector<double> res = sc.applyToValue(v);
 
     BOOST_CHECK( res.empty() );
+
+    float flt = 0;
+    BOOST_CHECK( sc.applyInto(&int_vec, &flt, 1) == 0 );
 }
 
 
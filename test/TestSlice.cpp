@@ -619,6 +619,41 @@ BOOST_AUTO_TEST_CASE ( test_slice_inslice ) {
         BOOST_CHECK ( !s.fitsASlice("a.12.b.2.10.d") );
         BOOST_CHECK ( !s.fitsASlice("d.12.b.2.10.d") );
     }
+
+    { 
+        // a "*" in the place only fits a "*" of the slice
+        SliceMatcher s("a.3 b.[1-3] c.*"); 
+
+        BOOST_CHECK ( s.fitsASlice("a.3") );
+        BOOST_CHECK ( !s.fitsASlice("a.*") );
+        BOOST_CHECK ( !s.fitsASlice("a.*.x") );
+        BOOST_CHECK ( s.fitsASlice("b.2") );
+        BOOST_CHECK ( !s.fitsASlice("b.*") );
+        BOOST_CHECK ( s.fitsASlice("c.7") );
+        BOOST_CHECK ( s.fitsASlice("c.*") );
+    }
+
+    { 
+        // a slice that starts another one still takes all of its place
+        SliceMatcher s("a a.b"); 
+
+        BOOST_CHECK ( s.fitsASlice("a") );
+        BOOST_CHECK ( s.fitsASlice("a.c") );
+        BOOST_CHECK ( s.fitsASlice("a.b.c") );
+        BOOST_CHECK ( !s.fitsASlice("b") );
+
+        SliceMatcher x("x.* x.*.b");
+
+        BOOST_CHECK ( x.fitsASlice("x.3.c") );
+        BOOST_CHECK ( x.fitsASlice("x.3.b") );
+        BOOST_CHECK ( !x.fitsASlice("x") );
+
+        SliceMatcher g("data.[1-2] data.*.b", true);
+
+        BOOST_CHECK ( g.fitsASlice("data.5.c") );
+        BOOST_CHECK ( g.fitsASlice("data.*.b") );
+        BOOST_CHECK ( !g.fitsASlice("data") );
+    }
 }
 
 BOOST_AUTO_TEST_CASE ( test_slice_tree ) 
@@ -705,3 +740,82 @@ BOOST_AUTO_TEST_CASE ( test_slice_tree )
     BOOST_CHECK( t1.fitsASlice("a.3") );
     BOOST_CHECK( !t1.fitsASlice("a.3.b.2") );
 }
+
+BOOST_AUTO_TEST_CASE ( test_slice_automaton ) 
+{
+    SliceAutomaton a1("start.idx start.[1,4-6].a start.[1,4-6].b start.*.c zwei");
+
+    BOOST_CHECK( a1.fitsASlice("start.idx") );
+    BOOST_CHECK( a1.fitsASlice("start.1.a") );
+    BOOST_CHECK( a1.fitsASlice("start.5.a") );
+    BOOST_CHECK( a1.fitsASlice("start.1.b") );
+    BOOST_CHECK( a1.fitsASlice("start.4.b") );
+    BOOST_CHECK( a1.fitsASlice("start.8.c") );
+    BOOST_CHECK( a1.fitsASlice("start.5.c") );
+    BOOST_CHECK( a1.fitsASlice("zwei") );
+    BOOST_CHECK( a1.fitsASlice("start.idx.2.a") );
+    BOOST_CHECK( a1.fitsASlice("zwei.idx") );
+    BOOST_CHECK( !a1.fitsASlice("drei") );
+    BOOST_CHECK( !a1.fitsASlice("start.value") );
+    BOOST_CHECK( !a1.fitsASlice("start.2.a") );
+    BOOST_CHECK( !a1.fitsASlice("start.1.d") );
+    BOOST_CHECK( !a1.fitsASlice("start.1") );
+    BOOST_CHECK( !a1.fitsASlice("") );
+
+    BOOST_CHECK( a1.getTokenId("idx", 3) >= 0 );
+    BOOST_CHECK( a1.getTokenId("id", 2) == -1 );
+
+    // the automaton follows all matching branches
+    SliceAutomaton a2("a.[0,2].b.1 a.*.c");
+
+    BOOST_CHECK( a2.fitsASlice("a.2.c") );
+    BOOST_CHECK( a2.fitsASlice("a.2.b.1") );
+    BOOST_CHECK( !a2.fitsASlice("a.1.b.1") );
+    BOOST_CHECK( a2.fitsASlice("a.*.b.1") );
+    BOOST_CHECK( !a2.fitsASlice("a.*.b.2") );
+
+    SliceTree t2("a.[0,2].b.1 a.*.c");
+    BOOST_CHECK( t2.fitsASlice("a.2.c") );
+
+    SliceAutomaton a3("! a.1 a.3.b.2");
+    
+    BOOST_CHECK( !a3.fitsASlice("a.1") );
+    BOOST_CHECK( !a3.fitsASlice("a.1.b.2") );
+    BOOST_CHECK( a3.fitsASlice("a.2.b.2") );
+    BOOST_CHECK( a3.fitsASlice("a.3") );
+    BOOST_CHECK( !a3.fitsASlice("a.3.b.2") );
+
+    BOOST_CHECK( SliceAutomaton("").fitsASlice("x.2") );
+    BOOST_CHECK( !SliceAutomaton("!").fitsASlice("x.2") );
+
+    // a "*" in the place fits index slices as in SliceTree
+    SliceAutomaton a4("a.3 b.[1-3] c.*");
+    SliceTree t4("a.3 b.[1-3] c.*");
+
+    BOOST_CHECK( a4.fitsASlice("a.*") && t4.fitsASlice("a.*") );
+    BOOST_CHECK( a4.fitsASlice("b.*") && t4.fitsASlice("b.*") );
+    BOOST_CHECK( a4.fitsASlice("c.*") && t4.fitsASlice("c.*") );
+    BOOST_CHECK( !a4.fitsASlice("a.2") && !t4.fitsASlice("a.2") );
+
+    // without wildcard places it only fits a "*", as in SliceMatcher
+    SliceAutomaton a5("a.3 b.[1-3] c.*", false);
+
+    BOOST_CHECK( !a5.fitsASlice("a.*") );
+    BOOST_CHECK( !a5.fitsASlice("b.*") );
+    BOOST_CHECK( a5.fitsASlice("c.*") );
+    BOOST_CHECK( a5.fitsASlice("a.3") && a5.fitsASlice("b.1") && a5.fitsASlice("c.4") );
+
+    // a slice ends at a node even if another slice goes on from there
+    SliceAutomaton a7("a a.b");
+    SliceTree t7("a a.b");
+
+    BOOST_CHECK( a7.fitsASlice("a.c") && t7.fitsASlice("a.c") );
+    BOOST_CHECK( a7.fitsASlice("a.b") && t7.fitsASlice("a.b") );
+    BOOST_CHECK( !a7.fitsASlice("c") && !t7.fitsASlice("c") );
+    BOOST_CHECK( !SliceAutomaton("! x.* x.*.b").fitsASlice("x.2.c") );
+
+    SliceAutomaton a6("! a.3", false);
+
+    BOOST_CHECK( a6.fitsASlice("a.*") );
+    BOOST_CHECK( !a6.fitsASlice("a.3") );
+}
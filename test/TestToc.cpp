@@ -1,6 +1,9 @@
 // \file  TestToc.cpp
 
 #include <boost/test/auto_unit_test.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <sstream>
 
 #include <Utilities.hpp>
 #include <VectorToc.hpp>
@@ -10,7 +13,7 @@ using namespace type_to_vector;
 VectorValueInfo makeInfo(const std::string& descr, unsigned int position,
         VectorToc* content=0) {
     VectorValueInfo info;
-    info.placeDescription = descr;
+    info.placeDescription = Place(descr);
     info.position = position;
     info.content = VectorTocPointer(content);
     return info;
@@ -213,3 +216,57 @@ BOOST_AUTO_TEST_CASE ( test_toc_level_two ) {
     }
 }
 
+
+BOOST_AUTO_TEST_CASE ( test_toc_place ) {
+
+    Place empty;
+    BOOST_CHECK ( empty.empty() );
+    BOOST_CHECK ( empty.toString() == "" );
+    BOOST_CHECK ( Place("") == empty );
+
+    Place p("position.3");
+    BOOST_CHECK ( !p.empty() );
+    BOOST_CHECK ( p.toString() == "position.3" );
+    BOOST_CHECK ( p.getDepth() == 2 );
+
+    unsigned int paths = PlaceTable::instance().getPathCount();
+    
+    BOOST_CHECK ( Place("position.3").getId() == p.getId() );
+    BOOST_CHECK ( p.getParent() == Place("position") );
+    BOOST_CHECK ( PlaceTable::instance().getPathCount() == paths );
+
+    Place q("position.3.rotation.im");
+    BOOST_CHECK ( q.toString() == "position.3.rotation.im" );
+    BOOST_CHECK ( q != p );
+    BOOST_CHECK ( q.getParent().getParent() == p );
+
+    StringVector tokens = q.getTokens();
+    BOOST_REQUIRE ( tokens.size() == 4 );
+    BOOST_CHECK ( tokens[1] == "3" && tokens[3] == "im" );
+
+    std::stringstream ss;
+    ss << q;
+    BOOST_CHECK ( ss.str() == "position.3.rotation.im" );
+}
+
+static void internPlaces (int count) {
+    for ( int i=0; i<count; i++ ) 
+        Place("intern_" + boost::lexical_cast<std::string>(i) + ".x");
+}
+
+BOOST_AUTO_TEST_CASE ( test_toc_place_concurrent_render ) {
+
+    Place p("render.me.3");
+
+    // rendering does not lock, the table grows meanwhile
+    boost::thread writer(boost::bind(&internPlaces, 20000));
+
+    bool same = true;
+    for ( int i=0; i<20000; i++ ) 
+        same = same && p.toString() == "render.me.3";
+
+    writer.join();
+
+    BOOST_CHECK ( same );
+    BOOST_CHECK ( Place("intern_19999.x").getParent().toString() == "intern_19999" );
+}
@@ -30,7 +30,7 @@ BOOST_AUTO_TEST_CASE ( test_tocmaker_scalar ) {
     BOOST_CHECK ( toc.mType == "/double");
     BOOST_CHECK ( toc.mSlice == "");
     BOOST_REQUIRE ( toc.size() == 1 );
-    BOOST_CHECK ( toc.back().placeDescription == "");
+    BOOST_CHECK ( toc.back().placeDescription.toString() == "");
     BOOST_REQUIRE ( toc.back().castFun != 0 );
 
     double val = 1.4;
@@ -57,7 +57,7 @@ BOOST_AUTO_TEST_CASE ( test_tocmaker_array ) {
     BOOST_REQUIRE ( toc.size() == 3 );
     
    for ( int i = 0; i<3 ; i++) {
-        BOOST_CHECK ( toc.at(i).placeDescription[0] == '0' + i);
+        BOOST_CHECK ( toc.at(i).placeDescription.toString()[0] == '0' + i);
         BOOST_REQUIRE ( toc.at(i).castFun != 0 );
 
         double val = 1.4;
@@ -87,25 +87,25 @@ BOOST_AUTO_TEST_CASE ( test_tocmaker_struct ) {
     BOOST_CHECK ( toc.mType == "/A" );
     BOOST_REQUIRE ( toc.size() == 4 );
 
-    BOOST_CHECK ( toc.at(0).placeDescription == "a");
+    BOOST_CHECK ( toc.at(0).placeDescription.toString() == "a");
     BOOST_REQUIRE ( toc.at(0).castFun != 0 );
     long long vall = 1<<32;
     BOOST_CHECK ( toc.at(0).castFun(&vall) == double(vall) );
     BOOST_CHECK ( toc.at(0).content == 0 );
     
-    BOOST_CHECK ( toc.at(1).placeDescription == "b");
+    BOOST_CHECK ( toc.at(1).placeDescription.toString() == "b");
     BOOST_REQUIRE ( toc.at(1).castFun != 0 );
     int vali = 1<<20;
     BOOST_CHECK ( toc.at(1).castFun(&vali) == double(vali) );
     BOOST_CHECK ( toc.at(1).content == 0 );
     
-    BOOST_CHECK ( toc.at(2).placeDescription == "c");
+    BOOST_CHECK ( toc.at(2).placeDescription.toString() == "c");
     BOOST_REQUIRE ( toc.at(2).castFun != 0 );
     char valc = 1<<4;
     BOOST_CHECK ( toc.at(2).castFun(&valc) == double(valc) );
     BOOST_CHECK ( toc.at(2).content == 0 );
     
-    BOOST_CHECK ( toc.at(3).placeDescription == "d");
+    BOOST_CHECK ( toc.at(3).placeDescription.toString() == "d");
     BOOST_REQUIRE ( toc.at(3).castFun != 0 );
     short vals = 1<<12;
     BOOST_CHECK ( toc.at(3).castFun(&vals) == double(vals) );
@@ -135,18 +135,51 @@ BOOST_AUTO_TEST_CASE ( test_tocmaker_container ) {
 
     BOOST_CHECK ( !toc.isFlat() );
     
-    BOOST_CHECK ( toc.back().placeDescription == "*" );
+    BOOST_CHECK ( toc.back().placeDescription.toString() == "*" );
     BOOST_CHECK ( toc.back().castFun == 0 );
     BOOST_CHECK ( toc.back().containerType == toc.mType );
     BOOST_REQUIRE ( toc.back().content.get() );
 
+    const ContainerHandle& container = toc.back().container;
+    BOOST_REQUIRE ( container.isResolved() );
+    BOOST_CHECK ( container.type == registry.get(type_str) );
+    BOOST_CHECK ( container.elementSize == sizeof(int32_t) );
+    BOOST_CHECK ( container.kind == ContainerHandle::StdVector );
+    BOOST_CHECK ( container.elementShift == 2 );
+
+    std::vector<int32_t> ints(5, 1);
+    BOOST_CHECK ( container.getElementCount(&ints) == 5 );
+    BOOST_CHECK ( container.getElements(&ints) == 
+            reinterpret_cast<const uint8_t*>(&ints[0]) );
+
+    std::vector<int32_t> no_ints;
+    BOOST_CHECK ( container.getElementCount(&no_ints) == 0 );
+
+    const Typelib::Container& string_type = 
+        static_cast<const Typelib::Container&>(*registry.get("/std/string"));
+    ContainerHandle string_container(string_type);
+    BOOST_CHECK ( string_container.kind == ContainerHandle::StdString );
+
+    std::string str("abc");
+    BOOST_CHECK ( string_container.getElementCount(&str) == 3 );
+    BOOST_CHECK ( string_container.getElements(&str)[1] == 'b' );
+
+    VectorToc unresolved(toc);
+    unresolved.back().container = ContainerHandle();
+    BOOST_CHECK ( !unresolved.hasResolvedContainers() );
+    
+    VectorToc resolved = VectorToc::withResolvedContainers(unresolved, registry);
+    BOOST_CHECK ( resolved.hasResolvedContainers() );
+    BOOST_CHECK ( resolved.back().container.type == container.type );
+    BOOST_CHECK ( !unresolved.back().container.isResolved() );
+
     VectorToc* subtoc = toc.back().content.get();
     
     BOOST_CHECK ( subtoc->mType == "/int32_t" );
     BOOST_REQUIRE ( subtoc->size() == 1 );
     
     BOOST_CHECK ( subtoc->back().content.get() ==  0 );
-    BOOST_CHECK ( subtoc->back().placeDescription == "");
+    BOOST_CHECK ( subtoc->back().placeDescription.toString() == "");
     BOOST_REQUIRE ( subtoc->back().castFun > 0 );
 
     int val = 23;
@@ -176,7 +209,7 @@ BOOST_AUTO_TEST_CASE ( test_tocmaker_string ) {
     BOOST_CHECK ( toc.mType == type_str );
     BOOST_REQUIRE ( toc.size() == 1 );
     
-    BOOST_CHECK ( toc.back().placeDescription == "*");
+    BOOST_CHECK ( toc.back().placeDescription.toString() == "*");
     BOOST_REQUIRE ( toc.back().castFun == 0 );
     BOOST_REQUIRE ( toc.back().content != 0 );
 
@@ -185,7 +218,7 @@ BOOST_AUTO_TEST_CASE ( test_tocmaker_string ) {
     BOOST_CHECK ( subtoc->mType == "/int8_t" );
     BOOST_REQUIRE ( subtoc->size() == 1 );
     
-    BOOST_CHECK ( subtoc->back().placeDescription == "");
+    BOOST_CHECK ( subtoc->back().placeDescription.toString() == "");
     BOOST_CHECK ( subtoc->back().content ==  0 );
     BOOST_REQUIRE ( subtoc->back().castFun > 0 );
     
@@ -1,6 +1,8 @@
 // \file  TestVectorBuilder.cpp
 
 #include <boost/test/auto_unit_test.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/is_convertible.hpp>
 
 #include <typelib/typemodel.hh>
 #include <typelib/registry.hh>
@@ -13,12 +15,24 @@
 #include "VectorTocMaker.hpp"
 #include "Utilities.hpp"
 #include "VectorBuilder.hpp"
+#include "WorkerPool.hpp"
 
 #include "TestTypes.h"
 
 using namespace Typelib;
 using namespace type_to_vector;
 
+namespace {
+    void countTask (int* count, int i) { 
+        if ( i == 7 ) throw std::runtime_error("task 7 failed");
+        count[i]++; 
+    }
+
+    void rangeTask (int i) {
+        if ( i == 3 ) throw std::out_of_range("task 3 out of range");
+    }
+}
+
 namespace type_to_vector {
     bool operator== (const VectorPosition& one, const VectorPosition& another) {
         return one.start == another.start && one.end == another.end;
@@ -102,8 +116,10 @@ BOOST_AUTO_TEST_CASE( test_builder ) {
             "Container.dbl_vector.0", "Container.dbl_vector.1" };
         std::string sref2[] = { "int", "B.a", "Container.a" };
 
-        BOOST_CHECK( builder.getPlaces(0) == StringVector(sref1, sref1+7) );
+        // places of the first index stay valid when the second is cached
+        const StringVector& places0 = builder.getPlaces(0);
         BOOST_CHECK( builder.getPlaces(1) == StringVector(sref2, sref2+3) );
+        BOOST_CHECK( places0 == StringVector(sref1, sref1+7) );
 
         BOOST_CHECK( builder.getVectorPosition(0,IntIndex) == VectorPosition(0,0) );
         BOOST_CHECK( builder.getVectorPosition(0,BIndex) == VectorPosition(1,4) );
@@ -176,3 +192,531 @@ BOOST_AUTO_TEST_CASE( test_builder ) {
     }
 }
 
+
+BOOST_AUTO_TEST_CASE( test_builder_fixed_layout ) {
+
+    Registry registry;
+    import_types(registry);
+
+    DataVectorBuilder builder;
+
+    builder.push_back(VectorConversion("int"));
+    VectorToc int_toc = VectorTocMaker().apply(*registry.get("/int"));
+    builder.back().addConverter(AbstractConverter::Pointer(new FlatConverter(int_toc)));
+
+    builder.push_back(VectorConversion("B"));
+    VectorToc b_toc = VectorTocMaker().apply(*registry.get("/B"));
+    builder.back().addConverter(AbstractConverter::Pointer(new FlatConverter(b_toc)));
+
+    int i = 2;
+    B b = { 56 , { 111, -12, 80, 23} };
+
+    builder.update(0, &i);
+    builder.fixLayout(0);
+
+    BOOST_REQUIRE( builder.hasFixedLayout(0) );
+    BOOST_CHECK( builder.getVectorSize(0) == 6 );
+    BOOST_CHECK( builder.getVectorPosition(0,0) == VectorPosition(0,0) );
+    BOOST_CHECK( builder.getVectorPosition(0,1) == VectorPosition(1,5) );
+    BOOST_CHECK( builder[1].getDataSize(0) == 5 );
+    BOOST_CHECK( builder.getVector(0)[0] == 2 );
+
+    const VectorOfDoubles* store = &builder.getVector(0);
+
+    builder.update(1, &b);
+    i = 7;
+    builder.update(0, &i, true);
+
+    double ref[] = { 7, 56, 111, -12, 80, 23 };
+    BOOST_CHECK( &builder.getVector(0) == store );
+    BOOST_CHECK( builder.getVector(0) == VectorOfDoubles(ref, ref+6) );
+    BOOST_CHECK( builder[1].getData(0) == VectorOfDoubles(ref+1, ref+6) );
+    BOOST_CHECK( builder.getPlaces(0).size() == 1 );
+
+    builder.push_back(VectorConversion("int2"));
+    builder.back().addConverter(AbstractConverter::Pointer(new FlatConverter(int_toc)));
+    builder.update(2, &i);
+
+    BOOST_CHECK( !builder.hasFixedLayout(0) );
+    BOOST_CHECK( builder.getVectorSize(0) == 7 );
+    BOOST_CHECK( builder.getVector(0)[6] == 7 );
+    BOOST_CHECK( builder.getVectorPosition(0,2) == VectorPosition(6,6) );
+
+    builder.fixLayout(0);
+    BOOST_CHECK( builder.hasFixedLayout(0) );
+    BOOST_CHECK( builder.getVector(0) == builder.getVector(0) );
+    BOOST_CHECK( builder.getVector(0).size() == 7 );
+    BOOST_CHECK( builder.getVector(0)[1] == 56 );
+
+    BOOST_TEST_CHECKPOINT("setting an output drops the layout");
+    builder[2].setName("int3");
+    BOOST_CHECK( builder.hasFixedLayout(0) );
+    builder[2].setOutput(0, 0);
+    BOOST_CHECK( !builder.hasFixedLayout(0) );
+    BOOST_CHECK( builder.getVector(0).size() == 7 );
+    BOOST_CHECK( builder.getVector(0)[6] == 7 );
+
+    builder.fixLayout(0);
+    BOOST_CHECK( builder.hasFixedLayout(0) );
+
+    BOOST_TEST_CHECKPOINT("a copy has its own store");
+    DataVectorBuilder copy(builder);
+    BOOST_REQUIRE( copy.hasFixedLayout(0) );
+    BOOST_CHECK( copy[0].getOutput(0) != builder[0].getOutput(0) );
+    BOOST_CHECK( copy.getVector(0) == builder.getVector(0) );
+
+    int j = 9;
+    copy.update(0, &j);
+    BOOST_CHECK( copy.getVector(0)[0] == 9 );
+    BOOST_CHECK( builder.getVector(0)[0] == 7 );
+
+    VectorConversion detached = builder[0];
+    BOOST_CHECK( detached.getOutput(0) == 0 );
+    BOOST_CHECK( detached.getData(0) == builder[0].getData(0) );
+
+    copy = builder;
+    BOOST_CHECK( copy.hasFixedLayout(0) && copy.getVector(0)[0] == 7 );
+    copy.update(0, &j);
+    BOOST_CHECK( builder.getVector(0)[0] == 7 );
+
+    builder.releaseLayout(0);
+    BOOST_CHECK( !builder.hasFixedLayout(0) );
+    BOOST_CHECK( builder[1].getOutput(0) == 0 );
+    BOOST_CHECK( builder.getVector(0).size() == 7 );
+    BOOST_CHECK( builder.getVector(0)[6] == 7 );
+
+    builder.push_back(VectorConversion("Container"));
+    VectorToc dv_toc = VectorTocMaker().apply(*registry.get("/DoubleVector"));
+    builder.back().addConverter(
+            AbstractConverter::Pointer(new ConvertToVector(dv_toc, registry)));
+
+    BOOST_CHECK_THROW( builder.fixLayout(0), std::runtime_error );
+}
+
+BOOST_AUTO_TEST_CASE( test_builder_fixed_layout_slice ) {
+
+    Registry registry;
+    import_types(registry);
+
+    VectorToc b_toc = VectorTocMaker().apply(*registry.get("/B"));
+    B b = { 56 , { 111, -12, 80, 23} };
+
+    for ( int fused=0; fused<2; fused++ ) {
+
+        boost::shared_ptr<FlatConverter> flat(new FlatConverter(b_toc));
+        boost::shared_ptr<CompiledConverter> compiled(
+                new CompiledConverter(b_toc, registry));
+
+        DataVectorBuilder builder;
+        builder.push_back(VectorConversion("flat"));
+        builder.back().addConverter(flat);
+        builder.push_back(VectorConversion("compiled"));
+        builder.back().addConverter(compiled);
+        builder.back().addConverter(
+                AbstractConverter::Pointer(new CompiledConverter(b_toc, registry)));
+        builder.back().setFused(fused);
+
+        builder.fixLayout(0);
+        builder.update(0, &b);
+        builder.update(1, &b);
+        BOOST_REQUIRE( builder.hasFixedLayout(0) && builder.getVectorSize(0) == 10 );
+
+        BOOST_TEST_CHECKPOINT("a smaller slice after fixLayout");
+        flat->setSlice("b");
+        compiled->setSlice("b");
+        BOOST_CHECK_THROW( builder.update(0, &b), std::runtime_error );
+        BOOST_CHECK( !builder.hasFixedLayout(0) );
+        BOOST_CHECK_THROW( builder.update(1, &b), std::runtime_error );
+        BOOST_CHECK( builder.getVector(0).size() == 10 );
+
+        BOOST_TEST_CHECKPOINT("a larger slice after fixLayout");
+        builder.fixLayout(0);
+        builder.update(0, &b);
+        builder.update(1, &b);
+        BOOST_REQUIRE( builder.hasFixedLayout(0) && builder.getVectorSize(0) == 8 );
+        BOOST_CHECK( builder.getVector(0)[4] == 111 );
+
+        flat->setSlice("");
+        compiled->setSlice("");
+        BOOST_CHECK_THROW( builder.update(1, &b), std::runtime_error );
+        BOOST_CHECK( !builder.hasFixedLayout(0) );
+        BOOST_CHECK_THROW( builder.update(0, &b), std::runtime_error );
+        BOOST_CHECK( builder[1].getData(0).size() == 4 );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_builder_float_layout ) {
+
+    Registry registry;
+    import_types(registry);
+
+    VectorToc int_toc = VectorTocMaker().apply(*registry.get("/int"));
+    VectorToc ta_toc = VectorTocMaker().apply(*registry.get("/TwoArrays"));
+
+    DataVectorBuilder builder;
+
+    builder.push_back(VectorConversion("int"));
+    builder.back().addConverter(AbstractConverter::Pointer(new FlatConverter(int_toc)));
+    builder.back().addConverter(AbstractConverter::Pointer(new FlatConverter(int_toc)));
+
+    builder.push_back(VectorConversion("TwoArrays"));
+    builder.back().addConverter(
+            AbstractConverter::Pointer(new CompiledConverter(ta_toc, registry)));
+    builder.back().addConverter(
+            AbstractConverter::Pointer(new CompiledConverter(ta_toc, registry)));
+    builder.back().setFused(true);
+
+    int i = 2;
+    TwoArrays ta = { { 1, -2, 3 }, { 4, 5, -6, 7, 8 } };
+
+    builder.update(0, &i);
+    builder.update(1, &ta);
+
+    double ref[] = { 2, 1, -2, 3, 4, 5, -6, 7, 8 };
+    std::vector<float> float_ref(ref, ref+9);
+
+    BOOST_TEST_CHECKPOINT("floats without a fixed layout");
+    BOOST_CHECK( builder.getFloatVector(0) == float_ref );
+    BOOST_REQUIRE( builder.getFloatChangedRanges(0).size() == 1 );
+    BOOST_CHECK( builder.getFloatChangedRanges(0)[0] == VectorPosition(0,8) );
+
+    BOOST_TEST_CHECKPOINT("a float store");
+    builder.fixLayout(0, true);
+    builder.fixLayout(1, true);
+    BOOST_REQUIRE( builder.hasFixedLayout(0) && builder.getVectorSize(0) == 9 );
+    BOOST_CHECK( builder[1].getOutput(0) == 0 && builder[1].getFloatOutput(0) != 0 );
+    BOOST_CHECK( builder.getFloatVector(0) == float_ref );
+
+    const std::vector<float>* store = &builder.getFloatVector(0);
+
+    i = 3;
+    ta.a[1] = 20;
+    builder.update(0, &i);
+    builder.update(1, &ta);
+    ref[0] = 3;
+    ref[2] = 20;
+    float_ref.assign(ref, ref+9);
+
+    BOOST_CHECK( builder[1].getFusedCount() == 2 );
+    BOOST_CHECK( &builder.getFloatVector(0) == store );
+    BOOST_CHECK( builder.getFloatChangedRanges(0).size() == 1 );
+    BOOST_CHECK( builder.getFloatVector(0) == float_ref );
+    BOOST_CHECK( builder.getFloatVector(1) == float_ref );
+    BOOST_CHECK( builder.getVector(0) == VectorOfDoubles(ref, ref+9) );
+    BOOST_CHECK( builder.getVectorPosition(0,1) == VectorPosition(1,8) );
+    BOOST_CHECK( builder[1].getData(1) == builder[1].getData(0) );
+
+    Eigen::VectorXf eigen_floats;
+    BOOST_REQUIRE( builder.getEigenVector(0, eigen_floats) );
+    BOOST_CHECK( eigen_floats[2] == 20.0f && eigen_floats.size() == 9 );
+
+    builder.update(0, &i);
+    builder.getFloatVector(0);
+    BOOST_REQUIRE( builder.getFloatChangedRanges(0).size() == 1 );
+    BOOST_CHECK( builder.getFloatChangedRanges(0)[0] == VectorPosition(0,0) );
+
+    BOOST_TEST_CHECKPOINT("a copy has its own float store");
+    DataVectorBuilder copy(builder);
+    BOOST_REQUIRE( copy.hasFixedLayout(0) );
+    BOOST_CHECK( copy[1].getFloatOutput(0) != 0 );
+    BOOST_CHECK( copy[1].getFloatOutput(0) != builder[1].getFloatOutput(0) );
+    BOOST_CHECK( copy.getFloatVector(0) == float_ref );
+
+    BOOST_TEST_CHECKPOINT("fused outputs of both types");
+    builder.releaseLayout(1);
+    BOOST_CHECK( builder.hasFixedLayout(0) && !builder.hasFixedLayout(1) );
+    ta.a[1] = 30;
+    builder.update(1, &ta);
+    BOOST_CHECK( builder[1].getData(0)[1] == 30 );
+    BOOST_CHECK( builder[1].getData(1) == builder[1].getData(0) );
+    BOOST_CHECK( builder.getFloatVector(0)[2] == 30.0f );
+
+    builder.releaseLayout(0);
+    BOOST_CHECK( builder[1].getFloatOutput(0) == 0 );
+    BOOST_CHECK( builder.getVector(0)[2] == 30 );
+}
+
+BOOST_AUTO_TEST_CASE( test_builder_changed_ranges ) {
+
+    Registry registry;
+    import_types(registry);
+
+    DataVectorBuilder builder;
+
+    VectorToc int_toc = VectorTocMaker().apply(*registry.get("/int"));
+    VectorToc b_toc = VectorTocMaker().apply(*registry.get("/B"));
+    
+    builder.push_back(VectorConversion("int"));
+    builder.back().addConverter(AbstractConverter::Pointer(new FlatConverter(int_toc)));
+    builder.push_back(VectorConversion("B"));
+    builder.back().addConverter(AbstractConverter::Pointer(new FlatConverter(b_toc)));
+    builder.push_back(VectorConversion("int2"));
+    builder.back().addConverter(AbstractConverter::Pointer(new FlatConverter(int_toc)));
+
+    int i = 2, j = 3;
+    B b = { 56 , { 111, -12, 80, 23} };
+
+    builder.update(0, &i);
+    builder.update(1, &b);
+    builder.update(2, &j);
+
+    for ( int fixed = 0; fixed < 2; fixed++ ) {
+
+        if ( fixed ) builder.fixLayout(0);
+
+        builder.getVector(0);
+        std::vector<VectorPosition> ranges = builder.getChangedRanges(0);
+        BOOST_REQUIRE( ranges.size() == 1 );
+        BOOST_CHECK( ranges[0] == VectorPosition(0,6) );
+
+        builder.getVector(0);
+        BOOST_CHECK( builder.getChangedRanges(0).empty() );
+
+        i = 4 + fixed; j = 5 + fixed;
+        builder.update(0, &i);
+        builder.update(2, &j);
+
+        double ref[] = { 4 + fixed, 56, 111, -12, 80, 23, 5 + fixed };
+        BOOST_CHECK( builder.getVector(0) == VectorOfDoubles(ref, ref+7) );
+
+        ranges = builder.getChangedRanges(0);
+        BOOST_REQUIRE( ranges.size() == 2 );
+        BOOST_CHECK( ranges[0] == VectorPosition(0,0) );
+        BOOST_CHECK( ranges[1] == VectorPosition(6,6) );
+
+        builder.update(1, &b);
+        builder.update(2, &j);
+        builder.getVector(0);
+
+        ranges = builder.getChangedRanges(0);
+        BOOST_REQUIRE( ranges.size() == 1 );
+        BOOST_CHECK( ranges[0] == VectorPosition(1,6) );
+    }
+
+    builder.releaseLayout(0);
+    builder.pop_back();
+
+    double ref[] = { 5, 56, 111, -12, 80, 23 };
+    BOOST_CHECK( builder.getVector(0) == VectorOfDoubles(ref, ref+6) );
+    BOOST_REQUIRE( builder.getChangedRanges(0).size() == 1 );
+    BOOST_CHECK( builder.getChangedRanges(0)[0] == VectorPosition(0,5) );
+}
+
+BOOST_AUTO_TEST_CASE( test_builder_parallel_update ) {
+
+    Registry registry;
+    import_types(registry);
+
+    WorkerPool pool(3);
+    BOOST_CHECK( pool.getThreadCount() == 3 );
+
+    {
+        int count[100] = { 0 };
+        WorkerPool::Tasks tasks;
+        for ( int i=0; i<100; i++ ) tasks.push_back(boost::bind(&countTask, count, i));
+
+        BOOST_CHECK_THROW( pool.run(tasks), std::runtime_error );
+
+        bool once = true;
+        for ( int i=0; i<100; i++ ) 
+            if ( i != 7 && count[i] != 1 ) once = false;
+        BOOST_CHECK( once );
+
+        tasks.erase(tasks.begin() + 7);
+        pool.run(tasks);
+        BOOST_CHECK( count[0] == 2 && count[99] == 2 );
+
+        tasks.clear();
+        for ( int i=0; i<10; i++ ) tasks.push_back(boost::bind(&rangeTask, i));
+
+        BOOST_CHECK_THROW( pool.run(tasks), std::out_of_range );
+    }
+
+    DataVectorBuilder builder;
+
+    VectorToc toc = VectorTocMaker().apply(*registry.get("/DoubleVector"));
+    const int Conversions = 20;
+
+    for ( int i=0; i<Conversions; i++ ) {
+        builder.push_back(VectorConversion("dv" + boost::lexical_cast<std::string>(i)));
+        builder.back().addConverter(
+                AbstractConverter::Pointer(new ConvertToVector(toc, registry)));
+    }
+
+    std::vector<DoubleVector> data(Conversions);
+    ConversionUpdates updates;
+
+    for ( int i=0; i<Conversions; i++ ) {
+        data[i].a = i;
+        data[i].dbl_vector.assign(i, double(i));
+        updates.push_back(std::make_pair(i, (void*)&data[i]));
+    }
+
+    builder.update(updates, pool, true);
+
+    for ( int i=0; i<Conversions; i++ ) {
+        VectorOfDoubles ref(i+1, double(i));
+        BOOST_CHECK( builder[i].getData(0) == ref );
+    }
+
+    BOOST_CHECK( builder.getVectorSize(0) == Conversions*(Conversions+1)/2 );
+    BOOST_CHECK( builder.getPlaces(0).size() == builder.getVector(0).size() );
+
+    // a duplicate is found before any conversion runs
+    unsigned int updates_of_first = builder[0].getUpdateCount(0);
+    updates.push_back(std::make_pair(3, (void*)&data[3]));
+    BOOST_CHECK_THROW( builder.update(updates, pool), std::runtime_error );
+    BOOST_CHECK( builder[0].getUpdateCount(0) == updates_of_first );
+
+    updates.back().first = Conversions;
+    BOOST_CHECK_THROW( builder.update(updates, pool), std::out_of_range );
+    BOOST_CHECK( builder[0].getUpdateCount(0) == updates_of_first );
+}
+
+BOOST_AUTO_TEST_CASE( test_builder_name_index ) {
+
+    DataVectorBuilder builder;
+
+    BOOST_CHECK( builder.getVectorIdx("a") == -1 );
+
+    builder.addConversion(VectorConversion("a"));
+    builder.addConversion(VectorConversion("b"));
+    builder.push_back(VectorConversion("c"));
+    builder.addConversion(VectorConversion("a"));
+
+    BOOST_CHECK( builder.getVectorIdx("a") == 0 );
+    BOOST_CHECK( builder.getVectorIdx("b") == 1 );
+    BOOST_CHECK( builder.getVectorIdx("c") == 2 );
+    BOOST_CHECK( builder.getVectorIdx("d") == -1 );
+
+    builder[1].setName("d");
+    BOOST_CHECK( builder.getVectorIdx("b") == -1 );
+    BOOST_CHECK( builder.getVectorIdx("d") == 1 );
+
+    builder.erase(builder.begin());
+    BOOST_CHECK( builder.getVectorIdx("a") == 2 );
+    BOOST_CHECK( builder.getVectorIdx("d") == 0 );
+
+    BOOST_TEST_CHECKPOINT("renamed earlier conversion is found first");
+    builder[1].setName("a");
+    BOOST_CHECK( builder.getVectorIdx("a") == 1 );
+
+    BOOST_TEST_CHECKPOINT("assigned conversion");
+    builder[0] = VectorConversion("e");
+    BOOST_CHECK( builder.getVectorIdx("e") == 0 );
+    BOOST_CHECK( builder.getVectorIdx("d") == -1 );
+    BOOST_CHECK( builder.getVectorIdx("a") == 1 );
+
+    BOOST_TEST_CHECKPOINT("conversions of other builders");
+    DataVectorBuilder copy(builder);
+    VectorConversion other = builder[0];
+    other.setName("f");
+    copy[0].setName("g");
+    BOOST_CHECK( builder.getVectorIdx("e") == 0 );
+    BOOST_CHECK( builder.getVectorIdx("f") == -1 );
+    BOOST_CHECK( builder.getVectorIdx("g") == -1 );
+    BOOST_CHECK( copy.getVectorIdx("g") == 0 );
+
+    BOOST_TEST_CHECKPOINT("growing the builder");
+    for ( int i=0; i<100; i++ ) builder.addConversion(VectorConversion("x"));
+    builder[1].setName("h");
+    BOOST_CHECK( builder.getVectorIdx("h") == 1 );
+    BOOST_CHECK( builder.getVectorIdx("x") == 3 );
+}
+
+BOOST_AUTO_TEST_CASE( test_builder_handles ) {
+
+    Registry registry;
+    import_types(registry);
+
+    VectorToc toc = VectorTocMaker().apply(*registry.get("/int"));
+
+    // resize, assign, swap and the like of a std::vector would skip the indices
+    BOOST_STATIC_ASSERT(( !boost::is_convertible<DataVectorBuilder*, 
+                std::vector<VectorConversion>*>::value ));
+
+    DataVectorBuilder builder;
+    std::vector<ConversionHandle> handles;
+
+    const char* names[] = { "a", "b", "c" };
+
+    for ( int i=0; i<3; i++ ) {
+        VectorConversion conversion(names[i]);
+        conversion.addConverter(AbstractConverter::Pointer(new FlatConverter(toc)));
+        handles.push_back(builder.addConversion(conversion));
+    }
+
+    for ( int i=0; i<3; i++ ) BOOST_CHECK( builder.getVectorIdx(handles[i]) == i );
+
+    builder.erase(builder.begin());
+
+    BOOST_CHECK( builder.getVectorIdx(handles[0]) == -1 );
+    BOOST_CHECK( builder.getVectorIdx(handles[1]) == 0 );
+    BOOST_CHECK( builder.getVectorIdx(handles[2]) == 1 );
+    BOOST_CHECK( builder.getVectorIdx("c") == 1 );
+
+    int value = 5;
+    BOOST_CHECK_THROW( builder.update(handles[0], &value), std::out_of_range );
+
+    builder.update(handles[2], &value);
+    BOOST_CHECK( builder[1].getUpdateCount(0) == 1 );
+    BOOST_CHECK( builder[0].getUpdateCount(0) == 0 );
+    BOOST_CHECK( builder.getData(handles[2], 0) == VectorOfDoubles(1, 5.0) );
+
+    builder.insert(builder.begin(), VectorConversion("d"));
+
+    BOOST_CHECK( builder.getVectorIdx(handles[2]) == 2 );
+    BOOST_CHECK( builder.getVectorIdx(builder.getHandle(0)) == 0 );
+    BOOST_CHECK( builder.getVectorIdx("d") == 0 );
+    BOOST_CHECK( builder.getData(handles[2], 0) == VectorOfDoubles(1, 5.0) );
+}
+
+BOOST_AUTO_TEST_CASE( test_conversion_fused ) {
+
+    Registry registry;
+    import_types(registry);
+
+    const char* types[] = { "/TwoArrays", "/B" };
+    const char* slices[] = { "b.[1-3]", "b.b" };
+
+    TwoArrays ta = { { 1, -2, 3 }, { 4, 5, -6, 7, 8 } };
+    B b = { 56 , { 111, -12, 80, 23} };
+    void* data[] = { &ta, &b };
+
+    for ( int t=0; t<2; t++ ) {
+
+        VectorToc toc = VectorTocMaker().apply(*registry.get(types[t]));
+
+        VectorConversion fused("fused"), separate("separate");
+        VectorConversion* conversions[] = { &fused, &separate };
+
+        for ( int c=0; c<2; c++ ) {
+
+            boost::shared_ptr<CompiledConverter> sliced(new CompiledConverter(toc, registry));
+            sliced->setSlice(slices[t]);
+
+            AbstractConverter::Pointer full(new CompiledConverter(toc, registry));
+
+            conversions[c]->addConverter(full);
+            conversions[c]->addConverter(sliced);
+            conversions[c]->addConverter(AbstractConverter::Pointer(
+                        new MultiplyConverter(full, 2.0)));
+            conversions[c]->addConverter(AbstractConverter::Pointer(
+                        new SingleConverter(toc)));
+            conversions[c]->addConverter(AbstractConverter::Pointer(
+                        new FlatConverter(toc)));
+        }
+
+        fused.setFused(true);
+        fused.update(data[t]);
+        separate.update(data[t]);
+
+        BOOST_CHECK( fused.getFusedCount() == 4 );
+
+        for ( int i=0; i<fused.size(); i++ )
+            BOOST_CHECK( fused.getData(i) == separate.getData(i) );
+
+        BOOST_CHECK( fused.getData(2).size() == fused.getData(0).size() );
+        BOOST_CHECK( fused.getData(2)[0] == 2 * fused.getData(0)[0] );
+    }
+}